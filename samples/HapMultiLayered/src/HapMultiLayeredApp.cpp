@@ -4,6 +4,7 @@
 
 #include "Resources.h"
 #include "MovieHap.h"
+#include "MovieHapCompositor.h"
 
 using namespace ci;
 using namespace ci::app;
@@ -16,7 +17,9 @@ class HapMultiLayeredApp : public App {
 	void update();
 	void draw();
 
-	qtime::MovieGlHapRef	mMovieBg, mMovieFront;
+	qtime::MovieGlHapRef			mMovieBg, mMovieFront;
+	//! Draws both movies in one pass, when they're the same size
+	qtime::MovieGlHapCompositorRef	mCompositor;
 };
 
 void HapMultiLayeredApp::setup()
@@ -33,11 +36,20 @@ void HapMultiLayeredApp::setup()
 	mMovieFront->setLoop();
 	mMovieFront->play();
 
+	mCompositor = qtime::MovieGlHapCompositor::create();
+	if( ! mCompositor->add( mMovieBg ) || ! mCompositor->add( mMovieFront ) )
+		mCompositor.reset();
+
 	gl::enableAlphaBlending();
 }
 
 void HapMultiLayeredApp::mouseDown( MouseEvent event )
 {
+	// Cycles the front layer through the blend modes
+	if( mCompositor ) {
+		const int mode = ( static_cast<int>( mCompositor->getBlendMode( mMovieFront ) ) + 1 ) % 4;
+		mCompositor->setBlendMode( mMovieFront, static_cast<qtime::MovieGlHapCompositor::BlendMode>( mode ) );
+	}
 }
 
 void HapMultiLayeredApp::update()
@@ -49,6 +61,11 @@ void HapMultiLayeredApp::draw()
 	gl::clear( Color::black() );
 	gl::viewport( toPixels( getWindowSize() ) );
 
+	if( mCompositor ) {
+		mCompositor->draw();
+		return;
+	}
+
 	if( mMovieBg ) {
 		mMovieBg->draw();
 	}
@@ -25,6 +25,7 @@
 
 // Cinder blocks
 #include "MovieHap.h"
+#include "MovieHapCueBank.h"
 #include "Warp.h"
 
 #include "PerfTracker.h"
@@ -77,7 +78,9 @@ public:
   void fileDrop(FileDropEvent event) override;
 
 private:
-  void loadMovieFile(const fs::path &path);
+  //! Cues the movie in slot \a index of the cue bank, and cuts to it once it's ready if \a cut is set
+  void loadMovieFile(const fs::path &path, int index = 1, bool cut = true);
+  void createInfoTexture(const fs::path &moviePath);
   void drawMovie();
   void updateMovieVolume();
 
@@ -91,7 +94,11 @@ private:
 private:
   // Hap video playback
   gl::TextureRef mInfoTexture;
+  //! The live movie of mCueBank, as of the last update()
   qtime::MovieGlHapRef mMovie;
+  //! Clips opened in the background, one per video index, so switching between them never shows black frames
+  qtime::MovieGlHapCueBankRef mCueBank;
+  std::map<int, fs::path> mMoviePaths;
   AppSettings mAppSettings;
 
   // Performance tracker
@@ -115,6 +122,7 @@ HapPlayerMultiscreenWarpApp::HapPlayerMultiscreenWarpApp()
   : mAppSettings()
   , mPerfTrackerVisible(false)
   , mUseBeginEnd(false)
+  , mCueBank(qtime::MovieGlHapCueBank::create())
 {
 }
 
@@ -172,6 +180,15 @@ void HapPlayerMultiscreenWarpApp::cleanup()
 
 void HapPlayerMultiscreenWarpApp::update()
 {
+  // Cuts happen here, between frames
+  mCueBank->update();
+  auto live = mCueBank->getLive();
+  if (live != mMovie)
+  {
+    mMovie = live;
+    updateMovieVolume();
+    createInfoTexture(mMoviePaths[mCueBank->getLiveIndex()]);
+  }
 }
 
 void HapPlayerMultiscreenWarpApp::draw()
@@ -307,7 +324,9 @@ void HapPlayerMultiscreenWarpApp::keyDown(KeyEvent event)
       break;
     }
     case KeyEvent::KEY_r:
-      // reset the movie
+      // reset the movie, and every clip cued
+      mCueBank = qtime::MovieGlHapCueBank::create();
+      mMoviePaths.clear();
       mMovie.reset();
       break;
     case KeyEvent::KEY_v:
@@ -374,20 +393,24 @@ void HapPlayerMultiscreenWarpApp::keyUp(KeyEvent event)
 
 void HapPlayerMultiscreenWarpApp::fileDrop(FileDropEvent event)
 {
-  loadMovieFile(event.getFile(0));
+  // Dropped files go to video indices 1, 2, 3... and the first one plays
+  for (size_t i = 0; i < event.getNumFiles(); ++i)
+    loadMovieFile(event.getFile(i), static_cast<int>(i) + 1, i == 0);
+}
+
+void HapPlayerMultiscreenWarpApp::loadMovieFile(const fs::path &moviePath, int index, bool cut)
+{
+  // The movie keeps playing until the new one is open and its first frame is uploaded
+  mCueBank->cue(index, moviePath);
+  mMoviePaths[index] = moviePath;
+  if (cut)
+    mCueBank->cut(index);
 }
 
-void HapPlayerMultiscreenWarpApp::loadMovieFile(const fs::path &moviePath)
+void HapPlayerMultiscreenWarpApp::createInfoTexture(const fs::path &moviePath)
 {
   try
   {
-    // load up the movie, set it to loop, and begin playing
-    mMovie.reset();
-    mMovie = qtime::MovieGlHap::create(moviePath);
-    updateMovieVolume();
-    mMovie->setLoop();
-    //mMovie->play();
-
     // create a texture for showing some info about the movie
     TextLayout infoText;
     infoText.clear(ColorA(0.2f, 0.2f, 0.2f, 0.5f));
@@ -403,10 +426,8 @@ void HapPlayerMultiscreenWarpApp::loadMovieFile(const fs::path &moviePath)
   }
   catch (...) 
   {
-    console() << "Unable to load the movie." << endl;
+    console() << "Unable to describe the movie." << endl;
     mInfoTexture.reset();
-
-    quit();
   }
 }
 
@@ -643,10 +664,14 @@ void HapPlayerMultiscreenWarpApp::onVideoIndexPressed(int idx)
   //message.addArg(idx);
   //mOscClient->send(message);
 
-  //mMovie->stop();
-  mMovie->seekToFrame(0);
-  //mMovie->seekToStart();
-  mMovie->play();
+  // Cut to the clip cued for this index, or restart the one playing
+  if (mMoviePaths.count(idx))
+    mCueBank->cut(idx);
+  else if (mMovie)
+  {
+    mMovie->seekToFrame(0);
+    mMovie->play();
+  }
 }
 
 CINDER_APP(HapPlayerMultiscreenWarpApp,
@@ -1044,8 +1044,8 @@ static void DoRendering (const float* worldMatrix, const float* identityMatrix,
         destRegion.front = 0;
         destRegion.back = 1;
 
-        // FIXME: what is logical explanation for this value?
-        auto rowPitch = width * 2;
+        // Rows of blocks come packed, 4 pixel rows each: width * 2 for DXT1, width * 4 for DXT5
+        auto rowPitch = dataLength / (height / 4);
 
         // Update subresource is bad!!!
         // ftp://download.nvidia.com/developer/cuda/seminar/TDCI_DX10perf_DX11preview.pdf
@@ -0,0 +1,148 @@
+/*
+ *  HapDecodeScheduler.cpp
+ *
+ *  Process-wide pool of decode threads shared by every playing Hap movie.
+ *
+ */
+
+#include "HapDecodeScheduler.h"
+#include "HapMovieDecoder.h"
+
+#include "cinder/Thread.h"
+
+#include <algorithm>
+
+namespace cinder { namespace hap {
+
+	namespace {
+		std::mutex						sInstanceMutex;
+		std::weak_ptr<DecodeScheduler>	sInstance;
+		size_t							sNumThreads = 0;
+	}
+
+	DecodeSchedulerRef DecodeScheduler::get()
+	{
+		std::lock_guard<std::mutex> lock( sInstanceMutex );
+		DecodeSchedulerRef scheduler = sInstance.lock();
+		if( ! scheduler ) {
+			size_t numThreads = sNumThreads;
+			if( numThreads == 0 )
+				numThreads = std::max<int>( 1, static_cast<int>( std::thread::hardware_concurrency() ) - 1 );
+			scheduler = DecodeSchedulerRef( new DecodeScheduler( numThreads ) );
+			sInstance = scheduler;
+		}
+		return scheduler;
+	}
+
+	void DecodeScheduler::setNumThreads( size_t numThreads )
+	{
+		std::lock_guard<std::mutex> lock( sInstanceMutex );
+		sNumThreads = numThreads;
+	}
+
+	DecodeScheduler::DecodeScheduler( size_t numThreads )
+	: mQuit( false ), mJobsRun( 0 ), mNotifications( 0 ), mNumIdle( 0 )
+	{
+		for( size_t i = 0; i < numThreads; i++ )
+			mThreads.push_back( std::thread( &DecodeScheduler::workerLoop, this ) );
+	}
+
+	DecodeScheduler::~DecodeScheduler()
+	{
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			mQuit = true;
+		}
+		mWakeCond.notify_all();
+		for( auto &thread : mThreads )
+			thread.join();
+	}
+
+	void DecodeScheduler::add( MovieDecoder *decoder )
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		Entry entry = { decoder, false };
+		mEntries.push_back( entry );
+	}
+
+	void DecodeScheduler::remove( MovieDecoder *decoder )
+	{
+		std::unique_lock<std::mutex> lock( mMutex );
+		auto findEntry = [&] { return std::find_if( mEntries.begin(), mEntries.end(), [=]( const Entry &entry ) { return entry.mDecoder == decoder; } ); };
+		mIdleCond.wait( lock, [&] { return ! findEntry()->mBusy; } );
+		mEntries.erase( findEntry() );
+	}
+
+	void DecodeScheduler::notify()
+	{
+		mNotifications++;
+		// A thread that has found nothing but isn't waiting yet holds the mutex, and would miss the wake-up. Taking it
+		// lets that thread reach the wait first. With no thread idle, the count alone is enough.
+		if( mNumIdle.load() > 0 ) {
+			mMutex.lock();
+			mMutex.unlock();
+		}
+		mWakeCond.notify_one();
+	}
+
+	void DecodeScheduler::workerLoop()
+	{
+		ThreadSetup threadSetup;
+
+		std::unique_lock<std::mutex> lock( mMutex );
+		while( ! mQuit ) {
+			const uint32_t notifications = mNotifications.load();
+
+			// Earliest deadline first among the movies that have something to decode and no job running
+			const Clock::time_point now = Clock::now();
+			Entry *next = nullptr;
+			Clock::time_point nextDeadline;
+			for( auto &entry : mEntries ) {
+				Clock::time_point deadline;
+				if( ! entry.mBusy && entry.mDecoder->prepareJob( now, &deadline ) && ( ! next || deadline < nextDeadline ) ) {
+					next = &entry;
+					nextDeadline = deadline;
+				}
+			}
+
+			if( ! next ) {
+				// Counted idle before the last look at mNotifications, so notify() either shows here or takes the mutex
+				mNumIdle++;
+				mWakeCond.wait( lock, [&] { return mQuit || mNotifications.load() != notifications; } );
+				mNumIdle--;
+				continue;
+			}
+
+			// The entry may move while the mutex is released, the decoder doesn't
+			MovieDecoder *decoder = next->mDecoder;
+			next->mBusy = true;
+			mJobsRun++;
+			lock.unlock();
+
+			decoder->runJob();
+
+			lock.lock();
+			for( auto &entry : mEntries ) {
+				if( entry.mDecoder == decoder )
+					entry.mBusy = false;
+			}
+			mIdleCond.notify_all();
+		}
+	}
+
+	DecodeScheduler::Stats DecodeScheduler::getStats() const
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		Stats stats;
+		stats.mNumThreads = static_cast<uint32_t>( mThreads.size() );
+		stats.mNumMovies = static_cast<uint32_t>( mEntries.size() );
+		stats.mJobsRun = mJobsRun;
+		for( const auto &entry : mEntries ) {
+			MovieDecoder::Stats decoderStats = entry.mDecoder->getStats();
+			stats.mFramesDropped += decoderStats.mFramesDropped;
+			stats.mLateFrames += decoderStats.mLateFrames;
+		}
+		return stats;
+	}
+
+} } // namespace cinder::hap
@@ -0,0 +1,82 @@
+/*
+ *  HapDecodeScheduler.h
+ *
+ *  Process-wide pool of decode threads shared by every playing Hap movie.
+ *
+ */
+#pragma once
+
+#include "cinder/Cinder.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cinder { namespace hap {
+
+	typedef std::shared_ptr<class DecodeScheduler> DecodeSchedulerRef;
+
+	//! Runs the decode jobs of all MovieDecoders on a fixed number of threads, earliest presentation deadline first.
+	//! Each movie has at most one job in flight, which keeps its frame ring single-producer. Frames that would
+	//! finish decoding after they were due to leave the screen are dropped unread.
+	class DecodeScheduler {
+	  public:
+		typedef std::chrono::steady_clock	Clock;
+
+		struct Stats {
+			Stats() : mNumThreads( 0 ), mNumMovies( 0 ), mJobsRun( 0 ), mFramesDropped( 0 ), mLateFrames( 0 ) {}
+
+			uint32_t	mNumThreads;
+			uint32_t	mNumMovies;
+			uint32_t	mJobsRun;
+			//! Frames skipped because they could no longer be decoded in time
+			uint32_t	mFramesDropped;
+			//! Frames that were decoded, but finished after they were due on screen
+			uint32_t	mLateFrames;
+		};
+
+		//! Returns the shared scheduler, starting it if no movie is using it. It stops when the last movie closes.
+		static DecodeSchedulerRef	get();
+		//! Number of threads used the next time the scheduler starts. Defaults to one less than the number of cores.
+		static void					setNumThreads( size_t numThreads );
+
+		~DecodeScheduler();
+
+		//! Wakes an idle thread to look for work. Safe to call from the render thread: it only takes the mutex while a
+		//! thread is idle, and then waits at most for another thread's look for work.
+		void		notify();
+		Stats		getStats() const;
+
+	  private:
+		DecodeScheduler( size_t numThreads );
+
+		friend class MovieDecoder;
+		void		add( class MovieDecoder *decoder );
+		//! Waits for the decoder's job to finish if one is running
+		void		remove( class MovieDecoder *decoder );
+
+		void		workerLoop();
+
+		struct Entry {
+			class MovieDecoder	*mDecoder;
+			bool				mBusy;
+		};
+
+		std::vector<std::thread>	mThreads;
+		mutable std::mutex			mMutex;
+		std::condition_variable		mWakeCond;
+		//! Signalled when a job finishes, for remove()
+		std::condition_variable		mIdleCond;
+		std::vector<Entry>			mEntries;
+		bool						mQuit;
+		uint32_t					mJobsRun;
+		//! Bumped by every notify(), so a thread that looked for work before it sees there may be more
+		std::atomic<uint32_t>		mNotifications;
+		//! Threads waiting on mWakeCond, or about to
+		std::atomic<uint32_t>		mNumIdle;
+	};
+
+} } // namespace cinder::hap
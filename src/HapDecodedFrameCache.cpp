@@ -0,0 +1,111 @@
+/*
+ *  HapDecodedFrameCache.cpp
+ *
+ *  Keeps the decoded DXT frames of short loops so later passes skip decoding altogether.
+ *
+ */
+
+#include "HapDecodedFrameCache.h"
+
+#include <iterator>
+#include <unordered_set>
+
+namespace cinder { namespace hap {
+
+	namespace {
+		std::mutex	sBudgetMutex;
+		size_t		sBudget = 512 * 1024 * 1024;
+		size_t		sReservedBytes = 0;
+		size_t		sBytes = 0;
+		uint32_t	sNumMovies = 0;
+	}
+
+	DecodedFrameCacheRef DecodedFrameCache::create( const MovieReaderRef &reader )
+	{
+		// Frames stored once are decoded once
+		std::unordered_set<uint64_t> offsets;
+		for( const auto &sample : reader->getSamples() )
+			offsets.insert( sample.mOffset );
+		const size_t bytes = offsets.size() * getDxtSize( reader->getCodec(), reader->getWidth(), reader->getHeight() );
+
+		std::lock_guard<std::mutex> lock( sBudgetMutex );
+		if( sReservedBytes + bytes > sBudget )
+			return nullptr;
+		sReservedBytes += bytes;
+		sNumMovies++;
+		return DecodedFrameCacheRef( new DecodedFrameCache( reader, bytes ) );
+	}
+
+	void DecodedFrameCache::setBudget( size_t bytes )
+	{
+		std::lock_guard<std::mutex> lock( sBudgetMutex );
+		sBudget = bytes;
+	}
+
+	DecodedFrameCache::Stats DecodedFrameCache::getStats()
+	{
+		std::lock_guard<std::mutex> lock( sBudgetMutex );
+		Stats stats;
+		stats.mBudget = sBudget;
+		stats.mReservedBytes = sReservedBytes;
+		stats.mBytes = sBytes;
+		stats.mNumMovies = sNumMovies;
+		return stats;
+	}
+
+	DecodedFrameCache::~DecodedFrameCache()
+	{
+		std::lock_guard<std::mutex> lock( sBudgetMutex );
+		sReservedBytes -= mReservedBytes;
+		sBytes -= mBytes;
+		sNumMovies--;
+	}
+
+	DecodedFrameCache::DataRef DecodedFrameCache::get( size_t sample, uint8_t *textureFormat ) const
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		auto it = mEntries.find( mReader->getSample( sample ).mOffset );
+		if( it == mEntries.end() )
+			return nullptr;
+		*textureFormat = it->second.mTextureFormat;
+		return it->second.mDxt;
+	}
+
+	void DecodedFrameCache::put( size_t sample, uint8_t textureFormat, const DataRef &dxt )
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		const uint64_t offset = mReader->getSample( sample ).mOffset;
+		if( mEntries.count( offset ) ) {
+			mSamples.insert( sample );
+			return;
+		}
+		// Only a frame of an unexpected size could outgrow the reservation. It isn't kept, and is decoded every time.
+		if( mBytes + dxt->size() > mReservedBytes )
+			return;
+
+		Entry entry = { textureFormat, dxt };
+		mEntries.insert( std::make_pair( offset, entry ) );
+		mSamples.insert( sample );
+		mBytes += dxt->size();
+		std::lock_guard<std::mutex> budgetLock( sBudgetMutex );
+		sBytes += dxt->size();
+	}
+
+	size_t DecodedFrameCache::findNearest( size_t sample ) const
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		auto after = mSamples.lower_bound( sample );
+		if( after == mSamples.begin() )
+			return after != mSamples.end() ? *after : SIZE_MAX;
+
+		auto before = std::prev( after );
+		return after != mSamples.end() && *after - sample < sample - *before ? *after : *before;
+	}
+
+	size_t DecodedFrameCache::getBytes() const
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		return mBytes;
+	}
+
+} } // namespace cinder::hap
@@ -0,0 +1,75 @@
+/*
+ *  HapDecodedFrameCache.h
+ *
+ *  Keeps the decoded DXT frames of short loops so later passes skip decoding altogether.
+ *
+ */
+#pragma once
+
+#include "HapMovieReader.h"
+
+#include "cinder/Cinder.h"
+
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+namespace cinder { namespace hap {
+
+	typedef std::shared_ptr<class DecodedFrameCache> DecodedFrameCacheRef;
+
+	//! Holds the decoded frames of one movie, filled as they are decoded. A movie is cached whole or not at all,
+	//! because a loop that only partly fits would evict every frame before it comes round again. Its decoded size is
+	//! reserved from a process-wide budget when the cache is created.
+	class DecodedFrameCache {
+	  public:
+		typedef std::shared_ptr<const std::vector<uint8_t>>	DataRef;
+
+		struct Stats {
+			Stats() : mBudget( 0 ), mReservedBytes( 0 ), mBytes( 0 ), mNumMovies( 0 ) {}
+
+			size_t		mBudget;
+			//! Decoded size of every cached movie, whether its frames have been decoded yet or not
+			size_t		mReservedBytes;
+			size_t		mBytes;
+			uint32_t	mNumMovies;
+		};
+
+		//! Returns nullptr if the decoded frames of \a reader don't fit in what's left of the budget.
+		static DecodedFrameCacheRef	create( const MovieReaderRef &reader );
+		//! Bytes of decoded frames all movies together may hold. Defaults to 512 MB. Movies already cached keep their frames.
+		static void					setBudget( size_t bytes );
+		static Stats				getStats();
+
+		~DecodedFrameCache();
+
+		//! The decoded frame of \a sample and its texture format, or nullptr if it hasn't been decoded yet
+		DataRef		get( size_t sample, uint8_t *textureFormat ) const;
+		//! Keeps the decoded frame of \a sample, unless it would take the cache past its reservation
+		void		put( size_t sample, uint8_t textureFormat, const DataRef &dxt );
+		//! The decoded sample closest to \a sample, or SIZE_MAX if none has been decoded yet
+		size_t		findNearest( size_t sample ) const;
+
+		size_t		getReservedBytes() const { return mReservedBytes; }
+		size_t		getBytes() const;
+
+	  private:
+		DecodedFrameCache( const MovieReaderRef &reader, size_t reservedBytes ) : mReader( reader ), mReservedBytes( reservedBytes ), mBytes( 0 ) {}
+
+		struct Entry {
+			uint8_t		mTextureFormat;
+			DataRef		mDxt;
+		};
+
+		MovieReaderRef		mReader;
+		size_t				mReservedBytes;
+
+		mutable std::mutex	mMutex;
+		//! Keyed by sample offset, so frames stored once are cached once
+		std::unordered_map<uint64_t, Entry>	mEntries;
+		//! Samples whose frames are kept
+		std::set<size_t>	mSamples;
+		size_t				mBytes;
+	};
+
+} } // namespace cinder::hap
@@ -0,0 +1,105 @@
+/*
+ *  HapDecoder.cpp
+ *
+ *  Unpacks Hap frames to DXT textures.
+ *
+ */
+
+#include "HapDecoder.h"
+#include "HapSnappy.h"
+
+#include <cstring>
+
+namespace cinder { namespace hap {
+
+	namespace {
+		uint32_t read32( const uint8_t *p ) { return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( static_cast<uint32_t>( p[3] ) << 24 ); }
+
+		//! Appends the decompressed form of one chunk or frame payload to \a dxt
+		void decompress( uint8_t compressor, const uint8_t *source, size_t sourceLength, std::vector<uint8_t> *dxt )
+		{
+			const size_t start = dxt->size();
+			if( compressor == ( COMPRESSOR_NONE >> 4 ) ) {
+				dxt->resize( start + sourceLength );
+				memcpy( dxt->data() + start, source, sourceLength );
+			}
+			else if( compressor == ( COMPRESSOR_SNAPPY >> 4 ) ) {
+				size_t length;
+				if( ! snappy::getUncompressedLength( source, sourceLength, &length ) )
+					throw DecoderExc( "Malformed Snappy preamble." );
+				dxt->resize( start + length );
+				if( ! snappy::uncompress( source, sourceLength, dxt->data() + start, length ) )
+					throw DecoderExc( "Corrupt Snappy data." );
+			}
+			else {
+				throw DecoderExc( "Unsupported compressor." );
+			}
+		}
+	} // anonymous namespace
+
+	uint8_t decodeFrame( const uint8_t *frame, size_t size, std::vector<uint8_t> *dxt )
+	{
+		size_t headerLength, sectionLength;
+		uint8_t type;
+		if( ! readSectionHeader( frame, size, &headerLength, &sectionLength, &type ) )
+			throw DecoderExc( "Malformed frame header." );
+
+		const uint8_t textureFormat = type & 0x0f;
+		if( textureFormat != TEXTURE_RGB_DXT1 && textureFormat != TEXTURE_RGBA_DXT5 && textureFormat != TEXTURE_YCOCG_DXT5 )
+			throw DecoderExc( "Unsupported texture format." );
+
+		const uint8_t *payload = frame + headerLength;
+		dxt->clear();
+
+		if( ( type & 0xf0 ) != COMPRESSOR_COMPLEX ) {
+			decompress( type >> 4, payload, sectionLength, dxt );
+			return textureFormat;
+		}
+
+		// Chunked frame: decode instructions, then the chunks back to back
+		size_t instructionsHeader, instructionsLength;
+		uint8_t instructionsType;
+		if( ! readSectionHeader( payload, sectionLength, &instructionsHeader, &instructionsLength, &instructionsType )
+			|| instructionsType != SECTION_DECODE_INSTRUCTIONS )
+			throw DecoderExc( "Missing decode instructions." );
+
+		const uint8_t *compressors = nullptr, *sizes = nullptr, *offsets = nullptr;
+		size_t chunkCount = 0, sizesLength = 0, offsetsLength = 0;
+		const uint8_t *instruction = payload + instructionsHeader;
+		const uint8_t *instructionsEnd = instruction + instructionsLength;
+		while( instruction < instructionsEnd ) {
+			size_t header, length;
+			uint8_t sectionType;
+			if( ! readSectionHeader( instruction, instructionsEnd - instruction, &header, &length, &sectionType ) )
+				throw DecoderExc( "Malformed decode instructions." );
+
+			const uint8_t *data = instruction + header;
+			switch( sectionType ) {
+				case SECTION_CHUNK_COMPRESSORS:	compressors = data; chunkCount = length; break;
+				case SECTION_CHUNK_SIZES:		sizes = data; sizesLength = length; break;
+				case SECTION_CHUNK_OFFSETS:		offsets = data; offsetsLength = length; break;
+				default:						break;
+			}
+			instruction = data + length;
+		}
+		if( ! compressors || ! sizes || chunkCount == 0 || sizesLength < 4 * chunkCount || ( offsets && offsetsLength < 4 * chunkCount ) )
+			throw DecoderExc( "Incomplete decode instructions." );
+
+		const uint8_t *chunks = instructionsEnd;
+		const size_t chunksLength = sectionLength - ( instructionsEnd - payload );
+		size_t offset = 0;
+		for( size_t chunk = 0; chunk < chunkCount; chunk++ ) {
+			size_t chunkSize = read32( sizes + 4 * chunk );
+			if( offsets )
+				offset = read32( offsets + 4 * chunk );
+			if( offset > chunksLength || chunkSize > chunksLength - offset )
+				throw DecoderExc( "Chunk overruns frame." );
+
+			decompress( compressors[chunk], chunks + offset, chunkSize, dxt );
+			offset += chunkSize;
+		}
+
+		return textureFormat;
+	}
+
+} } // namespace cinder::hap
@@ -0,0 +1,26 @@
+/*
+ *  HapDecoder.h
+ *
+ *  Unpacks Hap frames to the DXT textures they carry, without going through QuickTime.
+ *
+ */
+#pragma once
+
+#include "HapFormat.h"
+
+#include "cinder/Exception.h"
+
+#include <vector>
+
+namespace cinder { namespace hap {
+
+	//! Decompresses the Hap frame \a frame into \a dxt and returns its texture format (TEXTURE_RGB_DXT1, TEXTURE_RGBA_DXT5
+	//! or TEXTURE_YCOCG_DXT5). Handles uncompressed, Snappy and chunked frames. Throws DecoderExc on malformed input.
+	uint8_t		decodeFrame( const uint8_t *frame, size_t size, std::vector<uint8_t> *dxt );
+
+	class DecoderExc : public Exception {
+	  public:
+		DecoderExc( const std::string &description ) : Exception( description ) {}
+	};
+
+} } // namespace cinder::hap
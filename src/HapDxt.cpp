@@ -0,0 +1,400 @@
+/*
+ *  HapDxt.cpp
+ *
+ *  S3TC block compression and decompression for the three Hap texture formats.
+ *
+ *  Colour endpoints are fitted along the principal axis of the block and then refined with a
+ *  least-squares pass, in the spirit of stb_dxt and libsquish's range fit.
+ *
+ */
+
+#include "HapDxt.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace cinder { namespace hap { namespace dxt {
+
+	namespace {
+		inline int clamp255( int v )
+		{
+			return v < 0 ? 0 : ( v > 255 ? 255 : v );
+		}
+
+		inline uint16_t pack565( const int *c )
+		{
+			int r = ( clamp255( c[0] ) * 31 + 127 ) / 255;
+			int g = ( clamp255( c[1] ) * 63 + 127 ) / 255;
+			int b = ( clamp255( c[2] ) * 31 + 127 ) / 255;
+			return static_cast<uint16_t>( ( r << 11 ) | ( g << 5 ) | b );
+		}
+
+		inline void unpack565( uint16_t v, int *c )
+		{
+			int r = ( v >> 11 ) & 31, g = ( v >> 5 ) & 63, b = v & 31;
+			c[0] = ( r << 3 ) | ( r >> 2 );
+			c[1] = ( g << 2 ) | ( g >> 4 );
+			c[2] = ( b << 3 ) | ( b >> 2 );
+		}
+
+		// Builds the four-colour palette and picks the nearest entry for every pixel. Returns the summed squared error.
+		int computeIndices( const uint8_t *rgba, uint16_t c0, uint16_t c1, uint32_t *indices )
+		{
+			int palette[4][3];
+			unpack565( c0, palette[0] );
+			unpack565( c1, palette[1] );
+			for( int c = 0; c < 3; c++ ) {
+				palette[2][c] = ( 2 * palette[0][c] + palette[1][c] ) / 3;
+				palette[3][c] = ( palette[0][c] + 2 * palette[1][c] ) / 3;
+			}
+
+			uint32_t result = 0;
+			int totalError = 0;
+			for( int i = 0; i < 16; i++ ) {
+				const uint8_t *px = rgba + i * 4;
+				int best = 0, bestError = INT32_MAX;
+				for( int p = 0; p < 4; p++ ) {
+					int dr = px[0] - palette[p][0], dg = px[1] - palette[p][1], db = px[2] - palette[p][2];
+					int error = dr * dr + dg * dg + db * db;
+					if( error < bestError ) {
+						bestError = error;
+						best = p;
+					}
+				}
+				result |= static_cast<uint32_t>( best ) << ( 2 * i );
+				totalError += bestError;
+			}
+			*indices = result;
+			return totalError;
+		}
+
+		// Solves for the endpoints that minimise the error of the given index assignment
+		bool refineEndpoints( const uint8_t *rgba, uint32_t indices, int *max, int *min )
+		{
+			static const float kWeights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+
+			float aa = 0, bb = 0, ab = 0;
+			float ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+			for( int i = 0; i < 16; i++ ) {
+				float a = kWeights[( indices >> ( 2 * i ) ) & 3];
+				float b = 1.0f - a;
+				aa += a * a;
+				bb += b * b;
+				ab += a * b;
+				for( int c = 0; c < 3; c++ ) {
+					ax[c] += a * rgba[i * 4 + c];
+					bx[c] += b * rgba[i * 4 + c];
+				}
+			}
+
+			float det = aa * bb - ab * ab;
+			if( std::fabs( det ) < 1e-6f )
+				return false;
+
+			float inv = 1.0f / det;
+			for( int c = 0; c < 3; c++ ) {
+				max[c] = clamp255( static_cast<int>( ( bb * ax[c] - ab * bx[c] ) * inv + 0.5f ) );
+				min[c] = clamp255( static_cast<int>( ( aa * bx[c] - ab * ax[c] ) * inv + 0.5f ) );
+			}
+			return true;
+		}
+
+		// Endpoints from the pixels at either end of the block's principal axis
+		void fitPrincipalAxis( const uint8_t *rgba, int *max, int *min )
+		{
+			float mean[3] = { 0, 0, 0 };
+			for( int i = 0; i < 16; i++ )
+				for( int c = 0; c < 3; c++ )
+					mean[c] += rgba[i * 4 + c];
+			for( int c = 0; c < 3; c++ )
+				mean[c] /= 16.0f;
+
+			float cov[6] = { 0, 0, 0, 0, 0, 0 };
+			for( int i = 0; i < 16; i++ ) {
+				float r = rgba[i * 4 + 0] - mean[0], g = rgba[i * 4 + 1] - mean[1], b = rgba[i * 4 + 2] - mean[2];
+				cov[0] += r * r;
+				cov[1] += r * g;
+				cov[2] += r * b;
+				cov[3] += g * g;
+				cov[4] += g * b;
+				cov[5] += b * b;
+			}
+
+			// Power iteration, seeded with the largest variance channel
+			float axis[3] = { cov[0], cov[3], cov[5] };
+			for( int iter = 0; iter < 4; iter++ ) {
+				float x = axis[0] * cov[0] + axis[1] * cov[1] + axis[2] * cov[2];
+				float y = axis[0] * cov[1] + axis[1] * cov[3] + axis[2] * cov[4];
+				float z = axis[0] * cov[2] + axis[1] * cov[4] + axis[2] * cov[5];
+				float m = std::max( std::fabs( x ), std::max( std::fabs( y ), std::fabs( z ) ) );
+				if( m < 1e-6f )
+					break;
+				axis[0] = x / m;
+				axis[1] = y / m;
+				axis[2] = z / m;
+			}
+
+			int minIndex = 0, maxIndex = 0;
+			float minDot = 1e30f, maxDot = -1e30f;
+			for( int i = 0; i < 16; i++ ) {
+				float d = rgba[i * 4 + 0] * axis[0] + rgba[i * 4 + 1] * axis[1] + rgba[i * 4 + 2] * axis[2];
+				if( d < minDot ) {
+					minDot = d;
+					minIndex = i;
+				}
+				if( d > maxDot ) {
+					maxDot = d;
+					maxIndex = i;
+				}
+			}
+
+			for( int c = 0; c < 3; c++ ) {
+				max[c] = rgba[maxIndex * 4 + c];
+				min[c] = rgba[minIndex * 4 + c];
+			}
+		}
+
+		// Endpoints from the inset bounding box, as in "Real-Time DXT Compression" (van Waveren, 2006)
+		void fitBoundingBox( const uint8_t *rgba, int *max, int *min )
+		{
+			for( int c = 0; c < 3; c++ ) {
+				max[c] = 0;
+				min[c] = 255;
+			}
+			for( int i = 0; i < 16; i++ ) {
+				for( int c = 0; c < 3; c++ ) {
+					max[c] = std::max<int>( max[c], rgba[i * 4 + c] );
+					min[c] = std::min<int>( min[c], rgba[i * 4 + c] );
+				}
+			}
+			for( int c = 0; c < 3; c++ ) {
+				int inset = ( max[c] - min[c] ) >> 4;
+				max[c] -= inset;
+				min[c] += inset;
+			}
+		}
+
+		void writeColorBlock( uint16_t c0, uint16_t c1, uint32_t indices, uint8_t *dest )
+		{
+			// c0 > c1 selects four-colour mode; swapping endpoints maps indices 0<->1 and 2<->3
+			if( c0 < c1 ) {
+				std::swap( c0, c1 );
+				indices ^= 0x55555555;
+			}
+			else if( c0 == c1 ) {
+				indices = 0;
+			}
+			dest[0] = static_cast<uint8_t>( c0 & 0xff );
+			dest[1] = static_cast<uint8_t>( c0 >> 8 );
+			dest[2] = static_cast<uint8_t>( c1 & 0xff );
+			dest[3] = static_cast<uint8_t>( c1 >> 8 );
+			for( int i = 0; i < 4; i++ )
+				dest[4 + i] = static_cast<uint8_t>( indices >> ( 8 * i ) );
+		}
+
+		void compressColorBlock( const uint8_t *rgba, uint8_t *dest, Quality quality )
+		{
+			int max[3], min[3];
+			if( quality == Quality::FAST )
+				fitBoundingBox( rgba, max, min );
+			else
+				fitPrincipalAxis( rgba, max, min );
+
+			uint16_t c0 = pack565( max ), c1 = pack565( min );
+			uint32_t indices;
+			int error = computeIndices( rgba, c0, c1, &indices );
+
+			if( quality == Quality::HIGH && error > 0 && refineEndpoints( rgba, indices, max, min ) ) {
+				uint16_t r0 = pack565( max ), r1 = pack565( min );
+				uint32_t refined;
+				if( computeIndices( rgba, r0, r1, &refined ) < error ) {
+					c0 = r0;
+					c1 = r1;
+					indices = refined;
+				}
+			}
+
+			writeColorBlock( c0, c1, indices, dest );
+		}
+
+		// Eight interpolated levels between the block's alpha extremes
+		void compressAlphaBlock( const uint8_t *rgba, uint8_t *dest )
+		{
+			int a0 = 0, a1 = 255;
+			for( int i = 0; i < 16; i++ ) {
+				a0 = std::max<int>( a0, rgba[i * 4 + 3] );
+				a1 = std::min<int>( a1, rgba[i * 4 + 3] );
+			}
+
+			dest[0] = static_cast<uint8_t>( a0 );
+			dest[1] = static_cast<uint8_t>( a1 );
+
+			uint64_t bits = 0;
+			if( a0 > a1 ) {
+				int palette[8] = { a0, a1 };
+				for( int i = 2; i < 8; i++ )
+					palette[i] = ( ( 8 - i ) * a0 + ( i - 1 ) * a1 ) / 7;
+
+				for( int i = 0; i < 16; i++ ) {
+					int a = rgba[i * 4 + 3];
+					int best = 0, bestError = 256;
+					for( int p = 0; p < 8; p++ ) {
+						int error = std::abs( a - palette[p] );
+						if( error < bestError ) {
+							bestError = error;
+							best = p;
+						}
+					}
+					bits |= static_cast<uint64_t>( best ) << ( 3 * i );
+				}
+			}
+
+			for( int i = 0; i < 6; i++ )
+				dest[2 + i] = static_cast<uint8_t>( bits >> ( 8 * i ) );
+		}
+
+		void decompressColorBlock( const uint8_t *block, uint8_t *rgba )
+		{
+			const uint16_t c0 = static_cast<uint16_t>( block[0] | ( block[1] << 8 ) );
+			const uint16_t c1 = static_cast<uint16_t>( block[2] | ( block[3] << 8 ) );
+			int palette[4][3];
+			unpack565( c0, palette[0] );
+			unpack565( c1, palette[1] );
+			for( int c = 0; c < 3; c++ ) {
+				if( c0 > c1 ) {
+					palette[2][c] = ( 2 * palette[0][c] + palette[1][c] ) / 3;
+					palette[3][c] = ( palette[0][c] + 2 * palette[1][c] ) / 3;
+				}
+				else {
+					// Three-colour mode, the fourth entry is black
+					palette[2][c] = ( palette[0][c] + palette[1][c] ) / 2;
+					palette[3][c] = 0;
+				}
+			}
+
+			const uint32_t indices = block[4] | ( block[5] << 8 ) | ( block[6] << 16 ) | ( static_cast<uint32_t>( block[7] ) << 24 );
+			for( int i = 0; i < 16; i++ ) {
+				const int *color = palette[( indices >> ( 2 * i ) ) & 3];
+				rgba[i * 4 + 0] = static_cast<uint8_t>( color[0] );
+				rgba[i * 4 + 1] = static_cast<uint8_t>( color[1] );
+				rgba[i * 4 + 2] = static_cast<uint8_t>( color[2] );
+			}
+		}
+
+		void decompressAlphaBlock( const uint8_t *block, uint8_t *rgba )
+		{
+			const int a0 = block[0], a1 = block[1];
+			int palette[8] = { a0, a1 };
+			if( a0 > a1 ) {
+				for( int i = 2; i < 8; i++ )
+					palette[i] = ( ( 8 - i ) * a0 + ( i - 1 ) * a1 ) / 7;
+			}
+			else {
+				for( int i = 2; i < 6; i++ )
+					palette[i] = ( ( 6 - i ) * a0 + ( i - 1 ) * a1 ) / 5;
+				palette[6] = 0;
+				palette[7] = 255;
+			}
+
+			uint64_t bits = 0;
+			for( int i = 0; i < 6; i++ )
+				bits |= static_cast<uint64_t>( block[2 + i] ) << ( 8 * i );
+			for( int i = 0; i < 16; i++ )
+				rgba[i * 4 + 3] = static_cast<uint8_t>( palette[( bits >> ( 3 * i ) ) & 7] );
+		}
+	} // anonymous namespace
+
+	void compressBlockDxt1( const uint8_t *rgba, uint8_t *dest, Quality quality )
+	{
+		compressColorBlock( rgba, dest, quality );
+	}
+
+	void compressBlockDxt5( const uint8_t *rgba, uint8_t *dest, Quality quality )
+	{
+		compressAlphaBlock( rgba, dest );
+		compressColorBlock( rgba, dest + 8, quality );
+	}
+
+	void compressBlockYCoCgDxt5( const uint8_t *rgba, uint8_t *dest, Quality quality )
+	{
+		float co[16], cg[16];
+		float range = 0.0f;
+		uint8_t ycocg[64];
+		for( int i = 0; i < 16; i++ ) {
+			int r = rgba[i * 4 + 0], g = rgba[i * 4 + 1], b = rgba[i * 4 + 2];
+			co[i] = ( r - b ) * 0.5f;
+			cg[i] = ( -r + 2 * g - b ) * 0.25f;
+			ycocg[i * 4 + 3] = static_cast<uint8_t>( ( r + 2 * g + b + 2 ) / 4 );
+			range = std::max( range, std::max( std::fabs( co[i] ), std::fabs( cg[i] ) ) );
+		}
+
+		// Low-chroma blocks get their CoCg scaled up for precision; the scale is stored in blue as ( scale - 1 ) * 8
+		int scale = 1;
+		if( range < 32.0f )
+			scale = 4;
+		else if( range < 64.0f )
+			scale = 2;
+
+		for( int i = 0; i < 16; i++ ) {
+			ycocg[i * 4 + 0] = static_cast<uint8_t>( clamp255( static_cast<int>( std::floor( co[i] * scale + 128.5f ) ) ) );
+			ycocg[i * 4 + 1] = static_cast<uint8_t>( clamp255( static_cast<int>( std::floor( cg[i] * scale + 128.5f ) ) ) );
+			ycocg[i * 4 + 2] = static_cast<uint8_t>( ( scale - 1 ) * 8 );
+		}
+
+		compressAlphaBlock( ycocg, dest );
+		compressColorBlock( ycocg, dest + 8, quality );
+	}
+
+	void decompressBlockDxt1( const uint8_t *block, uint8_t *rgba )
+	{
+		decompressColorBlock( block, rgba );
+		for( int i = 0; i < 16; i++ )
+			rgba[i * 4 + 3] = 255;
+	}
+
+	void decompressBlockDxt5( const uint8_t *block, uint8_t *rgba )
+	{
+		decompressColorBlock( block + 8, rgba );
+		decompressAlphaBlock( block, rgba );
+	}
+
+	void decompressBlockYCoCgDxt5( const uint8_t *block, uint8_t *rgba )
+	{
+		decompressBlockDxt5( block, rgba );
+		for( int i = 0; i < 16; i++ ) {
+			uint8_t *px = rgba + i * 4;
+			const float scale = px[2] / 8.0f + 1.0f;
+			const float co = ( px[0] - 128 ) / scale, cg = ( px[1] - 128 ) / scale;
+			const float y = px[3];
+			px[0] = static_cast<uint8_t>( clamp255( static_cast<int>( std::floor( y + co - cg + 0.5f ) ) ) );
+			px[1] = static_cast<uint8_t>( clamp255( static_cast<int>( std::floor( y + cg + 0.5f ) ) ) );
+			px[2] = static_cast<uint8_t>( clamp255( static_cast<int>( std::floor( y - co - cg + 0.5f ) ) ) );
+			px[3] = 255;
+		}
+	}
+
+	void insertBlock( const uint8_t *block, int32_t width, int32_t height, ptrdiff_t rowBytes, int32_t x, int32_t y, uint8_t *rgba )
+	{
+		const int32_t columns = std::min( 4, width - x ), rows = std::min( 4, height - y );
+		for( int row = 0; row < rows; row++ )
+			memcpy( rgba + ( y + row ) * rowBytes + x * 4, block + row * 16, columns * 4 );
+	}
+
+	void extractBlock( const uint8_t *rgba, int32_t width, int32_t height, ptrdiff_t rowBytes, int32_t x, int32_t y, uint8_t *block )
+	{
+		if( x + 4 <= width && y + 4 <= height ) {
+			for( int row = 0; row < 4; row++ )
+				memcpy( block + row * 16, rgba + ( y + row ) * rowBytes + x * 4, 16 );
+			return;
+		}
+
+		for( int row = 0; row < 4; row++ ) {
+			const uint8_t *src = rgba + std::min( y + row, height - 1 ) * rowBytes;
+			for( int col = 0; col < 4; col++ )
+				memcpy( block + row * 16 + col * 4, src + std::min( x + col, width - 1 ) * 4, 4 );
+		}
+	}
+
+} } } // namespace cinder::hap::dxt
@@ -0,0 +1,40 @@
+/*
+ *  HapDxt.h
+ *
+ *  S3TC block compression and decompression for the three Hap texture formats.
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cinder { namespace hap { namespace dxt {
+
+	//! Size in bytes of a single compressed 4x4 block
+	const size_t kDxt1BlockSize = 8;
+	const size_t kDxt5BlockSize = 16;
+
+	//! FAST fits endpoints to the block's bounding box, HIGH to its principal axis followed by a least-squares refinement.
+	enum class Quality { FAST, HIGH };
+
+	//! Compresses a 4x4 block of RGBA pixels (64 bytes, row-major) to DXT1, ignoring alpha.
+	void	compressBlockDxt1( const uint8_t *rgba, uint8_t *dest, Quality quality = Quality::HIGH );
+	//! Compresses a 4x4 block of RGBA pixels to DXT5.
+	void	compressBlockDxt5( const uint8_t *rgba, uint8_t *dest, Quality quality = Quality::HIGH );
+	//! Converts a 4x4 block of RGBA pixels to scaled YCoCg and compresses it to DXT5, as expected by ScaledCoCgYToRGBA.frag.
+	void	compressBlockYCoCgDxt5( const uint8_t *rgba, uint8_t *dest, Quality quality = Quality::HIGH );
+
+	//! Copies the 4x4 block at (\a x, \a y) out of an RGBA image, clamping reads at the right and bottom edges.
+	void	extractBlock( const uint8_t *rgba, int32_t width, int32_t height, ptrdiff_t rowBytes, int32_t x, int32_t y, uint8_t *block );
+
+	//! Decompresses a DXT1 block to a 4x4 block of RGBA pixels. Alpha is always opaque, as for GL_COMPRESSED_RGB_S3TC_DXT1_EXT.
+	void	decompressBlockDxt1( const uint8_t *block, uint8_t *rgba );
+	void	decompressBlockDxt5( const uint8_t *block, uint8_t *rgba );
+	//! Decompresses a scaled YCoCg DXT5 block and converts it back to RGB, as ScaledCoCgYToRGBA.frag does. Alpha is opaque.
+	void	decompressBlockYCoCgDxt5( const uint8_t *block, uint8_t *rgba );
+
+	//! Copies a 4x4 block of RGBA pixels to (\a x, \a y) in an RGBA image, dropping the pixels past the right and bottom edges.
+	void	insertBlock( const uint8_t *block, int32_t width, int32_t height, ptrdiff_t rowBytes, int32_t x, int32_t y, uint8_t *rgba );
+
+} } } // namespace cinder::hap::dxt
@@ -0,0 +1,253 @@
+/*
+ *  HapEncoder.cpp
+ *
+ *  Converts RGBA frames to Hap, Hap Alpha or Hap Q frames.
+ *
+ */
+
+#include "HapEncoder.h"
+#include "HapSnappy.h"
+
+#include "cinder/Thread.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace cinder { namespace hap {
+
+	// Runs a function over a number of bands on persistent worker threads. The calling thread takes part and run() returns once every band is done.
+	class Encoder::BandPool {
+	  public:
+		BandPool( uint32_t numThreads )
+		: mFn( nullptr ), mNumBands( 0 ), mNextBand( 0 ), mBandsDone( 0 ), mQuit( false )
+		{
+			for( uint32_t i = 1; i < numThreads; i++ )
+				mThreads.emplace_back( &BandPool::workerLoop, this );
+		}
+
+		~BandPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock( mMutex );
+				mQuit = true;
+			}
+			mWorkCond.notify_all();
+			for( auto &thread : mThreads )
+				thread.join();
+		}
+
+		void run( uint32_t numBands, const std::function<void( uint32_t )> &fn )
+		{
+			std::unique_lock<std::mutex> lock( mMutex );
+			mFn = &fn;
+			mNumBands = numBands;
+			mNextBand = 0;
+			mBandsDone = 0;
+			mWorkCond.notify_all();
+
+			while( mNextBand < mNumBands ) {
+				uint32_t band = mNextBand++;
+				lock.unlock();
+				fn( band );
+				lock.lock();
+				mBandsDone++;
+			}
+
+			mDoneCond.wait( lock, [this] { return mBandsDone == mNumBands; } );
+			mFn = nullptr;
+			mNumBands = mNextBand = mBandsDone = 0;
+		}
+
+	  private:
+		void workerLoop()
+		{
+			ThreadSetup threadSetup;
+
+			std::unique_lock<std::mutex> lock( mMutex );
+			for(;;) {
+				mWorkCond.wait( lock, [this] { return mQuit || mNextBand < mNumBands; } );
+				if( mQuit )
+					return;
+
+				uint32_t band = mNextBand++;
+				const std::function<void( uint32_t )> *fn = mFn;
+				lock.unlock();
+				( *fn )( band );
+				lock.lock();
+
+				if( ++mBandsDone == mNumBands )
+					mDoneCond.notify_all();
+			}
+		}
+
+		std::vector<std::thread>				mThreads;
+		std::mutex								mMutex;
+		std::condition_variable					mWorkCond, mDoneCond;
+		const std::function<void( uint32_t )>	*mFn;
+		uint32_t								mNumBands, mNextBand, mBandsDone;
+		bool									mQuit;
+	};
+
+	Encoder::Encoder( int32_t width, int32_t height, const Format &format )
+	: mWidth( width ), mHeight( height ), mFormat( format ), mDxtSize( hap::getDxtSize( format.getCodec(), width, height ) ),
+		mHasPrevious( false ), mNumReusedBlocks( 0 )
+	{
+		if( mFormat.getTemporalReuse() ) {
+			mPreviousBlocks.resize( getNumBlocks() * 64 );
+			mPreviousDxt.resize( mDxtSize );
+		}
+		if( mFormat.getNumThreads() > 1 )
+			mBandPool.reset( new BandPool( mFormat.getNumThreads() ) );
+	}
+
+	Encoder::~Encoder()
+	{
+	}
+
+	uint32_t Encoder::convertBlockRows( const uint8_t *rgba, ptrdiff_t rowBytes, uint8_t *dxt, int32_t firstRow, int32_t lastRow )
+	{
+		const int32_t blocksWide = ( mWidth + 3 ) / 4;
+		const size_t blockSize = getBlockSize( mFormat.getCodec() );
+		const dxt::Quality quality = mFormat.getQuality();
+		const bool reuse = mFormat.getTemporalReuse();
+
+		uint32_t reused = 0;
+		uint8_t block[64];
+		for( int32_t row = firstRow; row < lastRow; row++ ) {
+			size_t blockIndex = row * blocksWide;
+			uint8_t *dest = dxt + blockIndex * blockSize;
+			for( int32_t col = 0; col < blocksWide; col++, blockIndex++, dest += blockSize ) {
+				dxt::extractBlock( rgba, mWidth, mHeight, rowBytes, col * 4, row * 4, block );
+
+				if( ! reuse ) {
+					compressBlock( block, dest, quality );
+					continue;
+				}
+
+				// Block compression is deterministic, so an unchanged block compresses to the same bytes
+				uint8_t *previousBlock = mPreviousBlocks.data() + blockIndex * 64;
+				uint8_t *previousDxt = mPreviousDxt.data() + blockIndex * blockSize;
+				if( mHasPrevious && memcmp( block, previousBlock, 64 ) == 0 ) {
+					memcpy( dest, previousDxt, blockSize );
+					reused++;
+				}
+				else {
+					compressBlock( block, dest, quality );
+					memcpy( previousBlock, block, 64 );
+					memcpy( previousDxt, dest, blockSize );
+				}
+			}
+		}
+		return reused;
+	}
+
+	void Encoder::compressBlock( const uint8_t *block, uint8_t *dest, dxt::Quality quality ) const
+	{
+		switch( mFormat.getCodec() ) {
+			case Codec::HAP:	dxt::compressBlockDxt1( block, dest, quality ); break;
+			case Codec::HAP_A:	dxt::compressBlockDxt5( block, dest, quality ); break;
+			case Codec::HAP_Q:	dxt::compressBlockYCoCgDxt5( block, dest, quality ); break;
+		}
+	}
+
+	void Encoder::convert( const uint8_t *rgba, ptrdiff_t rowBytes, std::vector<uint8_t> *dxt )
+	{
+		dxt->resize( mDxtSize );
+
+		const int32_t blockRows = ( mHeight + 3 ) / 4;
+		if( ! mBandPool ) {
+			mNumReusedBlocks = convertBlockRows( rgba, rowBytes, dxt->data(), 0, blockRows );
+		}
+		else {
+			// A few bands per thread keeps the load balanced when some rows are more detailed than others
+			const uint32_t numBands = std::min<uint32_t>( blockRows, mFormat.getNumThreads() * 4 );
+			uint8_t *dest = dxt->data();
+			std::atomic<uint32_t> reused( 0 );
+			mBandPool->run( numBands, [&]( uint32_t band ) {
+				reused += convertBlockRows( rgba, rowBytes, dest, blockRows * band / numBands, blockRows * ( band + 1 ) / numBands );
+			} );
+			mNumReusedBlocks = reused;
+		}
+		mHasPrevious = mFormat.getTemporalReuse();
+	}
+
+	void Encoder::compress( const std::vector<uint8_t> &dxt, std::vector<uint8_t> *frame ) const
+	{
+		const uint8_t textureFormat = getTextureFormat( mFormat.getCodec() );
+		const bool useSnappy = mFormat.getCompressor() == Compressor::SNAPPY;
+		const int32_t blockRows = ( mHeight + 3 ) / 4;
+		const size_t rowSize = dxt.size() / blockRows;
+		const uint32_t chunkCount = std::max<uint32_t>( 1, std::min<uint32_t>( mFormat.getChunkCount(), blockRows ) );
+
+		// Size the output for the worst case so the header length is known up front, then trim
+		const size_t maxPayload = useSnappy ? snappy::getMaxCompressedLength( dxt.size() ) + chunkCount * 32 : dxt.size();
+		const size_t instructionsLength = chunkCount > 1 ? 4 + ( 4 + chunkCount ) + ( 4 + 4 * chunkCount ) : 0;
+		const size_t headerLength = getSectionHeaderLength( instructionsLength + maxPayload );
+		frame->resize( headerLength + instructionsLength + maxPayload );
+
+		uint8_t *out = frame->data() + headerLength + instructionsLength;
+		uint8_t *payload = out;
+
+		if( chunkCount == 1 ) {
+			uint8_t compressor = COMPRESSOR_NONE;
+			if( useSnappy ) {
+				size_t length = snappy::compress( dxt.data(), dxt.size(), out );
+				if( length < dxt.size() ) {
+					compressor = COMPRESSOR_SNAPPY;
+					out += length;
+				}
+			}
+			if( compressor == COMPRESSOR_NONE ) {
+				memcpy( out, dxt.data(), dxt.size() );
+				out += dxt.size();
+			}
+			writeSectionHeader( frame->data(), headerLength, out - payload, compressor | textureFormat );
+		}
+		else {
+			// Chunks are split on block rows: decoding needs no knowledge of the split, but decoders can work on chunks in parallel
+			uint8_t *instructions = frame->data() + headerLength;
+			uint8_t *compressors = instructions + 8;
+			uint8_t *sizes = compressors + chunkCount + 4;
+			writeSectionHeader( instructions, 4, instructionsLength - 4, SECTION_DECODE_INSTRUCTIONS );
+			writeSectionHeader( instructions + 4, 4, chunkCount, SECTION_CHUNK_COMPRESSORS );
+			writeSectionHeader( compressors + chunkCount, 4, 4 * chunkCount, SECTION_CHUNK_SIZES );
+
+			for( uint32_t chunk = 0; chunk < chunkCount; chunk++ ) {
+				const uint8_t *source = dxt.data() + rowSize * ( blockRows * chunk / chunkCount );
+				const size_t sourceLength = rowSize * ( blockRows * ( chunk + 1 ) / chunkCount - blockRows * chunk / chunkCount );
+
+				size_t length = sourceLength;
+				compressors[chunk] = COMPRESSOR_NONE >> 4;
+				if( useSnappy ) {
+					length = snappy::compress( source, sourceLength, out );
+					if( length < sourceLength )
+						compressors[chunk] = COMPRESSOR_SNAPPY >> 4;
+				}
+				if( compressors[chunk] == COMPRESSOR_NONE >> 4 ) {
+					memcpy( out, source, sourceLength );
+					length = sourceLength;
+				}
+
+				for( int i = 0; i < 4; i++ )
+					sizes[chunk * 4 + i] = static_cast<uint8_t>( length >> ( 8 * i ) );
+				out += length;
+			}
+
+			writeSectionHeader( frame->data(), headerLength, instructionsLength + ( out - payload ), COMPRESSOR_COMPLEX | textureFormat );
+		}
+
+		frame->resize( out - frame->data() );
+	}
+
+	void Encoder::encode( const uint8_t *rgba, ptrdiff_t rowBytes, std::vector<uint8_t> *frame )
+	{
+		convert( rgba, rowBytes, &mScratch );
+		compress( mScratch, frame );
+	}
+
+} } // namespace cinder::hap
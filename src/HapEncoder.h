@@ -0,0 +1,94 @@
+/*
+ *  HapEncoder.h
+ *
+ *  Converts RGBA frames to Hap, Hap Alpha or Hap Q frames.
+ *
+ */
+#pragma once
+
+#include "HapFormat.h"
+#include "HapDxt.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace cinder { namespace hap {
+
+	typedef std::shared_ptr<class Encoder> EncoderRef;
+
+	//! Encodes frames in two steps, convert() (RGBA to DXT) followed by compress() (second-stage compression and framing),
+	//! so that callers can pipeline them on separate threads. The output needs no further processing before muxing.
+	class Encoder {
+	  public:
+		struct Format {
+			Format() : mCodec( Codec::HAP ), mCompressor( Compressor::SNAPPY ), mQuality( dxt::Quality::HIGH ), mChunkCount( 1 ), mNumThreads( 1 ), mTemporalReuse( true ) {}
+
+			Format&		codec( Codec codec ) { mCodec = codec; return *this; }
+			Format&		compressor( Compressor compressor ) { mCompressor = compressor; return *this; }
+			Format&		quality( dxt::Quality quality ) { mQuality = quality; return *this; }
+			//! Splits every frame into \a count independently compressed chunks, which decoders can decompress in parallel.
+			Format&		chunkCount( uint32_t count ) { mChunkCount = count; return *this; }
+			//! Number of threads convert() spreads a frame's block rows across, including the calling thread.
+			Format&		numThreads( uint32_t count ) { mNumThreads = count; return *this; }
+			//! Reuses the compressed block of every 4x4 block identical to the previous frame's instead of compressing it again.
+			//! The output is unchanged, but the encoder keeps a copy of the previous frame. Enabled by default.
+			Format&		temporalReuse( bool enable = true ) { mTemporalReuse = enable; return *this; }
+
+			Codec			getCodec() const { return mCodec; }
+			Compressor		getCompressor() const { return mCompressor; }
+			dxt::Quality	getQuality() const { return mQuality; }
+			uint32_t		getChunkCount() const { return mChunkCount; }
+			uint32_t		getNumThreads() const { return mNumThreads; }
+			bool			getTemporalReuse() const { return mTemporalReuse; }
+
+		  private:
+			Codec			mCodec;
+			Compressor		mCompressor;
+			dxt::Quality	mQuality;
+			uint32_t		mChunkCount;
+			uint32_t		mNumThreads;
+			bool			mTemporalReuse;
+		};
+
+		static EncoderRef create( int32_t width, int32_t height, const Format &format = Format() ) { return EncoderRef( new Encoder( width, height, format ) ); }
+		~Encoder();
+
+		//! Compresses \a rgba to the codec's DXT format. \a rowBytes may be negative for bottom-up images.
+		//! With temporal reuse, "previous frame" means the one passed to the previous call on this encoder.
+		void	convert( const uint8_t *rgba, ptrdiff_t rowBytes, std::vector<uint8_t> *dxt );
+		//! Applies the second-stage compressor and writes a complete Hap frame to \a frame. Safe to call from several threads at once.
+		void	compress( const std::vector<uint8_t> &dxt, std::vector<uint8_t> *frame ) const;
+		//! Shorthand for convert() followed by compress().
+		void	encode( const uint8_t *rgba, ptrdiff_t rowBytes, std::vector<uint8_t> *frame );
+
+		int32_t			getWidth() const { return mWidth; }
+		int32_t			getHeight() const { return mHeight; }
+		const Format&	getFormat() const { return mFormat; }
+		//! Size of the DXT texture produced by convert()
+		size_t			getDxtSize() const { return mDxtSize; }
+		//! Number of blocks the last convert() copied from the previous frame rather than compressing
+		uint32_t		getNumReusedBlocks() const { return mNumReusedBlocks; }
+		uint32_t		getNumBlocks() const { return static_cast<uint32_t>( ( ( mWidth + 3 ) / 4 ) * ( ( mHeight + 3 ) / 4 ) ); }
+
+	  private:
+		Encoder( int32_t width, int32_t height, const Format &format );
+
+		uint32_t	convertBlockRows( const uint8_t *rgba, ptrdiff_t rowBytes, uint8_t *dxt, int32_t firstRow, int32_t lastRow );
+		void		compressBlock( const uint8_t *block, uint8_t *dest, dxt::Quality quality ) const;
+
+		class BandPool;
+
+		int32_t						mWidth, mHeight;
+		Format						mFormat;
+		size_t						mDxtSize;
+		std::unique_ptr<BandPool>	mBandPool;
+		std::vector<uint8_t>		mScratch;
+
+		// Source pixels of the previous frame, stored block by block, and the blocks they compressed to
+		std::vector<uint8_t>		mPreviousBlocks, mPreviousDxt;
+		bool						mHasPrevious;
+		uint32_t					mNumReusedBlocks;
+	};
+
+} } // namespace cinder::hap
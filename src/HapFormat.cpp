@@ -0,0 +1,117 @@
+/*
+ *  HapFormat.cpp
+ *
+ *  Constants and section helpers for the Hap frame format.
+ *
+ */
+
+#include "HapFormat.h"
+#include "HapDxt.h"
+
+#include <cstring>
+
+namespace cinder { namespace hap {
+
+	uint32_t getCodecFourCC( Codec codec )
+	{
+		switch( codec ) {
+			case Codec::HAP_A:	return 'Hap5';
+			case Codec::HAP_Q:	return 'HapY';
+			default:			return 'Hap1';
+		}
+	}
+
+	uint8_t getTextureFormat( Codec codec )
+	{
+		switch( codec ) {
+			case Codec::HAP_A:	return TEXTURE_RGBA_DXT5;
+			case Codec::HAP_Q:	return TEXTURE_YCOCG_DXT5;
+			default:			return TEXTURE_RGB_DXT1;
+		}
+	}
+
+	size_t getBlockSize( Codec codec )
+	{
+		return codec == Codec::HAP ? dxt::kDxt1BlockSize : dxt::kDxt5BlockSize;
+	}
+
+	size_t getDxtSize( Codec codec, int32_t width, int32_t height )
+	{
+		size_t blocksWide = ( width + 3 ) / 4;
+		size_t blocksHigh = ( height + 3 ) / 4;
+		return blocksWide * blocksHigh * getBlockSize( codec );
+	}
+
+	size_t getSectionHeaderLength( size_t sectionLength )
+	{
+		return sectionLength <= 0xffffff ? 4 : 8;
+	}
+
+	void writeSectionHeader( uint8_t *dest, size_t headerLength, size_t sectionLength, uint8_t type )
+	{
+		if( headerLength == 4 ) {
+			dest[0] = static_cast<uint8_t>( sectionLength );
+			dest[1] = static_cast<uint8_t>( sectionLength >> 8 );
+			dest[2] = static_cast<uint8_t>( sectionLength >> 16 );
+			dest[3] = type;
+			return;
+		}
+
+		// A zero 24-bit length means the real length follows in a 32-bit field
+		dest[0] = dest[1] = dest[2] = 0;
+		dest[3] = type;
+		for( int i = 0; i < 4; i++ )
+			dest[4 + i] = static_cast<uint8_t>( sectionLength >> ( 8 * i ) );
+	}
+
+	bool readSectionHeader( const uint8_t *source, size_t sourceLength, size_t *headerLength, size_t *sectionLength, uint8_t *type )
+	{
+		if( sourceLength < 4 )
+			return false;
+
+		size_t length = source[0] | ( source[1] << 8 ) | ( source[2] << 16 );
+		size_t header = 4;
+		if( length == 0 ) {
+			if( sourceLength < 8 )
+				return false;
+			length = source[4] | ( source[5] << 8 ) | ( source[6] << 16 ) | ( static_cast<size_t>( source[7] ) << 24 );
+			header = 8;
+		}
+
+		if( length > sourceLength - header )
+			return false;
+
+		*headerLength = header;
+		*sectionLength = length;
+		*type = source[3];
+		return true;
+	}
+
+	uint64_t hashData( const uint8_t *data, size_t size )
+	{
+		// Multiply and fold eight bytes at a time, after MurmurHash64A
+		const uint64_t m = 0xc6a4a7935bd1e995ull;
+		uint64_t h = 0x9e3779b97f4a7c15ull ^ ( size * m );
+
+		const uint8_t *end = data + ( size & ~static_cast<size_t>( 7 ) );
+		for( ; data != end; data += 8 ) {
+			uint64_t k;
+			memcpy( &k, data, 8 );
+			k *= m;
+			k ^= k >> 47;
+			k *= m;
+			h ^= k;
+			h *= m;
+		}
+
+		for( size_t i = 0; i < ( size & 7 ); i++ )
+			h ^= static_cast<uint64_t>( data[i] ) << ( 8 * i );
+		h *= m;
+
+		h ^= h >> 47;
+		h *= m;
+		h ^= h >> 47;
+		return h;
+	}
+
+} } // namespace cinder::hap
@@ -0,0 +1,55 @@
+/*
+ *  HapFormat.h
+ *
+ *  Constants and section helpers for the Hap frame format.
+ *  See https://github.com/Vidvox/hap/blob/master/documentation/HapVideoDRAFT.md
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cinder { namespace hap {
+
+	//! The three Hap flavours, named after the QuickTime codecs that carry them ('Hap1', 'Hap5' and 'HapY').
+	enum class Codec { HAP, HAP_A, HAP_Q };
+	//! Second-stage compressors applied on top of the DXT texture
+	enum class Compressor { NONE, SNAPPY };
+
+	//! Section types. Top-level frame sections combine a compressor in the high nibble with a texture format in the low nibble.
+	enum SectionType : uint8_t {
+		SECTION_DECODE_INSTRUCTIONS		= 0x01,
+		SECTION_CHUNK_COMPRESSORS		= 0x02,
+		SECTION_CHUNK_SIZES				= 0x03,
+		SECTION_CHUNK_OFFSETS			= 0x04,
+
+		TEXTURE_RGB_DXT1				= 0x0B,
+		TEXTURE_RGBA_DXT5				= 0x0E,
+		TEXTURE_YCOCG_DXT5				= 0x0F,
+
+		COMPRESSOR_NONE					= 0xA0,
+		COMPRESSOR_SNAPPY				= 0xB0,
+		COMPRESSOR_COMPLEX				= 0xC0
+	};
+
+	//! Returns the QuickTime codec type ('Hap1', 'Hap5' or 'HapY') for \a codec.
+	uint32_t	getCodecFourCC( Codec codec );
+	//! Returns the texture format nibble stored in frame headers for \a codec.
+	uint8_t		getTextureFormat( Codec codec );
+	//! Returns the size in bytes of one compressed 4x4 block.
+	size_t		getBlockSize( Codec codec );
+	//! Returns the size of a DXT texture of \a width x \a height pixels, rounded up to whole blocks.
+	size_t		getDxtSize( Codec codec, int32_t width, int32_t height );
+
+	//! Returns the size of the smallest section header that can describe \a sectionLength bytes of payload, 4 or 8 bytes.
+	size_t		getSectionHeaderLength( size_t sectionLength );
+	//! Writes a section header of \a headerLength bytes, as returned by getSectionHeaderLength() for this or any larger payload.
+	void		writeSectionHeader( uint8_t *dest, size_t headerLength, size_t sectionLength, uint8_t type );
+	//! Parses the section header at \a source. Returns false if it doesn't fit in \a sourceLength or its payload would overrun.
+	bool		readSectionHeader( const uint8_t *source, size_t sourceLength, size_t *headerLength, size_t *sectionLength, uint8_t *type );
+
+	//! Fast non-cryptographic 64-bit hash, used to spot repeated frames and blocks. Equal hashes still need a byte comparison.
+	uint64_t	hashData( const uint8_t *data, size_t size );
+
+} } // namespace cinder::hap
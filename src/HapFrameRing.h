@@ -0,0 +1,79 @@
+/*
+ *  HapFrameRing.h
+ *
+ *  Lock-free ring buffer for exactly one producer thread and one consumer thread.
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace cinder { namespace hap {
+
+	//! Slots are preallocated and filled in place: the producer writes into getWriteSlot() and publishes it with
+	//! commitWrite(), the consumer reads getReadSlot() and hands it back with commitRead(). Neither side ever waits.
+	template<typename T>
+	class FrameRing {
+	  public:
+		explicit FrameRing( size_t capacity )
+		: mSlots( capacity + 1 ), mRead( 0 ), mWrite( 0 )
+		{}
+
+		//! Producer: the next free slot, or nullptr if the ring is full
+		T*		getWriteSlot()
+		{
+			size_t write = mWrite.load( std::memory_order_relaxed );
+			if( advance( write ) == mRead.load( std::memory_order_acquire ) )
+				return nullptr;
+			return &mSlots[write];
+		}
+		//! Producer: makes the slot returned by getWriteSlot() visible to the consumer
+		void	commitWrite()
+		{
+			mWrite.store( advance( mWrite.load( std::memory_order_relaxed ) ), std::memory_order_release );
+		}
+
+		//! Consumer: the oldest published slot, or nullptr if the ring is empty
+		T*		getReadSlot()
+		{
+			size_t read = mRead.load( std::memory_order_relaxed );
+			if( read == mWrite.load( std::memory_order_acquire ) )
+				return nullptr;
+			return &mSlots[read];
+		}
+		//! Consumer: the published slot \a index places after the oldest one, or nullptr if there aren't that many
+		T*		peekReadSlot( size_t index )
+		{
+			size_t read = mRead.load( std::memory_order_relaxed ), write = mWrite.load( std::memory_order_acquire );
+			size_t size = write >= read ? write - read : write + mSlots.size() - read;
+			if( index >= size )
+				return nullptr;
+			return &mSlots[( read + index ) % mSlots.size()];
+		}
+		//! Consumer: returns the slot returned by getReadSlot() to the producer
+		void	commitRead()
+		{
+			mRead.store( advance( mRead.load( std::memory_order_relaxed ) ), std::memory_order_release );
+		}
+
+		size_t	getCapacity() const { return mSlots.size() - 1; }
+		//! Number of published slots. Only exact when called from the producer or consumer thread.
+		size_t	getSize() const
+		{
+			size_t read = mRead.load( std::memory_order_acquire ), write = mWrite.load( std::memory_order_acquire );
+			return write >= read ? write - read : write + mSlots.size() - read;
+		}
+
+	  private:
+		size_t	advance( size_t index ) const { return index + 1 == mSlots.size() ? 0 : index + 1; }
+
+		std::vector<T>		mSlots;
+		// Kept on separate cache lines so the two threads don't contend over them
+		std::atomic<size_t>	mRead;
+		char				mPadding[64];
+		std::atomic<size_t>	mWrite;
+	};
+
+} } // namespace cinder::hap
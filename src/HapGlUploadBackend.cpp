@@ -0,0 +1,279 @@
+/*
+ *  HapGlUploadBackend.cpp
+ *
+ *  Uploads Hap frames to GL textures.
+ *
+ */
+
+#include "HapGlUploadBackend.h"
+#include "HapFormat.h"
+
+#include "cinder/Log.h"
+#include "cinder/gl/scoped.h"
+
+#include <cstring>
+
+namespace cinder { namespace hap {
+
+	GlUploadBackend::GlUploadBackend()
+	: mInternalFormat( GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ), mTexturePool( TexturePool::get() ), mNumTextures( 3 ), mShownSlot( SIZE_MAX ),
+		mUploadedSlot( SIZE_MAX ), mPixelBufferUpload( true ), mPowerOfTwoTextures( true ), mDeltaUpload( false ), mNumTextureWaits( 0 )
+	{
+	}
+
+	GlUploadBackend::~GlUploadBackend()
+	{
+		releaseTextureSlots();
+	}
+
+	void GlUploadBackend::create( const FrameFormat &format )
+	{
+		// Textures of another size or format are replaced slot by slot as frames are uploaded to them
+		mFormat = format;
+		mInternalFormat = format.mTextureFormat == SectionType::TEXTURE_RGB_DXT1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		mStats.mCreates++;
+	}
+
+	void GlUploadBackend::uploadRows( const uint8_t *dxt, size_t size, uint32_t firstRow, uint32_t numRows )
+	{
+		const GLuint width = mFormat.mWidth, height = mFormat.mHeight;
+		const size_t rowBytes = mFormat.getRowBytes(), rowPitch = mFormat.getRowPitch();
+		const uint32_t lastRow = std::min( firstRow + numRows, mFormat.getBlocksHigh() );
+		if( lastRow <= firstRow )
+			return;
+		numRows = lastRow - firstRow;
+		if( size < ( lastRow - 1 ) * rowPitch + rowBytes ) {
+			CI_LOG_E( "HAP ERROR :: frame of " << size << " bytes is too small for " << mFormat.mRoundedWidth << "x" << mFormat.mRoundedHeight );
+			return;
+		}
+
+		// Sized for the blocks covering the picture, not for whatever padding the frame has
+		GLuint backingWidth = mFormat.getBlocksWide() * 4, backingHeight = mFormat.getBlocksHigh() * 4;
+		if( mPowerOfTwoTextures ) {
+			// On NVIDIA hardware there is a massive slowdown if DXT textures aren't POT-dimensioned, so we use POT-dimensioned backing
+			GLuint potWidth = 1;
+			while( potWidth < backingWidth ) potWidth <<= 1;
+
+			GLuint potHeight = 1;
+			while( potHeight < backingHeight ) potHeight <<= 1;
+
+			backingWidth = potWidth;
+			backingHeight = potHeight;
+		}
+
+		// Every band of a frame goes to the same slot, and a frame left unfinished is overwritten by the next
+		if( mUploadedSlot == SIZE_MAX )
+			mUploadedSlot = acquireTextureSlot();
+		TextureSlot &slot = mTextureSlots[mUploadedSlot];
+		gl::Texture2dRef &texture = slot.mTexture;
+		// Proxy frames and full size ones need textures of their own size
+		if( texture && ( texture->getCleanWidth() != static_cast<GLint>( width ) || texture->getCleanHeight() != static_cast<GLint>( height ) || texture->getInternalFormat() != static_cast<GLint>( mInternalFormat )
+			|| texture->getActualWidth() != static_cast<GLint>( backingWidth ) || texture->getActualHeight() != static_cast<GLint>( backingHeight ) ) )
+			texture.reset();
+
+		if( ! texture ) {
+			// We allocate the texture with no pixel data, then use CompressedTexSubImage to update the content region.
+			// Textures of the same format and size dropped by any movie are reused rather than allocated again.
+			gl::Texture2d::Format format;
+			format.wrap( GL_CLAMP_TO_EDGE ).magFilter( GL_LINEAR ).minFilter( GL_LINEAR ).internalFormat( mInternalFormat ).dataType( GL_UNSIGNED_INT_8_8_8_8_REV ).immutableStorage();
+			texture = mTexturePool->acquire( backingWidth, backingHeight, format );
+			texture->setCleanBounds( Area( 0, 0, width, height ) );
+			slot.mRowHashes.clear();
+
+#if defined( CINDER_MAC )
+			/// There is no default format GL_TEXTURE_STORAGE_HINT_APPLE param so we fill it manually
+			gl::ScopedTextureBind bind( texture->getTarget(), texture->getId() );
+			glTexParameteri( texture->getTarget(), GL_TEXTURE_STORAGE_HINT_APPLE, GL_STORAGE_SHARED_APPLE );
+#endif
+		}
+
+		gl::ScopedTextureBind bind( texture );
+		if( mDeltaUpload ) {
+			uploadChangedRows( slot, dxt, firstRow, lastRow );
+		}
+		else if( mPixelBufferUpload ) {
+			// Rows uploaded without hashing leave the ones recorded out of date
+			slot.mRowHashes.clear();
+			if( ! mPixelBuffers )
+				mPixelBuffers = PixelBufferRing::create( rowBytes * numRows );
+			mPixelBuffers->upload( dxt + firstRow * rowPitch, rowBytes, rowPitch, numRows, [&]( const GLvoid *pixels, size_t pitch ) {
+				uploadBlocks( texture, pixels, pitch, firstRow, numRows );
+			} );
+		}
+		else {
+			slot.mRowHashes.clear();
+#if defined( CINDER_MAC )
+			glTextureRangeAPPLE( texture->getTarget(), static_cast<GLsizei>( size ), dxt );
+			/* WARNING: Even though it is present here:
+			 * https://github.com/Vidvox/hap-quicktime-playback-demo/blob/master/HapQuickTimePlayback/HapPixelBufferTexture.m#L186
+			 * the following call does not appear necessary. Furthermore, it corrupts display
+			 * when movies are loaded more than once
+			 */
+//			glPixelStorei( GL_UNPACK_CLIENT_STORAGE_APPLE, 1 );
+#endif
+			uploadBlocks( texture, dxt + firstRow * rowPitch, rowPitch, firstRow, numRows );
+		}
+
+		if( ! mDeltaUpload )
+			mStats.mBytes += numRows * rowBytes;
+		if( lastRow == mFormat.getBlocksHigh() )
+			mStats.mUploads++;
+	}
+
+	void GlUploadBackend::uploadChangedRows( TextureSlot &slot, const uint8_t *dxt, uint32_t firstRow, uint32_t lastRow )
+	{
+		const size_t rowBytes = mFormat.getRowBytes(), rowPitch = mFormat.getRowPitch();
+		const uint32_t blocksHigh = mFormat.getBlocksHigh();
+		// A texture whose rows aren't known gets every row. A hash collision would only leave a row stale until it changes again.
+		const bool known = slot.mRowHashes.size() == blocksHigh;
+		if( ! known )
+			slot.mRowHashes.assign( blocksHigh, 0 );
+
+		// Runs of adjacent changed rows, as first row and count
+		std::vector<std::pair<uint32_t, uint32_t>> runs;
+		uint32_t changedRows = 0;
+		for( uint32_t row = firstRow; row < lastRow; row++ ) {
+			const uint64_t hash = hashData( dxt + row * rowPitch, rowBytes );
+			if( known && hash == slot.mRowHashes[row] )
+				continue;
+			slot.mRowHashes[row] = hash;
+			if( ! runs.empty() && runs.back().first + runs.back().second == row )
+				runs.back().second++;
+			else
+				runs.push_back( std::make_pair( row, 1u ) );
+			changedRows++;
+		}
+
+		mStats.mBytes += changedRows * rowBytes;
+		mStats.mSkippedBytes += ( lastRow - firstRow - changedRows ) * rowBytes;
+		if( runs.empty() )
+			return;
+
+		const gl::Texture2dRef &texture = slot.mTexture;
+		if( ! mPixelBufferUpload ) {
+#if defined( CINDER_MAC )
+			glTextureRangeAPPLE( texture->getTarget(), static_cast<GLsizei>( ( lastRow - 1 ) * rowPitch + rowBytes ), dxt );
+#endif
+			for( const auto &run : runs )
+				uploadBlocks( texture, dxt + run.first * rowPitch, rowPitch, run.first, run.second );
+			return;
+		}
+
+		if( ! mPixelBuffers )
+			mPixelBuffers = PixelBufferRing::create( rowBytes * changedRows );
+		if( runs.size() == 1 ) {
+			mPixelBuffers->upload( dxt + runs[0].first * rowPitch, rowBytes, rowPitch, runs[0].second, [&]( const GLvoid *pixels, size_t pitch ) {
+				uploadBlocks( texture, pixels, pitch, runs[0].first, runs[0].second );
+			} );
+			return;
+		}
+
+		// Scattered rows are packed together first, so the frame takes a single pixel buffer slot however many runs it has
+		mChangedRows.resize( changedRows * rowBytes );
+		uint8_t *packed = mChangedRows.data();
+		for( const auto &run : runs ) {
+			for( uint32_t row = run.first; row < run.first + run.second; row++, packed += rowBytes )
+				memcpy( packed, dxt + row * rowPitch, rowBytes );
+		}
+		mPixelBuffers->upload( mChangedRows.data(), mChangedRows.size(), [&]( const GLvoid *pixels ) {
+			size_t offset = 0;
+			for( const auto &run : runs ) {
+				uploadBlocks( texture, static_cast<const uint8_t*>( pixels ) + offset, rowBytes, run.first, run.second );
+				offset += run.second * rowBytes;
+			}
+		} );
+	}
+
+	void GlUploadBackend::uploadBlocks( const gl::Texture2dRef &texture, const GLvoid *pixels, size_t rowPitch, uint32_t firstRow, uint32_t numRows )
+	{
+		const GLsizei width = mFormat.getBlocksWide() * 4, top = firstRow * 4, height = numRows * 4;
+		const size_t rowBytes = mFormat.getRowBytes();
+		if( rowPitch == rowBytes ) {
+			glCompressedTexSubImage2D( texture->getTarget(), 0, 0, top, width, height, texture->getInternalFormat(), static_cast<GLsizei>( rowBytes * numRows ), pixels );
+			return;
+		}
+
+		// Padded rows go up one row of blocks at a time, which every GL can do, rather than through the
+		// GL_UNPACK_COMPRESSED_BLOCK_* state that only GL 4.2 has
+		const uint8_t *rows = static_cast<const uint8_t*>( pixels );
+		for( GLsizei y = top; y < top + height; y += 4, rows += rowPitch )
+			glCompressedTexSubImage2D( texture->getTarget(), 0, 0, y, width, 4, texture->getInternalFormat(), static_cast<GLsizei>( rowBytes ), rows );
+	}
+
+	void GlUploadBackend::fence()
+	{
+		if( mUploadedSlot == SIZE_MAX )
+			return;
+
+		// Every draw sampling the texture shown so far has been issued by now
+		if( mShownSlot != SIZE_MAX && mShownSlot != mUploadedSlot )
+			mTextureSlots[mShownSlot].mReadFence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+		mShownSlot = mUploadedSlot;
+		mUploadedSlot = SIZE_MAX;
+		mTexture = mTextureSlots[mShownSlot].mTexture;
+	}
+
+	void GlUploadBackend::release()
+	{
+		releaseTextureSlots();
+		mTexture.reset();
+		mPixelBuffers.reset();
+	}
+
+	void GlUploadBackend::setPixelBufferUpload( bool enable )
+	{
+		mPixelBufferUpload = enable;
+		if( ! enable )
+			mPixelBuffers.reset();
+	}
+
+	PixelBufferRing::Stats GlUploadBackend::getPixelBufferStats() const
+	{
+		return mPixelBuffers ? mPixelBuffers->getStats() : PixelBufferRing::Stats();
+	}
+
+	size_t GlUploadBackend::acquireTextureSlot()
+	{
+		if( mTextureSlots.size() != mNumTextures ) {
+			releaseTextureSlots();
+			mTextureSlots.resize( mNumTextures );
+		}
+		if( mTextureSlots.size() == 1 )
+			return 0;
+
+		// The oldest slot first, skipping the one on screen and any still being sampled by draws already issued
+		const size_t first = mShownSlot == SIZE_MAX ? 0 : mShownSlot + 1;
+		for( size_t i = 0; i < mTextureSlots.size(); i++ ) {
+			const size_t slot = ( first + i ) % mTextureSlots.size();
+			if( slot == mShownSlot )
+				continue;
+			GLsync &fence = mTextureSlots[slot].mReadFence;
+			if( fence && glClientWaitSync( fence, 0, 0 ) == GL_TIMEOUT_EXPIRED )
+				continue;
+			if( fence )
+				glDeleteSync( fence );
+			fence = nullptr;
+			return slot;
+		}
+
+		// Every other slot is still in use, the driver will have to wait for the GPU or copy the texture
+		const size_t slot = first % mTextureSlots.size();
+		glDeleteSync( mTextureSlots[slot].mReadFence );
+		mTextureSlots[slot].mReadFence = nullptr;
+		mNumTextureWaits++;
+		return slot;
+	}
+
+	void GlUploadBackend::releaseTextureSlots()
+	{
+		for( auto &slot : mTextureSlots ) {
+			if( slot.mReadFence )
+				glDeleteSync( slot.mReadFence );
+		}
+		// The texture on screen stays in mTexture until the next fence
+		mTextureSlots.clear();
+		mShownSlot = SIZE_MAX;
+		mUploadedSlot = SIZE_MAX;
+	}
+
+} } // namespace cinder::hap
@@ -0,0 +1,102 @@
+/*
+ *  HapGlUploadBackend.h
+ *
+ *  Uploads Hap frames to GL textures.
+ *
+ */
+#pragma once
+
+#include "HapUploadBackend.h"
+#include "HapPixelBufferRing.h"
+#include "HapTexturePool.h"
+
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Texture.h"
+
+#include <algorithm>
+
+namespace cinder { namespace hap {
+
+	typedef std::shared_ptr<class GlUploadBackend> GlUploadBackendRef;
+
+	//! Uploads frames to compressed textures taken from the shared TexturePool, a few in turn so an upload never
+	//! overwrites a texture that draws still queued on the GPU sample. The texture replaced by each fence() is fenced
+	//! and written to again only once the GPU has passed that point. Frames are staged in a PixelBufferRing unless
+	//! setPixelBufferUpload() is off. Only the blocks covering the picture are uploaded, straight from padded frames
+	//! with no repacking pass, so any size plays. Every call needs the GL context current.
+	class GlUploadBackend : public UploadBackend {
+	  public:
+		//! Doesn't touch GL until the first upload, so it can be created on any thread
+		static GlUploadBackendRef create() { return GlUploadBackendRef( new GlUploadBackend ); }
+		~GlUploadBackend();
+
+		void	create( const FrameFormat &format ) override;
+		void	upload( const uint8_t *dxt, size_t size ) override { uploadRows( dxt, size, 0, mFormat.getBlocksHigh() ); }
+		void	uploadRows( const uint8_t *dxt, size_t size, uint32_t firstRow, uint32_t numRows ) override;
+		void	fence() override;
+		void	release() override;
+		Stats	getStats() const override { return mStats; }
+
+		//! The texture of the last frame fenced, its clean bounds the picture size
+		const gl::Texture2dRef&	getTexture() const { return mTexture; }
+
+		//! Number of textures uploaded in turn. Defaults to 3, 1 reuses one texture. Takes effect on the next upload.
+		void		setNumTextures( size_t count ) { mNumTextures = std::max<size_t>( 1, count ); }
+		size_t		getNumTextures() const { return mNumTextures; }
+		void		setPixelBufferUpload( bool enable = true );
+		bool		isUsingPixelBufferUpload() const { return mPixelBufferUpload; }
+		//! Rounds texture sizes up to powers of two, which some NVIDIA drivers need for fast DXT sampling. Defaults to
+		//! on. Off, textures are the picture size rounded to 4, which for odd sizes like LED canvases can save most of
+		//! the memory. Takes effect as textures are replaced.
+		void		setPowerOfTwoTextures( bool enable = true ) { mPowerOfTwoTextures = enable; }
+		bool		isUsingPowerOfTwoTextures() const { return mPowerOfTwoTextures; }
+		//! Hashes each row of blocks and uploads only the rows that differ from what the texture being written already
+		//! holds, for mostly static content like signage and UIs. Costs a pass over every frame, wasted on footage that
+		//! changes everywhere. Defaults to off.
+		void		setDeltaUpload( bool enable = true ) { mDeltaUpload = enable; }
+		bool		isUsingDeltaUpload() const { return mDeltaUpload; }
+
+		//! Uploads to a texture that draws still in flight may sample, because every other one was in use too
+		uint32_t				getNumTextureWaits() const { return mNumTextureWaits; }
+		PixelBufferRing::Stats	getPixelBufferStats() const;
+
+	  private:
+		GlUploadBackend();
+
+		struct TextureSlot {
+			TextureSlot() : mReadFence( nullptr ) {}
+
+			gl::Texture2dRef	mTexture;
+			//! Set when a newer slot is shown, after the last draw that could sample this one
+			GLsync				mReadFence;
+			//! Hash of each row of blocks in mTexture, empty if they aren't known
+			std::vector<uint64_t>	mRowHashes;
+		};
+
+		//! Returns the slot to upload the next frame to, preferably one that no draw in flight samples
+		size_t		acquireTextureSlot();
+		void		releaseTextureSlots();
+		//! Uploads \a numRows rows of the blocks covering the picture, from \a firstRow on, to the bound \a texture.
+		//! \a pixels is the first of those rows and \a rowPitch bytes lie between rows.
+		void		uploadBlocks( const gl::Texture2dRef &texture, const GLvoid *pixels, size_t rowPitch, uint32_t firstRow, uint32_t numRows );
+		//! Uploads the rows from \a firstRow to \a lastRow whose hash differs from \a slot's, in runs of adjacent rows
+		void		uploadChangedRows( TextureSlot &slot, const uint8_t *dxt, uint32_t firstRow, uint32_t lastRow );
+
+		FrameFormat				mFormat;
+		GLenum					mInternalFormat;
+		//! Holds the shared pool the textures come from while the backend lives
+		TexturePoolRef			mTexturePool;
+		//! Textures uploaded in turn. mTexture is the one in mShownSlot, mUploadedSlot the one a frame is going up to.
+		std::vector<TextureSlot>	mTextureSlots;
+		size_t					mNumTextures, mShownSlot, mUploadedSlot;
+		gl::Texture2dRef		mTexture;
+		//! Created with the first upload, if mPixelBufferUpload is on
+		PixelBufferRingRef		mPixelBuffers;
+		bool					mPixelBufferUpload, mPowerOfTwoTextures, mDeltaUpload;
+		//! Changed rows of a frame packed together, to stage them in one pixel buffer slot
+		std::vector<uint8_t>	mChangedRows;
+		uint32_t				mNumTextureWaits;
+		Stats					mStats;
+	};
+
+} } // namespace cinder::hap
@@ -0,0 +1,358 @@
+/*
+ *  HapMovieDecoder.cpp
+ *
+ *  Decodes the frames of a Hap movie ahead of the playhead on the shared decode threads.
+ *
+ */
+
+#include "HapMovieDecoder.h"
+#include "HapDecoder.h"
+
+#include "cinder/Log.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace cinder { namespace hap {
+
+	MovieDecoder::MovieDecoder( const MovieReaderRef &reader, size_t numFrames )
+	: mReader( reader ), mRing( numFrames ), mScheduler( DecodeScheduler::get() ), mCache( SampleCache::get() ),
+		mPlayhead( 0 ), mPlayheadTime( 0 ), mRate( 0 ), mReportTime( Clock::now().time_since_epoch().count() ), mRefreshInterval( 0 ),
+		mDirection( 1 ), mLoop( false ), mPalindrome( false ), mScrubbing( false ), mUseProxy( false ), mSuspended( false ),
+		mFrameStep( 1 ), mGeneration( 0 ), mJobGeneration( UINT32_MAX ), mNext( SIZE_MAX ), mNextDirection( 1 ), mPreviousOffset( UINT64_MAX ), mPreviousProxy( false ),
+		mFramesDecoded( 0 ), mCachedFrames( 0 ), mDuplicateFrames( 0 ), mFramesDiscarded( 0 ), mFramesDropped( 0 ), mFramesSkipped( 0 ), mLateFrames( 0 ), mFramesCancelled( 0 ), mDecodeErrors( 0 ), mDecodeMicros( 0 )
+	{
+		mScheduler->add( this );
+	}
+
+	MovieDecoder::~MovieDecoder()
+	{
+		mScheduler->remove( this );
+	}
+
+	MovieDecoder::Playback MovieDecoder::getPlayback() const
+	{
+		Playback playback;
+		playback.mDirection = mDirection.load( std::memory_order_relaxed );
+		playback.mLoop = mLoop.load( std::memory_order_relaxed );
+		playback.mPalindrome = mPalindrome.load( std::memory_order_relaxed );
+		return playback;
+	}
+
+	int64_t MovieDecoder::getDistance( size_t from, int fromDirection, size_t to, int toDirection, const Playback &playback ) const
+	{
+		if( ! playback.mPalindrome )
+			return mReader->getDistance( from, to, playback.mDirection, playback.mLoop );
+
+		// A palindrome cycles through 2n - 2 positions: forwards through every sample, then backwards through all but the ends
+		const int64_t numSamples = static_cast<int64_t>( mReader->getNumSamples() );
+		const int64_t cycle = std::max<int64_t>( 1, 2 * numSamples - 2 );
+		auto getPosition = [=]( size_t sample, int direction ) {
+			return direction > 0 ? static_cast<int64_t>( sample ) : ( cycle - static_cast<int64_t>( sample ) ) % cycle;
+		};
+
+		int64_t distance = ( getPosition( to, toDirection ) - getPosition( from, fromDirection ) ) % cycle;
+		if( distance > cycle / 2 )
+			distance -= cycle;
+		else if( distance < -cycle / 2 )
+			distance += cycle;
+		return distance;
+	}
+
+	size_t MovieDecoder::getNextSample( size_t sample, int *direction, const Playback &playback ) const
+	{
+		size_t next = mReader->getNextSample( sample, *direction, playback.mLoop && ! playback.mPalindrome );
+		if( next == SIZE_MAX && playback.mPalindrome && mReader->getNumSamples() > 1 ) {
+			*direction = -*direction;
+			next = mReader->getNextSample( sample, *direction, false );
+		}
+		return next;
+	}
+
+	void MovieDecoder::setPlayhead( double seconds, double rate, bool loop, bool palindrome )
+	{
+		if( mReader->getNumSamples() == 0 )
+			return;
+
+		const size_t sample = mReader->getSampleIndex( seconds );
+		const size_t previous = mPlayhead.load( std::memory_order_relaxed );
+		const Playback previousPlayback = getPlayback();
+		Playback playback = { rate > 0 ? 1 : ( rate < 0 ? -1 : previousPlayback.mDirection ), loop, palindrome };
+
+		// Estimate the display refresh interval from the interval between calls, ignoring pauses in rendering
+		const Clock::time_point now = Clock::now();
+		const double sinceReport = std::chrono::duration<double>( now - Clock::time_point( Clock::duration( mReportTime.load( std::memory_order_relaxed ) ) ) ).count();
+		if( sinceReport > 0 && sinceReport < 0.25 ) {
+			const double interval = mRefreshInterval.load( std::memory_order_relaxed );
+			mRefreshInterval.store( interval > 0 ? interval + ( sinceReport - interval ) * 0.1 : sinceReport, std::memory_order_relaxed );
+		}
+
+		mPlayheadTime.store( seconds, std::memory_order_relaxed );
+		mRate.store( rate, std::memory_order_relaxed );
+		mReportTime.store( now.time_since_epoch().count(), std::memory_order_relaxed );
+		mDirection.store( playback.mDirection, std::memory_order_relaxed );
+		mLoop.store( loop, std::memory_order_relaxed );
+		mPalindrome.store( palindrome, std::memory_order_relaxed );
+		mPlayhead.store( sample, std::memory_order_release );
+
+		// Going backwards, or further forward than the decoder could have got, is a seek. Palindromes turn round
+		// without one, the decoder has already read on through the turnaround. Nothing is read ahead while scrubbing.
+		if( isScrubbing() ) {
+			if( sample != previous )
+				restart();
+			return;
+		}
+		const int64_t distance = getDistance( previous, previousPlayback.mDirection, sample, playback.mDirection, playback );
+		const int64_t maxDistance = static_cast<int64_t>( mRing.getCapacity() * std::max( 1.0, std::ceil( std::abs( rate ) ) ) );
+		const bool reversed = playback.mDirection != previousPlayback.mDirection && ! palindrome;
+		if( reversed || loop != previousPlayback.mLoop || palindrome != previousPlayback.mPalindrome || distance < 0 || distance > maxDistance )
+			restart();
+		else
+			mScheduler->notify();
+	}
+
+	void MovieDecoder::setScrubbing( bool scrubbing )
+	{
+		mScrubbing.store( scrubbing, std::memory_order_relaxed );
+		mScheduler->notify();
+	}
+
+	void MovieDecoder::restart()
+	{
+		mGeneration.fetch_add( 1, std::memory_order_release );
+		mScheduler->notify();
+	}
+
+	MovieDecoder::Frame* MovieDecoder::acquireFrame( size_t sample )
+	{
+		const uint32_t generation = mGeneration.load( std::memory_order_relaxed );
+		const Playback playback = getPlayback();
+
+		while( Frame *frame = mRing.getReadSlot() ) {
+			if( frame->mGeneration == generation ) {
+				if( frame->mSample == sample )
+					return frame;
+				// Frames are decoded in playback order, so once one lies ahead of the playhead the rest do too
+				if( getDistance( sample, playback.mDirection, frame->mSample, frame->mDirection, playback ) > 0 )
+					return nullptr;
+				// Behind the playhead, but still the closest frame if the one wanted was skipped
+				Frame *following = mRing.peekReadSlot( 1 );
+				if( following && following->mGeneration == generation && getDistance( sample, playback.mDirection, following->mSample, following->mDirection, playback ) > 0 )
+					return frame;
+			}
+
+			mRing.commitRead();
+			mFramesDiscarded++;
+			mScheduler->notify();
+		}
+		return nullptr;
+	}
+
+	void MovieDecoder::releaseFrame()
+	{
+		mRing.commitRead();
+		mScheduler->notify();
+	}
+
+	MovieDecoder::Frame* MovieDecoder::peekFrame()
+	{
+		Frame *frame = mRing.getReadSlot();
+		return frame && frame->mGeneration == mGeneration.load( std::memory_order_relaxed ) ? frame : nullptr;
+	}
+
+	void MovieDecoder::getPresentationInterval( size_t sample, int direction, const Playback &playback, Clock::time_point *start, Clock::time_point *end ) const
+	{
+		const MovieReader::Sample &info = mReader->getSample( sample );
+		const double timeScale = mReader->getTimeScale();
+		const double duration = static_cast<double>( mReader->getDuration() );
+		const double rate = std::abs( mRate.load( std::memory_order_relaxed ) );
+
+		// Movie time unrolled along the direction of playback. Palindromes play the movie forwards, then back.
+		const double cycle = playback.mPalindrome ? 2 * duration : duration;
+		auto getCycleTime = [=]( double time, int timeDirection ) {
+			return timeDirection > 0 ? time : ( playback.mPalindrome ? cycle : 0 ) - time;
+		};
+
+		// Time scale units from the playhead until the sample appears and until it's replaced. Played backwards, a sample appears at its end.
+		const double playheadTime = getCycleTime( mPlayheadTime.load( std::memory_order_relaxed ) * timeScale, playback.mDirection );
+		double startUnits = getCycleTime( direction > 0 ? info.mTime : info.mTime + info.mDuration, direction ) - playheadTime;
+		double endUnits = startUnits + info.mDuration;
+		// The movie turns round within the end samples of a palindrome, which keeps them on screen twice as long
+		if( playback.mPalindrome && ( sample == 0 || sample + 1 == mReader->getNumSamples() ) )
+			endUnits += info.mDuration;
+		// Samples of a looping movie that lie behind the playhead come round after the rest of the cycle
+		if( ( playback.mLoop || playback.mPalindrome ) && endUnits <= 0
+			&& getDistance( mPlayhead.load( std::memory_order_relaxed ), playback.mDirection, sample, direction, playback ) > 0 ) {
+			startUnits += cycle;
+			endUnits += cycle;
+		}
+
+		const Clock::time_point reportTime( Clock::duration( mReportTime.load( std::memory_order_relaxed ) ) );
+		const double secondsPerUnit = 1 / ( timeScale * ( rate > 0 ? rate : 1 ) );
+		*start = reportTime + std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( startUnits * secondsPerUnit ) );
+		// The last frame of a movie that doesn't loop stays on screen once it has ended
+		int nextDirection = direction;
+		const bool held = rate == 0 || getNextSample( sample, &nextDirection, playback ) == SIZE_MAX;
+		*end = held ? Clock::time_point::max() : reportTime + std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( endUnits * secondsPerUnit ) );
+	}
+
+	bool MovieDecoder::isBetweenRefreshes( Clock::time_point start, Clock::time_point end ) const
+	{
+		const double refreshInterval = mRefreshInterval.load( std::memory_order_relaxed );
+		if( refreshInterval <= 0 || end == Clock::time_point::max() )
+			return false;
+
+		// Refreshes are assumed to fall at whole intervals from the last report
+		const Clock::time_point reportTime( Clock::duration( mReportTime.load( std::memory_order_relaxed ) ) );
+		const double refreshes = std::ceil( std::chrono::duration<double>( start - reportTime ).count() / refreshInterval );
+		return reportTime + std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( refreshes * refreshInterval ) ) >= end;
+	}
+
+	bool MovieDecoder::prepareJob( Clock::time_point now, Clock::time_point *deadline )
+	{
+		const uint32_t generation = mGeneration.load( std::memory_order_acquire );
+		const size_t playhead = mPlayhead.load( std::memory_order_acquire );
+		const Playback playback = getPlayback();
+		const size_t numSamples = mReader->getNumSamples();
+
+		// Start over from the playhead after a seek, or when the playhead has overtaken the decoder
+		if( generation != mJobGeneration || ( mNext != SIZE_MAX && getDistance( playhead, playback.mDirection, mNext, mNextDirection, playback ) < 0 ) ) {
+			mJobGeneration = generation;
+			mNext = playhead;
+			mNextDirection = playback.mDirection;
+			mPreviousOffset = UINT64_MAX;
+		}
+
+		if( mNext >= numSamples || ! mRing.getWriteSlot() || isSuspended() || ( isScrubbing() && mNext != playhead ) )
+			return false;
+
+		const uint32_t framesDecoded = mFramesDecoded;
+		const std::chrono::microseconds decodeTime( framesDecoded ? mDecodeMicros / framesDecoded : 0 );
+		const size_t frameStep = static_cast<size_t>( getFrameStep() );
+
+		for( size_t i = 0; i < 2 * numSamples; i++ ) {
+			Clock::time_point start, end;
+			getPresentationInterval( mNext, mNextDirection, playback, &start, &end );
+			if( frameStep > 1 && mNext % frameStep == 0 ) {
+				// Stays on screen until the next sample on the step replaces it
+				size_t last = mNext;
+				int lastDirection = mNextDirection;
+				for( size_t step = 1; step < frameStep; step++ ) {
+					int direction = lastDirection;
+					const size_t next = getNextSample( last, &direction, playback );
+					if( next == SIZE_MAX || next % frameStep == 0 )
+						break;
+					last = next;
+					lastDirection = direction;
+				}
+				Clock::time_point lastStart;
+				if( last != mNext )
+					getPresentationInterval( last, lastDirection, playback, &lastStart, &end );
+			}
+			const bool late = now + decodeTime >= end;
+			// The frame at the playhead is always wanted, frames off the frame step never
+			if( ! late && mNext % frameStep == 0 && ( mNext == playhead || ! isBetweenRefreshes( start, end ) ) ) {
+				mNextStart = start;
+				*deadline = start;
+				return true;
+			}
+
+			// Wouldn't be ready before the next frame replaces it, or wouldn't be seen at all. The frame after can't
+			// reuse its pixels either.
+			if( late )
+				mFramesDropped++;
+			else
+				mFramesSkipped++;
+			mPreviousOffset = UINT64_MAX;
+			mNext = getNextSample( mNext, &mNextDirection, playback );
+			if( mNext == SIZE_MAX )
+				return false;
+		}
+		return false;
+	}
+
+	void MovieDecoder::runJob()
+	{
+		const Playback playback = getPlayback();
+		const DecodedFrameCacheRef decodedCache = getDecodedFrameCache();
+		uint8_t cachedFormat = 0;
+		DecodedFrameCache::DataRef cachedDxt = decodedCache ? decodedCache->get( mNext, &cachedFormat ) : nullptr;
+		// A full size frame decoded already beats decoding the proxy
+		MovieReaderRef proxy = cachedDxt || ! mUseProxy.load( std::memory_order_relaxed ) ? nullptr : getProxy();
+		if( proxy && mNext >= proxy->getNumSamples() )
+			proxy.reset();
+		const MovieReader &reader = proxy ? *proxy : *mReader;
+
+		Frame *frame = mRing.getWriteSlot();
+		const MovieReader::Sample &sample = reader.getSample( mNext );
+		frame->mSample = mNext;
+		frame->mDirection = mNextDirection;
+		frame->mOffset = sample.mOffset;
+		frame->mGeneration = mJobGeneration;
+		frame->mProxy = proxy != nullptr;
+		frame->mDuplicate = sample.mOffset == mPreviousOffset && frame->mProxy == mPreviousProxy;
+		frame->mCachedDxt = frame->mDuplicate ? nullptr : cachedDxt;
+		if( frame->mCachedDxt )
+			frame->mTextureFormat = cachedFormat;
+
+		if( frame->mDuplicate ) {
+			mDuplicateFrames++;
+		}
+		else if( frame->mCachedDxt ) {
+			mCachedFrames++;
+		}
+		else {
+			auto start = Clock::now();
+			try {
+				SampleCache::DataRef compressed = mCache->read( reader, mNext );
+				// Reading takes long enough for a scrubbing playhead to have moved on, and decoding longer still
+				if( isScrubbing() && mGeneration.load( std::memory_order_acquire ) != mJobGeneration ) {
+					mFramesCancelled++;
+					return;
+				}
+				if( decodedCache && ! proxy ) {
+					auto dxt = std::make_shared<std::vector<uint8_t>>();
+					frame->mTextureFormat = decodeFrame( compressed->data(), compressed->size(), dxt.get() );
+					decodedCache->put( mNext, frame->mTextureFormat, dxt );
+					frame->mCachedDxt = dxt;
+				}
+				else
+					frame->mTextureFormat = decodeFrame( compressed->data(), compressed->size(), &frame->mDxt );
+			}
+			catch( const std::exception &exc ) {
+				CI_LOG_E( "HAP ERROR :: couldn't decode frame " << mNext << ": " << exc.what() );
+				mDecodeErrors++;
+				mPreviousOffset = UINT64_MAX;
+				mNext = getNextSample( mNext, &mNextDirection, playback );
+				return;
+			}
+			auto finish = Clock::now();
+			mDecodeMicros += std::chrono::duration_cast<std::chrono::microseconds>( finish - start ).count();
+			mFramesDecoded++;
+			if( finish > mNextStart )
+				mLateFrames++;
+		}
+
+		mRing.commitWrite();
+		mPreviousOffset = sample.mOffset;
+		mPreviousProxy = frame->mProxy;
+		mNext = getNextSample( mNext, &mNextDirection, playback );
+	}
+
+	MovieDecoder::Stats MovieDecoder::getStats() const
+	{
+		Stats stats;
+		stats.mFramesDecoded = mFramesDecoded;
+		stats.mCachedFrames = mCachedFrames;
+		stats.mDuplicateFrames = mDuplicateFrames;
+		stats.mFramesDiscarded = mFramesDiscarded;
+		stats.mFramesDropped = mFramesDropped;
+		stats.mFramesSkipped = mFramesSkipped;
+		stats.mLateFrames = mLateFrames;
+		stats.mFramesCancelled = mFramesCancelled;
+		stats.mDecodeErrors = mDecodeErrors;
+		stats.mAverageDecodeTime = stats.mFramesDecoded ? mDecodeMicros / 1e6 / stats.mFramesDecoded : 0;
+		return stats;
+	}
+
+} } // namespace cinder::hap
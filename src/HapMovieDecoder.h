@@ -0,0 +1,182 @@
+/*
+ *  HapMovieDecoder.h
+ *
+ *  Decodes the frames of a Hap movie ahead of the playhead on the shared decode threads.
+ *
+ */
+#pragma once
+
+#include "HapDecodedFrameCache.h"
+#include "HapDecodeScheduler.h"
+#include "HapFrameRing.h"
+#include "HapMovieReader.h"
+#include "HapSampleCache.h"
+
+#include "cinder/Cinder.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace cinder { namespace hap {
+
+	typedef std::shared_ptr<class MovieDecoder> MovieDecoderRef;
+
+	//! The render thread reports the playhead with setPlayhead() and picks up decoded frames with acquireFrame() and
+	//! releaseFrame(). The DecodeScheduler reads and unpacks the frames that follow into a lock-free ring, so neither of
+	//! these calls ever waits for it.
+	class MovieDecoder {
+	  public:
+		struct Frame {
+			Frame() : mSample( 0 ), mDirection( 1 ), mOffset( 0 ), mGeneration( 0 ), mTextureFormat( 0 ), mDuplicate( false ), mProxy( false ) {}
+
+			size_t					mSample;
+			//! Direction the sample was decoded for. Palindromes play every sample once each way.
+			int						mDirection;
+			uint64_t				mOffset;
+			uint32_t				mGeneration;
+			uint8_t					mTextureFormat;
+			//! The frame is stored at the same offset as the one decoded before it, so it wasn't read or decoded and its DXT data is stale
+			bool					mDuplicate;
+			//! Decoded from the proxy, so it has the proxy's dimensions. mOffset is an offset in the proxy's file.
+			bool					mProxy;
+			std::vector<uint8_t>	mDxt;
+			//! Set instead of mDxt while the movie's decoded frames are cached
+			DecodedFrameCache::DataRef	mCachedDxt;
+
+			const std::vector<uint8_t>&	getDxt() const { return mCachedDxt ? *mCachedDxt : mDxt; }
+		};
+
+		struct Stats {
+			Stats() : mFramesDecoded( 0 ), mCachedFrames( 0 ), mDuplicateFrames( 0 ), mFramesDiscarded( 0 ), mFramesDropped( 0 ), mFramesSkipped( 0 ), mLateFrames( 0 ), mFramesCancelled( 0 ), mDecodeErrors( 0 ), mAverageDecodeTime( 0 ) {}
+
+			uint32_t	mFramesDecoded;
+			//! Frames taken from the decoded frame cache, neither read nor decoded
+			uint32_t	mCachedFrames;
+			//! Frames passed on without reading or decoding because they repeat the previous one
+			uint32_t	mDuplicateFrames;
+			//! Decoded frames thrown away unused, after a seek or because the playhead had already moved past them
+			uint32_t	mFramesDiscarded;
+			//! Frames skipped without decoding because they would have been ready too late
+			uint32_t	mFramesDropped;
+			//! Frames skipped without decoding because at the current rate no display refresh would show them
+			uint32_t	mFramesSkipped;
+			//! Frames that finished decoding after they were due on screen
+			uint32_t	mLateFrames;
+			//! Frames read but not decoded because the playhead moved on while scrubbing
+			uint32_t	mFramesCancelled;
+			uint32_t	mDecodeErrors;
+			//! Seconds spent reading and decoding one frame
+			double		mAverageDecodeTime;
+		};
+
+		static MovieDecoderRef create( const MovieReaderRef &reader, size_t numFrames = 4 ) { return MovieDecoderRef( new MovieDecoder( reader, numFrames ) ); }
+		~MovieDecoder();
+
+		//! Render thread: reports the movie time on screen and the playback rate, negative when playing backwards. Call
+		//! it once per display refresh; the interval between calls tells which frames a fast rate will skip. A paused
+		//! movie keeps reading ahead in the direction it last played. A palindrome is read ahead through its turnaround,
+		//! so \a rate should change sign there. Seeks are detected here.
+		void		setPlayhead( double seconds, double rate, bool loop, bool palindrome = false );
+		//! The sample at the time last passed to setPlayhead()
+		size_t		getPlayhead() const { return mPlayhead.load( std::memory_order_relaxed ); }
+		//! Render thread: throws away everything decoded so far and starts again from the playhead.
+		void		restart();
+		//! Render thread: returns the decoded frame for \a sample if it's ready, discarding frames the playhead has passed.
+		//! If \a sample was skipped, the frame before it is returned instead. The frame stays valid until releaseFrame().
+		Frame*		acquireFrame( size_t sample );
+		void		releaseFrame();
+		//! Render thread: the oldest decoded frame, without acquiring it, for work on it ahead of time. nullptr if
+		//! there's none since the last seek. It stays valid until the next acquireFrame(), which may discard it.
+		Frame*		peekFrame();
+
+		//! While scrubbing only the frame at the playhead is decoded, every move of the playhead is a seek, and a frame
+		//! read for a playhead that has moved on since isn't decoded.
+		void		setScrubbing( bool scrubbing );
+		bool		isScrubbing() const { return mScrubbing.load( std::memory_order_relaxed ); }
+		//! A smaller encode of the same movie, with the same samples, to decode instead while useProxy() is set.
+		//! Frames in the decoded frame cache are still used as they are.
+		void		setProxy( const MovieReaderRef &proxy ) { std::atomic_store( &mProxy, proxy ); }
+		MovieReaderRef	getProxy() const { return std::atomic_load( &mProxy ); }
+		void		useProxy( bool use = true ) { mUseProxy.store( use, std::memory_order_relaxed ); mScheduler->notify(); }
+		bool		isUsingProxy() const { return mUseProxy.load( std::memory_order_relaxed ) && getProxy(); }
+		//! Only decodes samples whose index is a multiple of \a step. The playhead should be on one of them.
+		void		setFrameStep( int step ) { mFrameStep.store( std::max( 1, step ), std::memory_order_relaxed ); mScheduler->notify(); }
+		int			getFrameStep() const { return mFrameStep.load( std::memory_order_relaxed ); }
+		//! Stops decoding altogether. Frames decoded already stay in the ring.
+		void		setSuspended( bool suspended ) { mSuspended.store( suspended, std::memory_order_relaxed ); mScheduler->notify(); }
+		bool		isSuspended() const { return mSuspended.load( std::memory_order_relaxed ); }
+		//! Keeps the decoded frames in \a cache from now on, and takes frames already there instead of decoding them.
+		//! Pass nullptr to stop caching. Safe to call during playback.
+		void		setDecodedFrameCache( const DecodedFrameCacheRef &cache ) { std::atomic_store( &mDecodedCache, cache ); }
+		DecodedFrameCacheRef	getDecodedFrameCache() const { return std::atomic_load( &mDecodedCache ); }
+
+		const MovieReaderRef&	getReader() const { return mReader; }
+		Stats					getStats() const;
+
+	  private:
+		MovieDecoder( const MovieReaderRef &reader, size_t numFrames );
+
+		typedef DecodeScheduler::Clock	Clock;
+
+		//! How the movie is played, as last reported by the render thread
+		struct Playback {
+			int		mDirection;
+			bool	mLoop, mPalindrome;
+		};
+
+		Playback	getPlayback() const;
+		//! Number of steps in playback order from \a from, played in \a fromDirection, to \a to, played in \a toDirection.
+		//! Negative if \a to comes first. Looping movies and palindromes wrap around.
+		int64_t		getDistance( size_t from, int fromDirection, size_t to, int toDirection, const Playback &playback ) const;
+		//! The sample after \a sample in playback order, turning \a direction round at the ends of a palindrome.
+		//! SIZE_MAX past the end of a movie that doesn't loop.
+		size_t		getNextSample( size_t sample, int *direction, const Playback &playback ) const;
+
+		friend class DecodeScheduler;
+		//! Scheduler, never concurrently with runJob(): finds the next frame to decode, skipping frames that can't be
+		//! ready before they leave the screen. Returns false if there's nothing to do.
+		bool		prepareJob( Clock::time_point now, Clock::time_point *deadline );
+		//! Scheduler: reads and decodes the frame found by prepareJob() into the ring
+		void		runJob();
+		//! When \a sample, played in \a direction, is due on screen and when the sample after it replaces it, given the
+		//! last reported playhead. Paused movies, and the last frame of a movie that doesn't loop, are never replaced.
+		void		getPresentationInterval( size_t sample, int direction, const Playback &playback, Clock::time_point *start, Clock::time_point *end ) const;
+		//! True if no display refresh is expected while the frame is on screen, going by the interval between setPlayhead() calls
+		bool		isBetweenRefreshes( Clock::time_point start, Clock::time_point end ) const;
+
+
+		MovieReaderRef			mReader;
+		FrameRing<Frame>		mRing;
+
+		DecodeSchedulerRef		mScheduler;
+		SampleCacheRef			mCache;
+		//! Accessed atomically, set by the render thread
+		DecodedFrameCacheRef	mDecodedCache;
+		MovieReaderRef			mProxy;
+
+		// Written by the render thread only
+		std::atomic<size_t>		mPlayhead;
+		std::atomic<double>		mPlayheadTime;
+		std::atomic<double>		mRate;
+		std::atomic<Clock::rep>	mReportTime;
+		std::atomic<double>		mRefreshInterval;
+		std::atomic<int>		mDirection;
+		std::atomic<bool>		mLoop, mPalindrome;
+		std::atomic<bool>		mScrubbing, mUseProxy, mSuspended;
+		std::atomic<int>		mFrameStep;
+		std::atomic<uint32_t>	mGeneration;
+
+		// Owned by whichever scheduler thread runs the movie's job
+		uint32_t				mJobGeneration;
+		size_t					mNext;
+		int						mNextDirection;
+		uint64_t				mPreviousOffset;
+		//! Whether the frame at mPreviousOffset came from the proxy
+		bool					mPreviousProxy;
+		Clock::time_point		mNextStart;
+
+		std::atomic<uint32_t>	mFramesDecoded, mCachedFrames, mDuplicateFrames, mFramesDiscarded, mFramesDropped, mFramesSkipped, mLateFrames, mFramesCancelled, mDecodeErrors;
+		std::atomic<uint64_t>	mDecodeMicros;
+	};
+
+} } // namespace cinder::hap
@@ -0,0 +1,292 @@
+/*
+ *  HapMovieReader.cpp
+ *
+ *  Reads the sample tables of a Hap QuickTime movie.
+ *
+ */
+
+#include "HapMovieReader.h"
+
+#include <algorithm>
+
+namespace cinder { namespace hap {
+
+	namespace {
+		uint16_t read16( const uint8_t *p ) { return static_cast<uint16_t>( ( p[0] << 8 ) | p[1] ); }
+		uint32_t read32( const uint8_t *p ) { return ( static_cast<uint32_t>( p[0] ) << 24 ) | ( p[1] << 16 ) | ( p[2] << 8 ) | p[3]; }
+		uint64_t read64( const uint8_t *p ) { return ( static_cast<uint64_t>( read32( p ) ) << 32 ) | read32( p + 4 ); }
+
+		// Iterates over the atoms contained in a buffer
+		class AtomIter {
+		  public:
+			AtomIter( const uint8_t *data, size_t size ) : mData( data ), mEnd( data + size ), mType( 0 ), mPayload( nullptr ), mPayloadSize( 0 ) {}
+
+			bool next()
+			{
+				if( mEnd - mData < 8 )
+					return false;
+
+				uint64_t size = read32( mData );
+				size_t header = 8;
+				if( size == 1 ) {
+					if( mEnd - mData < 16 )
+						return false;
+					size = read64( mData + 8 );
+					header = 16;
+				}
+				else if( size == 0 ) {
+					size = mEnd - mData;
+				}
+
+				if( size < header || size > static_cast<uint64_t>( mEnd - mData ) )
+					throw MovieReaderExc( "Malformed atom." );
+
+				mType = read32( mData + 4 );
+				mPayload = mData + header;
+				mPayloadSize = static_cast<size_t>( size - header );
+				mData += size;
+				return true;
+			}
+
+			uint32_t		getType() const { return mType; }
+			const uint8_t*	getPayload() const { return mPayload; }
+			size_t			getPayloadSize() const { return mPayloadSize; }
+
+		  private:
+			const uint8_t	*mData, *mEnd;
+			uint32_t		mType;
+			const uint8_t	*mPayload;
+			size_t			mPayloadSize;
+		};
+
+		//! Finds the first child atom of \a type. Returns false if there is none.
+		bool findAtom( const uint8_t *data, size_t size, uint32_t type, const uint8_t **payload, size_t *payloadSize )
+		{
+			AtomIter it( data, size );
+			while( it.next() ) {
+				if( it.getType() == type ) {
+					*payload = it.getPayload();
+					*payloadSize = it.getPayloadSize();
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void checkSize( size_t available, size_t needed )
+		{
+			if( available < needed )
+				throw MovieReaderExc( "Truncated sample table." );
+		}
+	} // anonymous namespace
+
+	MovieReader::MovieReader( const fs::path &path )
+	: mPath( path ), mWidth( 0 ), mHeight( 0 ), mCodec( Codec::HAP ), mTimeScale( 0 ), mDuration( 0 )
+	{
+		mStream.open( path.string().c_str(), std::ios::binary );
+		if( ! mStream )
+			throw MovieReaderExc( "Couldn't open " + path.string() + "." );
+
+		// Only the movie atom is loaded; the media data can be anywhere in the file
+		uint64_t position = 0;
+		const uint64_t fileSize = fs::file_size( path );
+		while( position + 8 <= fileSize ) {
+			uint8_t header[16];
+			mStream.seekg( position );
+			mStream.read( reinterpret_cast<char*>( header ), 8 );
+			uint64_t size = read32( header );
+			if( size == 1 ) {
+				mStream.read( reinterpret_cast<char*>( header + 8 ), 8 );
+				size = read64( header + 8 );
+			}
+			else if( size == 0 ) {
+				size = fileSize - position;
+			}
+			if( ! mStream || size < 8 || position + size > fileSize )
+				break;
+
+			if( read32( header + 4 ) == 'moov' ) {
+				std::vector<uint8_t> movie( static_cast<size_t>( size ) );
+				mStream.seekg( position );
+				mStream.read( reinterpret_cast<char*>( movie.data() ), movie.size() );
+				if( ! mStream )
+					break;
+				parseMovie( movie.data() + 8, movie.size() - 8 );
+				return;
+			}
+			position += size;
+		}
+
+		throw MovieReaderExc( path.string() + " has no movie header." );
+	}
+
+	void MovieReader::parseMovie( const uint8_t *data, size_t size )
+	{
+		AtomIter it( data, size );
+		while( it.next() ) {
+			if( it.getType() == 'trak' && parseTrack( it.getPayload(), it.getPayloadSize() ) )
+				return;
+		}
+		throw MovieReaderExc( mPath.string() + " has no Hap video track." );
+	}
+
+	bool MovieReader::parseTrack( const uint8_t *data, size_t size )
+	{
+		const uint8_t *mdia, *hdlr, *mdhd, *minf, *stbl, *atom;
+		size_t mdiaSize, hdlrSize, mdhdSize, minfSize, stblSize, atomSize;
+		if( ! findAtom( data, size, 'mdia', &mdia, &mdiaSize )
+			|| ! findAtom( mdia, mdiaSize, 'hdlr', &hdlr, &hdlrSize ) || hdlrSize < 12 || read32( hdlr + 8 ) != 'vide'
+			|| ! findAtom( mdia, mdiaSize, 'mdhd', &mdhd, &mdhdSize )
+			|| ! findAtom( mdia, mdiaSize, 'minf', &minf, &minfSize )
+			|| ! findAtom( minf, minfSize, 'stbl', &stbl, &stblSize ) )
+			return false;
+
+		// Sample description: the first entry's type is the codec
+		if( ! findAtom( stbl, stblSize, 'stsd', &atom, &atomSize ) || atomSize < 8 + 8 + 28 )
+			return false;
+		const uint8_t *entry = atom + 8;
+		switch( read32( entry + 4 ) ) {
+			case 'Hap1':	mCodec = Codec::HAP; break;
+			case 'Hap5':	mCodec = Codec::HAP_A; break;
+			case 'HapY':	mCodec = Codec::HAP_Q; break;
+			default:		return false;
+		}
+		mWidth = read16( entry + 32 );
+		mHeight = read16( entry + 34 );
+
+		checkSize( mdhdSize, 20 );
+		if( mdhd[0] == 1 ) {
+			checkSize( mdhdSize, 32 );
+			mTimeScale = read32( mdhd + 20 );
+		}
+		else {
+			mTimeScale = read32( mdhd + 12 );
+		}
+		if( mTimeScale == 0 )
+			throw MovieReaderExc( "Invalid time scale." );
+
+		// Sample sizes
+		if( ! findAtom( stbl, stblSize, 'stsz', &atom, &atomSize ) )
+			throw MovieReaderExc( "Missing sample size table." );
+		checkSize( atomSize, 12 );
+		const uint32_t uniformSize = read32( atom + 4 );
+		const uint32_t numSamples = read32( atom + 8 );
+		if( ! uniformSize )
+			checkSize( atomSize, 12 + 4 * static_cast<size_t>( numSamples ) );
+		mSamples.resize( numSamples );
+		for( uint32_t i = 0; i < numSamples; i++ )
+			mSamples[i].mSize = uniformSize ? uniformSize : read32( atom + 12 + 4 * i );
+
+		// Sample times
+		if( ! findAtom( stbl, stblSize, 'stts', &atom, &atomSize ) )
+			throw MovieReaderExc( "Missing time to sample table." );
+		checkSize( atomSize, 8 );
+		const uint32_t numTimeEntries = read32( atom + 4 );
+		checkSize( atomSize, 8 + 8 * static_cast<size_t>( numTimeEntries ) );
+		size_t sample = 0;
+		uint64_t time = 0;
+		for( uint32_t i = 0; i < numTimeEntries; i++ ) {
+			uint32_t count = read32( atom + 8 + 8 * i );
+			uint32_t duration = read32( atom + 12 + 8 * i );
+			for( uint32_t j = 0; j < count && sample < mSamples.size(); j++, sample++ ) {
+				mSamples[sample].mTime = time;
+				mSamples[sample].mDuration = duration;
+				time += duration;
+			}
+		}
+		if( sample != mSamples.size() )
+			throw MovieReaderExc( "Time to sample table doesn't cover every sample." );
+		mDuration = time;
+
+		// Chunk offsets, 32 or 64-bit
+		std::vector<uint64_t> chunkOffsets;
+		bool is64Bit = findAtom( stbl, stblSize, 'co64', &atom, &atomSize );
+		if( ! is64Bit && ! findAtom( stbl, stblSize, 'stco', &atom, &atomSize ) )
+			throw MovieReaderExc( "Missing chunk offset table." );
+		checkSize( atomSize, 8 );
+		const uint32_t numChunks = read32( atom + 4 );
+		checkSize( atomSize, 8 + ( is64Bit ? 8 : 4 ) * static_cast<size_t>( numChunks ) );
+		chunkOffsets.resize( numChunks );
+		for( uint32_t i = 0; i < numChunks; i++ )
+			chunkOffsets[i] = is64Bit ? read64( atom + 8 + 8 * i ) : read32( atom + 8 + 4 * i );
+
+		// Samples are laid out back to back within their chunk
+		if( ! findAtom( stbl, stblSize, 'stsc', &atom, &atomSize ) )
+			throw MovieReaderExc( "Missing sample to chunk table." );
+		checkSize( atomSize, 8 );
+		const uint32_t numChunkEntries = read32( atom + 4 );
+		checkSize( atomSize, 8 + 12 * static_cast<size_t>( numChunkEntries ) );
+		sample = 0;
+		for( uint32_t i = 0; i < numChunkEntries; i++ ) {
+			uint32_t firstChunk = read32( atom + 8 + 12 * i );
+			uint32_t samplesPerChunk = read32( atom + 12 + 12 * i );
+			uint32_t lastChunk = i + 1 < numChunkEntries ? read32( atom + 20 + 12 * i ) : numChunks + 1;
+			if( firstChunk == 0 || lastChunk > numChunks + 1 )
+				throw MovieReaderExc( "Invalid sample to chunk table." );
+
+			for( uint32_t chunk = firstChunk; chunk < lastChunk; chunk++ ) {
+				uint64_t offset = chunkOffsets[chunk - 1];
+				for( uint32_t j = 0; j < samplesPerChunk && sample < mSamples.size(); j++, sample++ ) {
+					mSamples[sample].mOffset = offset;
+					offset += mSamples[sample].mSize;
+				}
+			}
+		}
+		if( sample != mSamples.size() )
+			throw MovieReaderExc( "Sample to chunk table doesn't cover every sample." );
+
+		return true;
+	}
+
+	size_t MovieReader::getSampleIndex( double seconds ) const
+	{
+		if( mSamples.empty() || seconds <= 0 )
+			return 0;
+
+		// The epsilon keeps exact frame times from landing on the previous frame through rounding
+		uint64_t time = static_cast<uint64_t>( seconds * mTimeScale + 1e-6 );
+		auto it = std::upper_bound( mSamples.begin(), mSamples.end(), time, []( uint64_t t, const Sample &sample ) { return t < sample.mTime; } );
+		return static_cast<size_t>( it - mSamples.begin() ) - 1;
+	}
+
+	int64_t MovieReader::getDistance( size_t from, size_t to, int direction, bool loop ) const
+	{
+		int64_t distance = ( static_cast<int64_t>( to ) - static_cast<int64_t>( from ) ) * direction;
+		if( loop && ! mSamples.empty() ) {
+			const int64_t numSamples = static_cast<int64_t>( mSamples.size() );
+			distance %= numSamples;
+			if( distance > numSamples / 2 )
+				distance -= numSamples;
+			else if( distance < -numSamples / 2 )
+				distance += numSamples;
+		}
+		return distance;
+	}
+
+	size_t MovieReader::getNextSample( size_t sample, int direction, bool loop ) const
+	{
+		const size_t numSamples = mSamples.size();
+		if( direction > 0 ) {
+			if( sample + 1 < numSamples )
+				return sample + 1;
+			return loop ? 0 : SIZE_MAX;
+		}
+		if( sample > 0 )
+			return sample - 1;
+		return loop ? numSamples - 1 : SIZE_MAX;
+	}
+
+	void MovieReader::readSample( size_t index, std::vector<uint8_t> *data ) const
+	{
+		const Sample &sample = mSamples.at( index );
+		data->resize( sample.mSize );
+
+		std::lock_guard<std::mutex> lock( mStreamMutex );
+		mStream.clear();
+		mStream.seekg( sample.mOffset );
+		mStream.read( reinterpret_cast<char*>( data->data() ), sample.mSize );
+		if( ! mStream )
+			throw MovieReaderExc( "Couldn't read frame " + std::to_string( index ) + " of " + mPath.string() + "." );
+	}
+
+} } // namespace cinder::hap
@@ -0,0 +1,83 @@
+/*
+ *  HapMovieReader.h
+ *
+ *  Reads the sample tables of a Hap QuickTime movie and the encoded frames they point to,
+ *  without going through QuickTime itself.
+ *
+ */
+#pragma once
+
+#include "HapFormat.h"
+
+#include "cinder/Cinder.h"
+#include "cinder/Exception.h"
+#include "cinder/Filesystem.h"
+
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace cinder { namespace hap {
+
+	typedef std::shared_ptr<class MovieReader> MovieReaderRef;
+
+	//! Parses the first Hap video track of a movie. Edit lists are ignored, so sample times are media times.
+	class MovieReader {
+	  public:
+		struct Sample {
+			//! Position of the encoded frame in the file. Duplicate frames may share an offset.
+			uint64_t	mOffset;
+			uint32_t	mSize;
+			//! Presentation time and duration in time scale units
+			uint64_t	mTime;
+			uint32_t	mDuration;
+		};
+
+		static MovieReaderRef create( const fs::path &path ) { return MovieReaderRef( new MovieReader( path ) ); }
+
+		const fs::path&		getFilePath() const { return mPath; }
+		int32_t				getWidth() const { return mWidth; }
+		int32_t				getHeight() const { return mHeight; }
+		Codec				getCodec() const { return mCodec; }
+		//! Number of time units per second of the video track
+		uint32_t			getTimeScale() const { return mTimeScale; }
+		//! Duration of the video track in time scale units
+		uint64_t			getDuration() const { return mDuration; }
+		double				getDurationSeconds() const { return mDuration / static_cast<double>( mTimeScale ); }
+
+		size_t							getNumSamples() const { return mSamples.size(); }
+		const Sample&					getSample( size_t index ) const { return mSamples[index]; }
+		const std::vector<Sample>&		getSamples() const { return mSamples; }
+		//! Index of the sample displayed at \a seconds, clamped to the track.
+		size_t							getSampleIndex( double seconds ) const;
+		//! Number of steps in playback order from sample \a from to \a to, negative if \a to comes first. Looping movies wrap around.
+		int64_t							getDistance( size_t from, size_t to, int direction, bool loop ) const;
+		//! The sample after \a sample in playback order, or SIZE_MAX past the end of a movie that doesn't loop
+		size_t							getNextSample( size_t sample, int direction, bool loop ) const;
+
+		//! Reads the encoded frame of sample \a index into \a data. Safe to call from several threads.
+		void	readSample( size_t index, std::vector<uint8_t> *data ) const;
+
+	  private:
+		MovieReader( const fs::path &path );
+
+		void	parseMovie( const uint8_t *data, size_t size );
+		bool	parseTrack( const uint8_t *data, size_t size );
+
+		fs::path					mPath;
+		mutable std::ifstream		mStream;
+		mutable std::mutex			mStreamMutex;
+
+		int32_t						mWidth, mHeight;
+		Codec						mCodec;
+		uint32_t					mTimeScale;
+		uint64_t					mDuration;
+		std::vector<Sample>			mSamples;
+	};
+
+	class MovieReaderExc : public Exception {
+	  public:
+		MovieReaderExc( const std::string &description ) : Exception( description ) {}
+	};
+
+} } // namespace cinder::hap
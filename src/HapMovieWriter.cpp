@@ -0,0 +1,411 @@
+/*
+ *  HapMovieWriter.cpp
+ *
+ *  Writes encoded Hap frames to a QuickTime movie.
+ *
+ */
+
+#include "HapMovieWriter.h"
+
+#include "cinder/Log.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+
+namespace cinder { namespace hap {
+
+	namespace {
+		// Seconds between the QuickTime epoch (1904) and the Unix epoch
+		const uint32_t kMacEpochOffset = 2082844800u;
+
+		// Big-endian atom builder. Atoms are opened with begin() and their sizes patched by end().
+		class AtomWriter {
+		  public:
+			void	u8( uint8_t v ) { mData.push_back( v ); }
+			void	u16( uint16_t v ) { u8( v >> 8 ); u8( v & 0xff ); }
+			void	u32( uint32_t v ) { u16( v >> 16 ); u16( v & 0xffff ); }
+			void	u64( uint64_t v ) { u32( static_cast<uint32_t>( v >> 32 ) ); u32( static_cast<uint32_t>( v ) ); }
+			void	zeros( size_t count ) { mData.insert( mData.end(), count, 0 ); }
+			void	pascalString( const std::string &str, size_t fieldLength )
+			{
+				size_t length = std::min( str.size(), fieldLength - 1 );
+				u8( static_cast<uint8_t>( length ) );
+				mData.insert( mData.end(), str.begin(), str.begin() + length );
+				zeros( fieldLength - 1 - length );
+			}
+			void	matrix()
+			{
+				const uint32_t identity[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+				for( uint32_t v : identity )
+					u32( v );
+			}
+
+			void	begin( uint32_t type )
+			{
+				mOpen.push_back( mData.size() );
+				u32( 0 );
+				u32( type );
+			}
+			void	beginFull( uint32_t type, uint8_t version, uint32_t flags )
+			{
+				begin( type );
+				u32( ( static_cast<uint32_t>( version ) << 24 ) | flags );
+			}
+			void	end()
+			{
+				size_t start = mOpen.back();
+				mOpen.pop_back();
+				patch32( start, static_cast<uint32_t>( mData.size() - start ) );
+			}
+
+			//! Overwrites a previously written 32-bit value
+			void	patch32( size_t offset, uint32_t v )
+			{
+				for( int i = 0; i < 4; i++ )
+					mData[offset + i] = static_cast<uint8_t>( v >> ( 24 - 8 * i ) );
+			}
+
+			size_t						getSize() const { return mData.size(); }
+			const std::vector<uint8_t>&	getData() const { return mData; }
+
+		  private:
+			std::vector<uint8_t>	mData;
+			std::vector<size_t>		mOpen;
+		};
+
+		const char* getCompressorName( Codec codec )
+		{
+			switch( codec ) {
+				case Codec::HAP_A:	return "Hap Alpha";
+				case Codec::HAP_Q:	return "Hap Q";
+				default:			return "Hap";
+			}
+		}
+	} // anonymous namespace
+
+	MovieWriter::Format& MovieWriter::Format::frameRate( double fps )
+	{
+		// 23.976, 29.97, 59.94 etc. are exact multiples of 1000 / 1001
+		double ntsc = fps * 1.001;
+		if( std::fabs( ntsc - std::floor( ntsc + 0.5 ) ) < 0.001 && std::fabs( fps - std::floor( fps + 0.5 ) ) > 0.001 ) {
+			mTimeScale = static_cast<uint32_t>( std::floor( ntsc + 0.5 ) ) * 1000;
+			mFrameDuration = 1001;
+		}
+		else if( std::fabs( fps - std::floor( fps + 0.5 ) ) < 0.001 ) {
+			mTimeScale = static_cast<uint32_t>( std::floor( fps + 0.5 ) ) * 100;
+			mFrameDuration = 100;
+		}
+		else {
+			mTimeScale = static_cast<uint32_t>( std::floor( fps * 1000 + 0.5 ) );
+			mFrameDuration = 1000;
+		}
+		return *this;
+	}
+
+	MovieWriter::MovieWriter( const fs::path &path, int32_t width, int32_t height, const Format &format )
+	: mWidth( width ), mHeight( height ), mFormat( format ), mFinished( false ), mDataSize( 0 ), mNumDuplicateFrames( 0 )
+	{
+		// Opened for reading too, so that possible duplicates can be compared with what was written
+		mStream.open( path.string().c_str(), std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc );
+		if( ! mStream )
+			throw MovieWriterExc( "Couldn't open " + path.string() + " for writing." );
+
+		AtomWriter header;
+		header.begin( 'ftyp' );
+		header.u32( 'qt  ' );
+		header.u32( 0x20050300 );
+		header.u32( 'qt  ' );
+		header.end();
+
+		// The media data atom uses a 64-bit size, patched in finish(), so movies can grow past 4GB
+		header.u32( 1 );
+		header.u32( 'mdat' );
+		header.u64( 0 );
+
+		mStream.write( reinterpret_cast<const char*>( header.getData().data() ), header.getData().size() );
+		mMediaDataOffset = header.getSize() - 16;
+	}
+
+	MovieWriter::~MovieWriter()
+	{
+		if( ! mFinished ) {
+			try {
+				finish();
+			}
+			catch( const std::exception &exc ) {
+				CI_LOG_E( "HAP ERROR :: couldn't finish movie: " << exc.what() );
+			}
+		}
+	}
+
+	void MovieWriter::addFrame( const uint8_t *data, size_t size, uint32_t duration )
+	{
+		if( mFinished )
+			throw MovieWriterExc( "Can't add frames to a finished movie." );
+
+		// The tables only take the frame once it's in the file, so a failed write leaves them consistent
+		const uint32_t sampleDuration = duration ? duration : mFormat.getFrameDuration();
+		uint64_t hash = 0;
+		if( mFormat.getDeduplicate() ) {
+			hash = hashData( data, size );
+			int64_t duplicate = findDuplicate( data, size, hash );
+			if( duplicate >= 0 ) {
+				mSampleOffsets.push_back( mSampleOffsets[static_cast<size_t>( duplicate )] );
+				mSampleSizes.push_back( static_cast<uint32_t>( size ) );
+				mSampleDurations.push_back( sampleDuration );
+				mNumDuplicateFrames++;
+				return;
+			}
+		}
+
+		mStream.write( reinterpret_cast<const char*>( data ), size );
+		if( ! mStream )
+			throw MovieWriterExc( "Failed writing frame data." );
+
+		if( mFormat.getDeduplicate() )
+			mFrameHashes.insert( std::make_pair( hash, mSampleOffsets.size() ) );
+		mSampleOffsets.push_back( mMediaDataOffset + 16 + mDataSize );
+		mSampleSizes.push_back( static_cast<uint32_t>( size ) );
+		mSampleDurations.push_back( sampleDuration );
+		mDataSize += size;
+	}
+
+	uint64_t MovieWriter::copyData( std::istream &source, uint64_t length )
+	{
+		if( mFinished )
+			throw MovieWriterExc( "Can't add frames to a finished movie." );
+
+		const uint64_t offset = mMediaDataOffset + 16 + mDataSize;
+		const size_t kBlockSize = 8 * 1024 * 1024;
+		mScratch.resize( static_cast<size_t>( std::min<uint64_t>( length, kBlockSize ) ) );
+		for( uint64_t copied = 0; copied < length; ) {
+			size_t block = static_cast<size_t>( std::min<uint64_t>( length - copied, kBlockSize ) );
+			source.read( reinterpret_cast<char*>( mScratch.data() ), block );
+			if( ! source )
+				throw MovieWriterExc( "Failed reading frame data to copy." );
+			mStream.write( reinterpret_cast<const char*>( mScratch.data() ), block );
+			if( ! mStream )
+				throw MovieWriterExc( "Failed writing frame data." );
+			copied += block;
+		}
+
+		mDataSize += length;
+		return offset;
+	}
+
+	void MovieWriter::addFrameReference( uint64_t offset, uint32_t size, uint32_t duration )
+	{
+		if( mFinished )
+			throw MovieWriterExc( "Can't add frames to a finished movie." );
+		if( offset < mMediaDataOffset + 16 || offset + size > mMediaDataOffset + 16 + mDataSize )
+			throw MovieWriterExc( "Frame reference is outside the written data." );
+
+		mSampleOffsets.push_back( offset );
+		mSampleSizes.push_back( size );
+		mSampleDurations.push_back( duration ? duration : mFormat.getFrameDuration() );
+	}
+
+	int64_t MovieWriter::findDuplicate( const uint8_t *data, size_t size, uint64_t hash )
+	{
+		auto range = mFrameHashes.equal_range( hash );
+		for( auto it = range.first; it != range.second; ++it ) {
+			size_t index = it->second;
+			if( mSampleSizes[index] != size )
+				continue;
+
+			// Hashes can collide, so the candidate is read back and compared byte for byte
+			mScratch.resize( size );
+			mStream.seekg( mSampleOffsets[index] );
+			mStream.read( reinterpret_cast<char*>( mScratch.data() ), size );
+			bool match = mStream && memcmp( mScratch.data(), data, size ) == 0;
+			mStream.clear();
+			mStream.seekp( 0, std::ios::end );
+			if( match )
+				return static_cast<int64_t>( index );
+		}
+		return -1;
+	}
+
+	void MovieWriter::finish()
+	{
+		if( mFinished )
+			return;
+		mFinished = true;
+
+		writeMovieHeader();
+
+		mStream.seekp( mMediaDataOffset + 8 );
+		uint64_t mediaDataSize = 16 + mDataSize;
+		for( int i = 0; i < 8; i++ )
+			mStream.put( static_cast<char>( mediaDataSize >> ( 56 - 8 * i ) ) );
+
+		mStream.close();
+		if( mStream.fail() )
+			throw MovieWriterExc( "Failed writing movie header." );
+	}
+
+	void MovieWriter::writeMovieHeader()
+	{
+		const uint32_t now = static_cast<uint32_t>( std::time( nullptr ) ) + kMacEpochOffset;
+		const uint32_t timeScale = mFormat.getTimeScale();
+		const Codec codec = mFormat.getCodec();
+
+		uint64_t duration = 0;
+		for( uint32_t d : mSampleDurations )
+			duration += d;
+
+		AtomWriter moov;
+		moov.begin( 'moov' );
+
+		moov.beginFull( 'mvhd', 0, 0 );
+		moov.u32( now );
+		moov.u32( now );
+		moov.u32( timeScale );
+		moov.u32( static_cast<uint32_t>( duration ) );
+		moov.u32( 0x00010000 );		// preferred rate
+		moov.u16( 0x0100 );			// preferred volume
+		moov.zeros( 10 );
+		moov.matrix();
+		moov.zeros( 6 * 4 );		// preview, poster, selection and current time
+		moov.u32( 2 );				// next track ID
+		moov.end();
+
+		moov.begin( 'trak' );
+		moov.beginFull( 'tkhd', 0, 0x0f );	// enabled, in movie, in preview, in poster
+		moov.u32( now );
+		moov.u32( now );
+		moov.u32( 1 );				// track ID
+		moov.zeros( 4 );
+		moov.u32( static_cast<uint32_t>( duration ) );
+		moov.zeros( 8 );
+		moov.u16( 0 );				// layer
+		moov.u16( 0 );				// alternate group
+		moov.u16( 0 );				// volume
+		moov.zeros( 2 );
+		moov.matrix();
+		moov.u32( static_cast<uint32_t>( mWidth ) << 16 );
+		moov.u32( static_cast<uint32_t>( mHeight ) << 16 );
+		moov.end();
+
+		moov.begin( 'mdia' );
+		moov.beginFull( 'mdhd', 0, 0 );
+		moov.u32( now );
+		moov.u32( now );
+		moov.u32( timeScale );
+		moov.u32( static_cast<uint32_t>( duration ) );
+		moov.u16( 0 );				// language
+		moov.u16( 0 );				// quality
+		moov.end();
+
+		moov.beginFull( 'hdlr', 0, 0 );
+		moov.u32( 'mhlr' );
+		moov.u32( 'vide' );
+		moov.u32( 'appl' );
+		moov.zeros( 8 );
+		moov.pascalString( "Video Media Handler", 20 );
+		moov.end();
+
+		moov.begin( 'minf' );
+		moov.beginFull( 'vmhd', 0, 1 );
+		moov.u16( 0x40 );			// ditherCopy
+		moov.u16( 0x8000 );
+		moov.u16( 0x8000 );
+		moov.u16( 0x8000 );
+		moov.end();
+
+		moov.beginFull( 'hdlr', 0, 0 );
+		moov.u32( 'dhlr' );
+		moov.u32( 'alis' );
+		moov.u32( 'appl' );
+		moov.zeros( 8 );
+		moov.pascalString( "Data Handler", 13 );
+		moov.end();
+
+		moov.begin( 'dinf' );
+		moov.beginFull( 'dref', 0, 0 );
+		moov.u32( 1 );
+		moov.beginFull( 'alis', 0, 1 );	// media data is in this file
+		moov.end();
+		moov.end();
+		moov.end();
+
+		moov.begin( 'stbl' );
+		moov.beginFull( 'stsd', 0, 0 );
+		moov.u32( 1 );
+		moov.begin( getCodecFourCC( codec ) );
+		moov.zeros( 6 );
+		moov.u16( 1 );				// data reference index
+		moov.u16( 0 );				// version
+		moov.u16( 0 );				// revision
+		moov.u32( 0 );				// vendor
+		moov.u32( 0 );				// temporal quality
+		moov.u32( 0x200 );			// spatial quality
+		moov.u16( static_cast<uint16_t>( mWidth ) );
+		moov.u16( static_cast<uint16_t>( mHeight ) );
+		moov.u32( 0x00480000 );		// 72 dpi
+		moov.u32( 0x00480000 );
+		moov.u32( 0 );				// data size
+		moov.u16( 1 );				// frames per sample
+		moov.pascalString( getCompressorName( codec ), 32 );
+		moov.u16( codec == Codec::HAP_A ? 32 : 24 );
+		moov.u16( 0xffff );			// no color table
+		moov.end();
+		moov.end();
+
+		// Run-length encoded frame durations
+		moov.beginFull( 'stts', 0, 0 );
+		size_t countOffset = moov.getSize();
+		moov.u32( 0 );
+		uint32_t entries = 0;
+		for( size_t i = 0; i < mSampleDurations.size(); ) {
+			size_t run = i + 1;
+			while( run < mSampleDurations.size() && mSampleDurations[run] == mSampleDurations[i] )
+				run++;
+			moov.u32( static_cast<uint32_t>( run - i ) );
+			moov.u32( mSampleDurations[i] );
+			entries++;
+			i = run;
+		}
+		moov.patch32( countOffset, entries );
+		moov.end();
+
+		// One sample per chunk, so every frame's offset is stored directly in the chunk offset table
+		moov.beginFull( 'stsc', 0, 0 );
+		moov.u32( 1 );
+		moov.u32( 1 );
+		moov.u32( 1 );
+		moov.u32( 1 );
+		moov.end();
+
+		moov.beginFull( 'stsz', 0, 0 );
+		moov.u32( 0 );
+		moov.u32( static_cast<uint32_t>( mSampleSizes.size() ) );
+		for( uint32_t size : mSampleSizes )
+			moov.u32( size );
+		moov.end();
+
+		// Duplicates and frame references point back into the data, so the last offset needn't be the largest
+		bool needs64BitOffsets = ! mSampleOffsets.empty() && *std::max_element( mSampleOffsets.begin(), mSampleOffsets.end() ) > 0xffffffffu;
+		moov.beginFull( needs64BitOffsets ? 'co64' : 'stco', 0, 0 );
+		moov.u32( static_cast<uint32_t>( mSampleOffsets.size() ) );
+		for( uint64_t offset : mSampleOffsets ) {
+			if( needs64BitOffsets )
+				moov.u64( offset );
+			else
+				moov.u32( static_cast<uint32_t>( offset ) );
+		}
+		moov.end();
+
+		moov.end();	// stbl
+		moov.end();	// minf
+		moov.end();	// mdia
+		moov.end();	// trak
+		moov.end();	// moov
+
+		mStream.seekp( 0, std::ios::end );
+		mStream.write( reinterpret_cast<const char*>( moov.getData().data() ), moov.getData().size() );
+	}
+
+} } // namespace cinder::hap
@@ -0,0 +1,100 @@
+/*
+ *  HapMovieWriter.h
+ *
+ *  Writes encoded Hap frames to a QuickTime movie without going through QuickTime itself,
+ *  so it is available to 64-bit tools and threads that don't own a QuickTime context.
+ *
+ */
+#pragma once
+
+#include "HapFormat.h"
+
+#include "cinder/Cinder.h"
+#include "cinder/Exception.h"
+#include "cinder/Filesystem.h"
+
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+
+namespace cinder { namespace hap {
+
+	typedef std::shared_ptr<class MovieWriter> MovieWriterRef;
+
+	class MovieWriter {
+	  public:
+		struct Format {
+			Format() : mCodec( Codec::HAP ), mTimeScale( 600 ), mFrameDuration( 20 ), mDeduplicate( true ) {}
+
+			Format&		codec( Codec codec ) { mCodec = codec; return *this; }
+			//! Number of time units per second
+			Format&		timeScale( uint32_t timeScale ) { mTimeScale = timeScale; return *this; }
+			//! Default duration of a frame, in time units
+			Format&		frameDuration( uint32_t duration ) { mFrameDuration = duration; return *this; }
+			//! Picks a time scale and frame duration that represent \a fps exactly, including the NTSC rates.
+			Format&		frameRate( double fps );
+			//! Stores frames identical to an earlier one only once, pointing their sample table entries at the same bytes. Enabled by default.
+			Format&		deduplicate( bool enable = true ) { mDeduplicate = enable; return *this; }
+
+			Codec		getCodec() const { return mCodec; }
+			uint32_t	getTimeScale() const { return mTimeScale; }
+			uint32_t	getFrameDuration() const { return mFrameDuration; }
+			bool		getDeduplicate() const { return mDeduplicate; }
+
+		  private:
+			Codec		mCodec;
+			uint32_t	mTimeScale, mFrameDuration;
+			bool		mDeduplicate;
+		};
+
+		static MovieWriterRef create( const fs::path &path, int32_t width, int32_t height, const Format &format = Format() )
+		{ return MovieWriterRef( new MovieWriter( path, width, height, format ) ); }
+		~MovieWriter();
+
+		//! Appends an encoded Hap frame lasting \a duration time units, or the Format's frame duration if 0.
+		void	addFrame( const uint8_t *data, size_t size, uint32_t duration = 0 );
+		void	addFrame( const std::vector<uint8_t> &frame, uint32_t duration = 0 ) { addFrame( frame.data(), frame.size(), duration ); }
+		//! Copies \a length bytes of frame data from the current position of \a source without adding any frames, in large
+		//! sequential blocks. Returns the file offset the data was written at, for addFrameReference().
+		uint64_t	copyData( std::istream &source, uint64_t length );
+		//! Appends a frame whose \a size bytes were already written at \a offset, by copyData() or an earlier frame.
+		void		addFrameReference( uint64_t offset, uint32_t size, uint32_t duration = 0 );
+		//! Writes the movie header. Called by the destructor if needed; no frames can be added afterwards.
+		void	finish();
+
+		uint32_t		getNumFrames() const { return static_cast<uint32_t>( mSampleSizes.size() ); }
+		//! Number of frames that reuse the data of an earlier frame
+		uint32_t		getNumDuplicateFrames() const { return mNumDuplicateFrames; }
+		//! Total size of the frame data written so far
+		uint64_t		getDataSize() const { return mDataSize; }
+		const Format&	getFormat() const { return mFormat; }
+
+	  private:
+		MovieWriter( const fs::path &path, int32_t width, int32_t height, const Format &format );
+
+		void	writeMovieHeader();
+		//! Returns the index of an earlier frame with the same contents, or -1
+		int64_t	findDuplicate( const uint8_t *data, size_t size, uint64_t hash );
+
+		std::fstream			mStream;
+		int32_t					mWidth, mHeight;
+		Format					mFormat;
+		bool					mFinished;
+
+		uint64_t				mMediaDataOffset, mDataSize;
+		std::vector<uint64_t>	mSampleOffsets;
+		std::vector<uint32_t>	mSampleSizes;
+		std::vector<uint32_t>	mSampleDurations;
+
+		std::unordered_multimap<uint64_t, size_t>	mFrameHashes;
+		//! Holds frames read back for comparison and blocks being copied
+		std::vector<uint8_t>	mScratch;
+		uint32_t				mNumDuplicateFrames;
+	};
+
+	class MovieWriterExc : public Exception {
+	  public:
+		MovieWriterExc( const std::string &description ) : Exception( description ) {}
+	};
+
+} } // namespace cinder::hap
@@ -0,0 +1,150 @@
+/*
+ *  HapPixelBufferRing.cpp
+ *
+ *  Ring of pixel unpack buffers that compressed texture uploads are staged in.
+ *
+ */
+
+#include "HapPixelBufferRing.h"
+
+#include "cinder/Log.h"
+#include "cinder/gl/scoped.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace cinder { namespace hap {
+
+	namespace {
+		//! Slots start on this boundary, which suits every driver's copy engine
+		const size_t kSlotAlignment = 256;
+
+		size_t alignSlot( size_t size )
+		{
+			return ( size + kSlotAlignment - 1 ) & ~( kSlotAlignment - 1 );
+		}
+	}
+
+	PixelBufferRing::PixelBufferRing( size_t slotSize, size_t numSlots )
+	: mBuffer( 0 ), mMapping( nullptr ), mSlotSize( 0 ), mFences( std::max<size_t>( 1, numSlots ), nullptr ), mNextSlot( 0 ),
+		mUploads( 0 ), mClientUploads( 0 ), mReallocations( 0 )
+	{
+		mPersistent = gl::isExtensionAvailable( "GL_ARB_buffer_storage" );
+		allocate( slotSize );
+	}
+
+	PixelBufferRing::~PixelBufferRing()
+	{
+		release();
+	}
+
+	void PixelBufferRing::allocate( size_t slotSize )
+	{
+		mSlotSize = alignSlot( slotSize );
+		const GLsizeiptr size = static_cast<GLsizeiptr>( mSlotSize * mFences.size() );
+		glGenBuffers( 1, &mBuffer );
+		gl::ScopedBuffer bind( GL_PIXEL_UNPACK_BUFFER, mBuffer );
+		if( mPersistent ) {
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage( GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags );
+			mMapping = static_cast<uint8_t*>( glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, size, flags ) );
+			if( ! mMapping ) {
+				CI_LOG_E( "HAP ERROR :: couldn't map the pixel buffers persistently, mapping them per upload instead" );
+				mPersistent = false;
+				glDeleteBuffers( 1, &mBuffer );
+				allocate( slotSize );
+			}
+		}
+		else
+			glBufferData( GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW );
+	}
+
+	void PixelBufferRing::release()
+	{
+		for( auto &fence : mFences ) {
+			if( fence )
+				glDeleteSync( fence );
+			fence = nullptr;
+		}
+		if( mMapping ) {
+			gl::ScopedBuffer bind( GL_PIXEL_UNPACK_BUFFER, mBuffer );
+			glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+			mMapping = nullptr;
+		}
+		// Uploads still reading the buffer keep it alive on the GPU side
+		glDeleteBuffers( 1, &mBuffer );
+		mBuffer = 0;
+	}
+
+	void PixelBufferRing::upload( const void *data, size_t size, const std::function<void( const GLvoid *pixels )> &upload )
+	{
+		this->upload( data, size, size, 1, [&]( const GLvoid *pixels, size_t ) { upload( pixels ); } );
+	}
+
+	void PixelBufferRing::upload( const void *data, size_t rowBytes, size_t rowPitch, size_t rows, const std::function<void( const GLvoid *pixels, size_t rowPitch )> &upload )
+	{
+		const size_t size = rowBytes * rows;
+		const auto copy = [=]( uint8_t *dst ) {
+			if( rowPitch == rowBytes )
+				std::memcpy( dst, data, size );
+			else {
+				for( size_t row = 0; row < rows; row++ )
+					std::memcpy( dst + row * rowBytes, static_cast<const uint8_t*>( data ) + row * rowPitch, rowBytes );
+			}
+		};
+
+		if( size > mSlotSize ) {
+			release();
+			allocate( size );
+			mNextSlot = 0;
+			mReallocations++;
+		}
+
+		const size_t slot = mNextSlot;
+		GLsync &fence = mFences[slot];
+		if( fence ) {
+			if( glClientWaitSync( fence, 0, 0 ) == GL_TIMEOUT_EXPIRED ) {
+				mClientUploads++;
+				upload( data, rowPitch );
+				return;
+			}
+			glDeleteSync( fence );
+			fence = nullptr;
+		}
+
+		gl::ScopedBuffer bind( GL_PIXEL_UNPACK_BUFFER, mBuffer );
+		const size_t offset = slot * mSlotSize;
+		if( mPersistent )
+			copy( mMapping + offset );
+		else {
+			// The fence already says the GPU is done with the slot, so there's nothing for the driver to wait for
+			void *mapping = glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT );
+			if( ! mapping ) {
+				gl::ScopedBuffer unbind( GL_PIXEL_UNPACK_BUFFER, 0 );
+				mClientUploads++;
+				upload( data, rowPitch );
+				return;
+			}
+			copy( static_cast<uint8_t*>( mapping ) );
+			glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+		}
+
+		upload( reinterpret_cast<const GLvoid*>( offset ), rowBytes );
+		fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+		mNextSlot = ( slot + 1 ) % mFences.size();
+		mUploads++;
+	}
+
+	PixelBufferRing::Stats PixelBufferRing::getStats() const
+	{
+		Stats stats;
+		stats.mPersistent = mPersistent;
+		stats.mSlotSize = mSlotSize;
+		stats.mNumSlots = mFences.size();
+		stats.mUploads = mUploads;
+		stats.mClientUploads = mClientUploads;
+		stats.mReallocations = mReallocations;
+		return stats;
+	}
+
+} } // namespace cinder::hap
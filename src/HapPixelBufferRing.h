@@ -0,0 +1,70 @@
+/*
+ *  HapPixelBufferRing.h
+ *
+ *  Ring of pixel unpack buffers that compressed texture uploads are staged in.
+ *
+ */
+#pragma once
+
+#include "cinder/Cinder.h"
+#include "cinder/gl/gl.h"
+
+#include <functional>
+
+namespace cinder { namespace hap {
+
+	typedef std::shared_ptr<class PixelBufferRing> PixelBufferRingRef;
+
+	//! Stages frames in a buffer object so the texture upload reads from GPU-visible memory: the upload call returns as
+	//! soon as it's queued and the copy into the texture happens on the GPU's own time. The buffer is split in slots,
+	//! each fenced after its upload and reused only once the GPU is done with it. Where ARB_buffer_storage is available
+	//! the buffer is mapped once, persistently, otherwise each slot is mapped unsynchronized as it's written.
+	//! Every call must be made with the GL context that created the ring current.
+	class PixelBufferRing {
+	  public:
+		struct Stats {
+			Stats() : mPersistent( false ), mSlotSize( 0 ), mNumSlots( 0 ), mUploads( 0 ), mClientUploads( 0 ), mReallocations( 0 ) {}
+
+			bool		mPersistent;
+			size_t		mSlotSize, mNumSlots;
+			//! Frames staged in a slot
+			uint32_t	mUploads;
+			//! Frames uploaded from client memory because every slot was still being read, or mapping failed
+			uint32_t	mClientUploads;
+			//! Times the slots were reallocated for a larger frame
+			uint32_t	mReallocations;
+		};
+
+		//! \a numSlots slots of \a slotSize bytes each. Slots grow when a larger frame is uploaded.
+		static PixelBufferRingRef create( size_t slotSize, size_t numSlots = 3 ) { return PixelBufferRingRef( new PixelBufferRing( slotSize, numSlots ) ); }
+		~PixelBufferRing();
+
+		//! Copies \a size bytes of \a data to the next free slot, binds the buffer to GL_PIXEL_UNPACK_BUFFER and calls
+		//! \a upload with the slot's offset to pass to the gl*TexSubImage*() call in place of the data pointer. Calls
+		//! it with \a data itself and no buffer bound if no slot is free, so it never waits for the GPU.
+		void		upload( const void *data, size_t size, const std::function<void( const GLvoid *pixels )> &upload );
+		//! Stages \a rows rows of \a rowBytes bytes, each \a rowPitch bytes after the one before in \a data, packed
+		//! together in the slot. That copy is the only one, so padded frames cost no more than packed ones. \a upload
+		//! gets the pitch of the rows it's given: \a rowBytes when staged, \a rowPitch when given \a data itself.
+		void		upload( const void *data, size_t rowBytes, size_t rowPitch, size_t rows, const std::function<void( const GLvoid *pixels, size_t rowPitch )> &upload );
+
+		Stats		getStats() const;
+
+	  private:
+		PixelBufferRing( size_t slotSize, size_t numSlots );
+
+		void		allocate( size_t slotSize );
+		void		release();
+
+		GLuint					mBuffer;
+		//! Base of the persistent mapping, nullptr if slots are mapped one at a time
+		uint8_t					*mMapping;
+		bool					mPersistent;
+		size_t					mSlotSize;
+		//! Fence set after each slot's last upload, nullptr once the GPU is known to be done with it
+		std::vector<GLsync>		mFences;
+		size_t					mNextSlot;
+		uint32_t				mUploads, mClientUploads, mReallocations;
+	};
+
+} } // namespace cinder::hap
@@ -0,0 +1,82 @@
+/*
+ *  HapPresentationClock.cpp
+ *
+ *  Picks the frame of a Hap movie to show on each display refresh.
+ *
+ */
+
+#include "HapPresentationClock.h"
+
+#include <cmath>
+
+namespace cinder { namespace hap {
+
+	PresentationClock::PresentationClock( const MovieReaderRef &reader, Policy policy )
+	: mReader( reader ), mPolicy( policy ), mLastSample( SIZE_MAX ), mLastSelectionTime( 0 ), mDirection( 1 )
+	{
+	}
+
+	size_t PresentationClock::selectFrame( double seconds, double rate, bool loop )
+	{
+		const MovieReader &reader = *mReader;
+		const size_t numSamples = reader.getNumSamples();
+		const double duration = reader.getDurationSeconds();
+		if( numSamples == 0 || duration <= 0 )
+			return 0;
+
+		if( rate != 0 )
+			mDirection = rate > 0 ? 1 : -1;
+		auto wrap = [=]( double time ) {
+			if( ! loop )
+				return time;
+			time = std::fmod( time, duration );
+			return time < 0 ? time + duration : time;
+		};
+
+		double lookupTime = wrap( seconds );
+		if( mPolicy != Policy::ALWAYS_LATEST ) {
+			// Rounding to the closest frame start is truncating half a frame further on. Playing backwards, frames start at their end time.
+			const MovieReader::Sample &info = reader.getSample( reader.getSampleIndex( lookupTime ) );
+			lookupTime = wrap( lookupTime + mDirection * ( info.mDuration / 2.0 ) / reader.getTimeScale() );
+		}
+		size_t sample = reader.getSampleIndex( lookupTime );
+		if( lookupTime < 0 || lookupTime >= duration ) {
+			// Held at either end of a movie that doesn't loop
+			const MovieReader::Sample &info = reader.getSample( sample );
+			lookupTime = ( info.mTime + info.mDuration / 2.0 ) / reader.getTimeScale();
+		}
+
+		// Jumps further than half a second of playback aren't playback
+		const int64_t maxStep = 1 + static_cast<int64_t>( 0.5 * numSamples / duration * std::abs( rate ) );
+		const int64_t distance = mLastSample != SIZE_MAX ? reader.getDistance( mLastSample, sample, mDirection, loop ) : 0;
+		const bool playing = rate != 0 && mLastSample != SIZE_MAX;
+
+		if( mPolicy == Policy::NEVER_SKIP && playing && distance > 1 && distance <= maxStep ) {
+			sample = reader.getNextSample( mLastSample, mDirection, loop );
+			const MovieReader::Sample &info = reader.getSample( sample );
+			lookupTime = ( info.mTime + info.mDuration / 2.0 ) / reader.getTimeScale();
+		}
+		mLastSelectionTime = lookupTime;
+
+		mStats.mRefreshes++;
+		if( mLastSample == SIZE_MAX )
+			mStats.mFramesShown++;
+		else if( sample == mLastSample ) {
+			// Holding the last frame of a movie that has ended isn't a repeat
+			if( playing && reader.getNextSample( sample, mDirection, loop ) != SIZE_MAX )
+				mStats.mFramesRepeated++;
+		}
+		else {
+			mStats.mFramesShown++;
+			const int64_t step = reader.getDistance( mLastSample, sample, mDirection, loop );
+			if( ! playing || step < 0 || step > maxStep )
+				mStats.mSeeks++;
+			else
+				mStats.mFramesDropped += static_cast<uint32_t>( step - 1 );
+		}
+
+		mLastSample = sample;
+		return sample;
+	}
+
+} } // namespace cinder::hap
@@ -0,0 +1,75 @@
+/*
+ *  HapPresentationClock.h
+ *
+ *  Picks the frame of a Hap movie to show on each display refresh.
+ *
+ */
+#pragma once
+
+#include "HapMovieReader.h"
+
+#include "cinder/Cinder.h"
+
+namespace cinder { namespace hap {
+
+	typedef std::shared_ptr<class PresentationClock> PresentationClockRef;
+
+	//! Maps the movie time at which a display refresh will be scanned out to the sample shown on it, and counts the
+	//! frames that were skipped or shown on more than one refresh. Call selectFrame() exactly once per refresh.
+	class PresentationClock {
+	  public:
+		enum class Policy {
+			//! The frame whose start time is closest to the scan-out time. Rounding rather than truncating keeps the
+			//! cadence steady when the refresh phase sits near a frame boundary, as with 50 fps on a 60 Hz output.
+			NEAREST,
+			//! The last frame that has started by the scan-out time, so the newest frame is always on screen
+			ALWAYS_LATEST,
+			//! Like NEAREST, but advances at most one frame per refresh. Frames are never skipped and a slow display
+			//! falls behind the clock instead. Falling more than half a second behind counts as a seek.
+			NEVER_SKIP
+		};
+
+		struct Stats {
+			Stats() : mRefreshes( 0 ), mFramesShown( 0 ), mFramesDropped( 0 ), mFramesRepeated( 0 ), mSeeks( 0 ) {}
+
+			uint32_t	mRefreshes;
+			//! Refreshes that showed a different frame from the one before
+			uint32_t	mFramesShown;
+			//! Frames passed over between two refreshes
+			uint32_t	mFramesDropped;
+			//! Refreshes that showed the same frame again while the movie was playing
+			uint32_t	mFramesRepeated;
+			//! Jumps that were too far, or in the wrong direction, to be playback
+			uint32_t	mSeeks;
+		};
+
+		static PresentationClockRef create( const MovieReaderRef &reader, Policy policy = Policy::NEAREST ) { return PresentationClockRef( new PresentationClock( reader, policy ) ); }
+
+		void		setPolicy( Policy policy ) { mPolicy = policy; }
+		Policy		getPolicy() const { return mPolicy; }
+
+		//! Returns the sample to show on the refresh scanned out at movie time \a seconds. \a rate is negative when
+		//! playing backwards and zero when paused. Times past either end wrap around if \a loop is set.
+		size_t		selectFrame( double seconds, double rate, bool loop );
+		//! Forgets the previous frame, so the next selectFrame() isn't counted as a drop, repeat or seek
+		void		reset() { mLastSample = SIZE_MAX; }
+
+		//! The sample returned by the last selectFrame(), or SIZE_MAX
+		size_t		getLastSample() const { return mLastSample; }
+		//! The movie time the last frame was picked for. It lies within that frame, half a frame on from the scan-out
+		//! time with NEAREST.
+		double		getLastSelectionTime() const { return mLastSelectionTime; }
+		const Stats&	getStats() const { return mStats; }
+
+	  private:
+		PresentationClock( const MovieReaderRef &reader, Policy policy );
+
+		MovieReaderRef	mReader;
+		Policy			mPolicy;
+		size_t			mLastSample;
+		double			mLastSelectionTime;
+		int				mDirection;
+		Stats			mStats;
+	};
+
+} } // namespace cinder::hap
@@ -0,0 +1,192 @@
+/*
+ *  HapRecorder.cpp
+ *
+ *  Records frames handed over by a real-time app to a Hap movie.
+ *
+ */
+
+#include "HapRecorder.h"
+
+#include "cinder/Log.h"
+#include "cinder/Thread.h"
+
+#include <chrono>
+#include <cstring>
+#include <map>
+
+namespace cinder { namespace hap {
+
+	struct Recorder::Slot {
+		uint32_t								mIndex;
+		//! Frames dropped between the previous accepted frame and this one
+		uint32_t								mDropsBefore;
+		std::chrono::steady_clock::time_point	mAddedTime;
+		std::vector<uint8_t>					mPixels;
+		std::vector<uint8_t>					mFrame;
+	};
+
+	Recorder::Recorder( const fs::path &path, int32_t width, int32_t height, const Format &format )
+	: mWidth( width ), mHeight( height ), mFormat( format ),
+		mFreeSlots( format.getMaxFramesInFlight() ),
+		mEncodeQueue( format.getMaxFramesInFlight() + format.getNumWorkers() ),
+		mWriteQueue( format.getMaxFramesInFlight() + 1 ),
+		mFinished( false ), mNextIndex( 0 ), mPendingDrops( 0 ), mTotalLatency( 0 )
+	{
+		mWriter = MovieWriter::create( path, width, height, MovieWriter::Format().codec( format.getCodec() ).frameRate( format.getFrameRate() ) );
+
+		// Every slot is allocated up front so recording never allocates on the render thread
+		for( uint32_t i = 0; i < format.getMaxFramesInFlight(); i++ ) {
+			auto slot = std::make_shared<Slot>();
+			slot->mPixels.resize( static_cast<size_t>( width ) * height * 4 );
+			mFreeSlots.pushFront( slot );
+		}
+
+		for( uint32_t i = 0; i < format.getNumWorkers(); i++ )
+			mEncodeThreads.emplace_back( &Recorder::encodeLoop, this );
+		mWriteThread = std::thread( &Recorder::writeLoop, this );
+	}
+
+	Recorder::~Recorder()
+	{
+		finish();
+	}
+
+	bool Recorder::addFrame( const uint8_t *rgba, ptrdiff_t rowBytes )
+	{
+		if( mFinished )
+			return false;
+
+		SlotRef slot;
+		if( ! mFreeSlots.tryPopBack( &slot ) ) {
+			mPendingDrops++;
+			std::lock_guard<std::mutex> lock( mStatsMutex );
+			mStats.mFramesDropped++;
+			return false;
+		}
+
+		const size_t packedRowBytes = mWidth * 4;
+		for( int32_t y = 0; y < mHeight; y++ )
+			memcpy( slot->mPixels.data() + y * packedRowBytes, rgba + y * rowBytes, packedRowBytes );
+
+		slot->mIndex = mNextIndex++;
+		slot->mDropsBefore = mPendingDrops;
+		slot->mAddedTime = std::chrono::steady_clock::now();
+		mPendingDrops = 0;
+
+		{
+			std::lock_guard<std::mutex> lock( mStatsMutex );
+			mStats.mFramesAdded++;
+		}
+
+		// Can't block: the queue has room for every slot
+		mEncodeQueue.pushFront( slot );
+		return true;
+	}
+
+	void Recorder::encodeLoop()
+	{
+		ThreadSetup threadSetup;
+
+		// Workers encode whole frames, so each has its own single-threaded encoder. With several, the frame an encoder
+		// saw last is several frames back, so reusing its blocks would cost a full compare and copy for few hits.
+		auto encoder = Encoder::create( mWidth, mHeight, Encoder::Format()
+											.codec( mFormat.getCodec() ).compressor( mFormat.getCompressor() )
+											.quality( mFormat.getQuality() ).chunkCount( mFormat.getChunkCount() )
+											.temporalReuse( mFormat.getNumWorkers() == 1 ) );
+
+		for(;;) {
+			SlotRef slot;
+			mEncodeQueue.popBack( &slot );
+			if( ! slot )
+				return;
+
+			encoder->encode( slot->mPixels.data(), mWidth * 4, &slot->mFrame );
+			mWriteQueue.pushFront( slot );
+		}
+	}
+
+	void Recorder::writeLoop()
+	{
+		ThreadSetup threadSetup;
+
+		// Workers finish out of order. The last frame in order is held back until the next one arrives,
+		// as its duration depends on how many frames were dropped in between.
+		std::map<uint32_t, SlotRef> pending;
+		SlotRef held;
+		uint32_t nextIndex = 0;
+		bool failed = false;
+
+		auto write = [&]( const SlotRef &slot, uint32_t drops ) {
+			if( ! failed ) {
+				try {
+					mWriter->addFrame( slot->mFrame, mWriter->getFormat().getFrameDuration() * ( 1 + drops ) );
+				}
+				catch( const std::exception &exc ) {
+					CI_LOG_E( "HAP ERROR :: recording failed: " << exc.what() );
+					failed = true;
+				}
+			}
+
+			double latency = std::chrono::duration<double>( std::chrono::steady_clock::now() - slot->mAddedTime ).count();
+			{
+				std::lock_guard<std::mutex> lock( mStatsMutex );
+				if( ! failed ) {
+					mStats.mFramesWritten++;
+					mStats.mBytesWritten += slot->mFrame.size();
+					mTotalLatency += latency;
+					mStats.mMaxLatency = std::max( mStats.mMaxLatency, latency );
+					mStats.mAverageLatency = mTotalLatency / mStats.mFramesWritten;
+				}
+			}
+			mFreeSlots.pushFront( slot );
+		};
+
+		for(;;) {
+			SlotRef slot;
+			mWriteQueue.popBack( &slot );
+			if( ! slot )
+				break;
+
+			pending[slot->mIndex] = slot;
+			for( auto it = pending.find( nextIndex ); it != pending.end(); it = pending.find( ++nextIndex ) ) {
+				if( held )
+					write( held, it->second->mDropsBefore );
+				held = it->second;
+				pending.erase( it );
+			}
+		}
+
+		// finish() only sends the sentinel once every worker is done, so nothing is left in pending
+		if( held )
+			write( held, mPendingDrops );
+
+		try {
+			mWriter->finish();
+		}
+		catch( const std::exception &exc ) {
+			CI_LOG_E( "HAP ERROR :: couldn't finish recording: " << exc.what() );
+		}
+	}
+
+	void Recorder::finish()
+	{
+		if( mFinished )
+			return;
+		mFinished = true;
+
+		for( size_t i = 0; i < mEncodeThreads.size(); i++ )
+			mEncodeQueue.pushFront( SlotRef() );
+		for( auto &thread : mEncodeThreads )
+			thread.join();
+
+		mWriteQueue.pushFront( SlotRef() );
+		mWriteThread.join();
+	}
+
+	Recorder::Stats Recorder::getStats() const
+	{
+		std::lock_guard<std::mutex> lock( mStatsMutex );
+		return mStats;
+	}
+
+} } // namespace cinder::hap
@@ -0,0 +1,112 @@
+/*
+ *  HapRecorder.h
+ *
+ *  Records frames handed over by a real-time app (typically FBO contents read back every frame)
+ *  to a Hap movie, encoding and writing on background threads.
+ *
+ */
+#pragma once
+
+#include "HapEncoder.h"
+#include "HapMovieWriter.h"
+
+#include "cinder/Cinder.h"
+#include "cinder/ConcurrentCircularBuffer.h"
+#include "cinder/Filesystem.h"
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+namespace cinder { namespace hap {
+
+	typedef std::shared_ptr<class Recorder> RecorderRef;
+
+	//! addFrame() only copies the frame into one of a fixed number of slots and never waits. Encoder workers and a
+	//! writer thread take it from there. When every slot is still busy the frame is dropped and counted, and the
+	//! previous frame is held longer in the movie so that recorded time keeps matching real time.
+	class Recorder {
+	  public:
+		struct Format {
+			Format()
+			: mCodec( Codec::HAP ), mCompressor( Compressor::SNAPPY ), mQuality( dxt::Quality::FAST ), mChunkCount( 1 ),
+				mFrameRate( 60.0 ), mNumWorkers( std::max( 1u, std::thread::hardware_concurrency() / 2 ) ), mMaxFramesInFlight( 8 )
+			{}
+
+			Format&		codec( Codec codec ) { mCodec = codec; return *this; }
+			Format&		compressor( Compressor compressor ) { mCompressor = compressor; return *this; }
+			//! Defaults to FAST, which keeps up with 1080p60 on a few cores.
+			Format&		quality( dxt::Quality quality ) { mQuality = quality; return *this; }
+			Format&		chunkCount( uint32_t count ) { mChunkCount = count; return *this; }
+			//! Rate at which addFrame() is called. Every frame lasts 1 / \a fps in the movie.
+			Format&		frameRate( double fps ) { mFrameRate = fps; return *this; }
+			//! Number of threads encoding frames concurrently, one frame each.
+			Format&		numWorkers( uint32_t count ) { mNumWorkers = count; return *this; }
+			//! Frames that may be queued, encoding or waiting to be written. Bounds both memory use and recording latency.
+			Format&		maxFramesInFlight( uint32_t count ) { mMaxFramesInFlight = count; return *this; }
+
+			Codec			getCodec() const { return mCodec; }
+			Compressor		getCompressor() const { return mCompressor; }
+			dxt::Quality	getQuality() const { return mQuality; }
+			uint32_t		getChunkCount() const { return mChunkCount; }
+			double			getFrameRate() const { return mFrameRate; }
+			uint32_t		getNumWorkers() const { return mNumWorkers; }
+			uint32_t		getMaxFramesInFlight() const { return mMaxFramesInFlight; }
+
+		  private:
+			Codec			mCodec;
+			Compressor		mCompressor;
+			dxt::Quality	mQuality;
+			uint32_t		mChunkCount;
+			double			mFrameRate;
+			uint32_t		mNumWorkers, mMaxFramesInFlight;
+		};
+
+		struct Stats {
+			Stats() : mFramesAdded( 0 ), mFramesWritten( 0 ), mFramesDropped( 0 ), mBytesWritten( 0 ), mAverageLatency( 0 ), mMaxLatency( 0 ) {}
+
+			uint32_t	mFramesAdded, mFramesWritten, mFramesDropped;
+			uint64_t	mBytesWritten;
+			//! Seconds from addFrame() to the frame being written to disk
+			double		mAverageLatency, mMaxLatency;
+		};
+
+		static RecorderRef create( const fs::path &path, int32_t width, int32_t height, const Format &format = Format() )
+		{ return RecorderRef( new Recorder( path, width, height, format ) ); }
+		~Recorder();
+
+		//! Copies an RGBA frame for encoding without blocking. \a rowBytes may be negative, so a bottom-up glReadPixels()
+		//! result is recorded upright by passing a pointer to its last row. Returns false if the frame was dropped.
+		//! Frames must be added from a single thread.
+		bool	addFrame( const uint8_t *rgba, ptrdiff_t rowBytes );
+		//! Waits for the queued frames and finalizes the movie. Called by the destructor if needed.
+		void	finish();
+
+		Stats			getStats() const;
+		const Format&	getFormat() const { return mFormat; }
+
+	  private:
+		Recorder( const fs::path &path, int32_t width, int32_t height, const Format &format );
+
+		struct Slot;
+		typedef std::shared_ptr<Slot> SlotRef;
+
+		void	encodeLoop();
+		void	writeLoop();
+
+		int32_t							mWidth, mHeight;
+		Format							mFormat;
+		MovieWriterRef					mWriter;
+
+		ConcurrentCircularBuffer<SlotRef>	mFreeSlots, mEncodeQueue, mWriteQueue;
+		std::vector<std::thread>		mEncodeThreads;
+		std::thread						mWriteThread;
+		bool							mFinished;
+
+		uint32_t						mNextIndex, mPendingDrops;
+		mutable std::mutex				mStatsMutex;
+		Stats							mStats;
+		double							mTotalLatency;
+	};
+
+} } // namespace cinder::hap
@@ -0,0 +1,126 @@
+/*
+ *  HapRemuxer.cpp
+ *
+ *  Trims, cuts and joins Hap movies without re-encoding.
+ *
+ */
+
+#include "HapRemuxer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+
+namespace cinder { namespace hap {
+
+	void Remuxer::addFrames( const MovieReaderRef &reader, size_t firstFrame, size_t endFrame )
+	{
+		endFrame = std::min( endFrame, reader->getNumSamples() );
+		if( firstFrame >= endFrame )
+			return;
+
+		if( ! mSegments.empty() ) {
+			const MovieReaderRef &first = mSegments.front().mReader;
+			if( reader->getCodec() != first->getCodec() || reader->getWidth() != first->getWidth() || reader->getHeight() != first->getHeight() )
+				throw RemuxerExc( reader->getFilePath().string() + " doesn't match the codec and dimensions of " + first->getFilePath().string() + "." );
+		}
+
+		Segment segment = { reader, firstFrame, endFrame };
+		mSegments.push_back( segment );
+	}
+
+	void Remuxer::addRange( const MovieReaderRef &reader, double inSeconds, double outSeconds )
+	{
+		if( reader->getNumSamples() == 0 || outSeconds <= inSeconds )
+			return;
+
+		size_t firstFrame = reader->getSampleIndex( inSeconds );
+		size_t endFrame = reader->getSampleIndex( outSeconds );
+		// The frame on screen at the out point is kept only if it starts before it
+		if( reader->getSample( endFrame ).mTime < outSeconds * reader->getTimeScale() - 1e-6 )
+			endFrame++;
+
+		addFrames( reader, firstFrame, endFrame );
+	}
+
+	size_t Remuxer::getNumFrames() const
+	{
+		size_t frames = 0;
+		for( const auto &segment : mSegments )
+			frames += segment.mEndFrame - segment.mFirstFrame;
+		return frames;
+	}
+
+	double Remuxer::getDuration() const
+	{
+		double duration = 0;
+		for( const auto &segment : mSegments ) {
+			const auto &samples = segment.mReader->getSamples();
+			const auto &last = samples[segment.mEndFrame - 1];
+			duration += ( last.mTime + last.mDuration - samples[segment.mFirstFrame].mTime ) / static_cast<double>( segment.mReader->getTimeScale() );
+		}
+		return duration;
+	}
+
+	void Remuxer::write( const fs::path &path )
+	{
+		if( mSegments.empty() )
+			throw RemuxerExc( "Nothing to write." );
+
+		for( const auto &segment : mSegments ) {
+			if( fs::exists( path ) && fs::equivalent( path, segment.mReader->getFilePath() ) )
+				throw RemuxerExc( "Can't write over an input movie." );
+		}
+
+		const MovieReaderRef &first = mSegments.front().mReader;
+		const uint32_t timeScale = first->getTimeScale();
+		auto writer = MovieWriter::create( path, first->getWidth(), first->getHeight(), MovieWriter::Format()
+											.codec( first->getCodec() ).timeScale( timeScale ).frameDuration( first->getSample( 0 ).mDuration ) );
+
+		// Movies with other time scales are converted, carrying the rounding error over so that durations don't drift
+		double timeError = 0;
+
+		for( const auto &segment : mSegments ) {
+			const MovieReader &reader = *segment.mReader;
+			std::ifstream source( reader.getFilePath().string().c_str(), std::ios::binary );
+			if( ! source )
+				throw RemuxerExc( "Couldn't open " + reader.getFilePath().string() + "." );
+
+			// The byte ranges the segment needs, merged where they touch so that they are copied in as few
+			// sequential reads as possible. Frames stored once and referenced several times are copied once.
+			std::map<uint64_t, uint64_t> ranges;
+			for( size_t i = segment.mFirstFrame; i < segment.mEndFrame; i++ ) {
+				const auto &sample = reader.getSample( i );
+				uint64_t &end = ranges[sample.mOffset];
+				end = std::max( end, sample.mOffset + sample.mSize );
+			}
+
+			std::map<uint64_t, uint64_t> copiedRanges;	// source offset to output offset
+			for( auto it = ranges.begin(); it != ranges.end(); ) {
+				uint64_t start = it->first, end = it->second;
+				for( ++it; it != ranges.end() && it->first <= end; ++it )
+					end = std::max( end, it->second );
+
+				source.seekg( start );
+				copiedRanges[start] = writer->copyData( source, end - start );
+			}
+
+			for( size_t i = segment.mFirstFrame; i < segment.mEndFrame; i++ ) {
+				const auto &sample = reader.getSample( i );
+				auto range = --copiedRanges.upper_bound( sample.mOffset );
+
+				uint32_t duration = sample.mDuration;
+				if( reader.getTimeScale() != timeScale ) {
+					double scaled = sample.mDuration * static_cast<double>( timeScale ) / reader.getTimeScale() + timeError;
+					duration = std::max<uint32_t>( 1, static_cast<uint32_t>( scaled + 0.5 ) );
+					timeError = scaled - duration;
+				}
+
+				writer->addFrameReference( range->second + ( sample.mOffset - range->first ), sample.mSize, duration );
+			}
+		}
+
+		writer->finish();
+	}
+
+} } // namespace cinder::hap
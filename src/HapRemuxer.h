@@ -0,0 +1,59 @@
+/*
+ *  HapRemuxer.h
+ *
+ *  Trims, cuts and joins Hap movies without re-encoding. Every Hap frame is intra-coded,
+ *  so editing only rewrites the sample tables and copies the frames that are kept.
+ *
+ */
+#pragma once
+
+#include "HapMovieReader.h"
+#include "HapMovieWriter.h"
+
+#include "cinder/Cinder.h"
+#include "cinder/Exception.h"
+#include "cinder/Filesystem.h"
+
+#include <vector>
+
+namespace cinder { namespace hap {
+
+	typedef std::shared_ptr<class Remuxer> RemuxerRef;
+
+	//! Collects ranges of frames from one or more movies, then writes them one after the other with write().
+	//! All movies must share the codec and dimensions of the first. Only the Hap video track is kept.
+	class Remuxer {
+	  public:
+		static RemuxerRef create() { return RemuxerRef( new Remuxer ); }
+
+		//! Appends frames [\a firstFrame, \a endFrame) of \a reader.
+		void	addFrames( const MovieReaderRef &reader, size_t firstFrame, size_t endFrame );
+		//! Appends the frames displayed from \a inSeconds up to, but not including, \a outSeconds.
+		void	addRange( const MovieReaderRef &reader, double inSeconds, double outSeconds );
+		//! Appends every frame of \a reader.
+		void	addMovie( const MovieReaderRef &reader ) { addFrames( reader, 0, reader->getNumSamples() ); }
+
+		//! Writes the collected frames to \a path, which must not be one of the inputs.
+		void	write( const fs::path &path );
+
+		size_t	getNumFrames() const;
+		//! Duration in seconds of the collected frames
+		double	getDuration() const;
+
+	  private:
+		Remuxer() {}
+
+		struct Segment {
+			MovieReaderRef	mReader;
+			size_t			mFirstFrame, mEndFrame;
+		};
+
+		std::vector<Segment>	mSegments;
+	};
+
+	class RemuxerExc : public Exception {
+	  public:
+		RemuxerExc( const std::string &description ) : Exception( description ) {}
+	};
+
+} } // namespace cinder::hap
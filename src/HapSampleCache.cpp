@@ -0,0 +1,178 @@
+/*
+ *  HapSampleCache.cpp
+ *
+ *  Process-wide cache of encoded Hap frames, shared by every movie under one memory budget.
+ *
+ */
+
+#include "HapSampleCache.h"
+
+namespace cinder { namespace hap {
+
+	namespace {
+		const int	kOffsetBits = 40;
+
+		std::mutex					sInstanceMutex;
+		std::weak_ptr<SampleCache>	sInstance;
+		size_t						sBudget = 256 * 1024 * 1024;
+	}
+
+	SampleCacheRef SampleCache::get()
+	{
+		std::lock_guard<std::mutex> lock( sInstanceMutex );
+		SampleCacheRef cache = sInstance.lock();
+		if( ! cache ) {
+			cache = SampleCacheRef( new SampleCache );
+			sInstance = cache;
+		}
+		return cache;
+	}
+
+	void SampleCache::setBudget( size_t bytes )
+	{
+		SampleCacheRef cache;
+		{
+			std::lock_guard<std::mutex> lock( sInstanceMutex );
+			sBudget = bytes;
+			cache = sInstance.lock();
+		}
+		if( cache ) {
+			std::lock_guard<std::mutex> lock( cache->mMutex );
+			cache->evict( bytes );
+		}
+	}
+
+	size_t SampleCache::getBudget()
+	{
+		std::lock_guard<std::mutex> lock( sInstanceMutex );
+		return sBudget;
+	}
+
+	SampleCache::File& SampleCache::getFile( const fs::path &path )
+	{
+		auto it = mFiles.find( path.string() );
+		if( it == mFiles.end() ) {
+			it = mFiles.insert( std::make_pair( path.string(), File() ) ).first;
+			it->second.mId = static_cast<uint32_t>( mFiles.size() );
+		}
+		return it->second;
+	}
+
+	SampleCache::DataRef SampleCache::read( const MovieReader &reader, size_t index )
+	{
+		const size_t budget = getBudget();
+		uint32_t fileId;
+		bool pinned;
+		const Key key = static_cast<Key>( reader.getSample( index ).mOffset );
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			const File &file = getFile( reader.getFilePath() );
+			fileId = file.mId;
+			pinned = file.mPinCount > 0;
+
+			auto it = mEntries.find( key | ( static_cast<Key>( fileId ) << kOffsetBits ) );
+			if( it != mEntries.end() ) {
+				Entry &entry = it->second;
+				if( entry.mLruPosition != mLru.end() )
+					mLru.splice( mLru.begin(), mLru, entry.mLruPosition );
+				mHits++;
+				return entry.mData;
+			}
+			mMisses++;
+		}
+
+		auto data = std::make_shared<std::vector<uint8_t>>();
+		reader.readSample( index, data.get() );
+		if( ! pinned && data->size() > budget )
+			return data;
+
+		std::lock_guard<std::mutex> lock( mMutex );
+		// Another thread may have read the same frame meanwhile, or the file may have been pinned or unpinned
+		const Key fileKey = key | ( static_cast<Key>( fileId ) << kOffsetBits );
+		if( mEntries.count( fileKey ) )
+			return data;
+		pinned = getFile( reader.getFilePath() ).mPinCount > 0;
+
+		Entry entry;
+		entry.mData = data;
+		entry.mFileId = fileId;
+		if( pinned ) {
+			entry.mLruPosition = mLru.end();
+			mPinnedBytes += data->size();
+		}
+		else {
+			mLru.push_front( fileKey );
+			entry.mLruPosition = mLru.begin();
+		}
+		mEntries.insert( std::make_pair( fileKey, entry ) );
+		mBytes += data->size();
+
+		evict( budget );
+		return data;
+	}
+
+	void SampleCache::evict( size_t budget )
+	{
+		while( ! mLru.empty() && mBytes - mPinnedBytes > budget ) {
+			auto it = mEntries.find( mLru.back() );
+			mBytes -= it->second.mData->size();
+			mEntries.erase( it );
+			mLru.pop_back();
+			mEvictions++;
+		}
+	}
+
+	void SampleCache::setPinned( uint32_t fileId, bool pinned )
+	{
+		for( auto &keyEntry : mEntries ) {
+			Entry &entry = keyEntry.second;
+			if( entry.mFileId != fileId )
+				continue;
+
+			if( pinned && entry.mLruPosition != mLru.end() ) {
+				mLru.erase( entry.mLruPosition );
+				entry.mLruPosition = mLru.end();
+				mPinnedBytes += entry.mData->size();
+			}
+			else if( ! pinned && entry.mLruPosition == mLru.end() ) {
+				mLru.push_front( keyEntry.first );
+				entry.mLruPosition = mLru.begin();
+				mPinnedBytes -= entry.mData->size();
+			}
+		}
+	}
+
+	void SampleCache::pin( const fs::path &path )
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		File &file = getFile( path );
+		if( file.mPinCount++ == 0 )
+			setPinned( file.mId, true );
+	}
+
+	void SampleCache::unpin( const fs::path &path )
+	{
+		const size_t budget = getBudget();
+		std::lock_guard<std::mutex> lock( mMutex );
+		File &file = getFile( path );
+		if( file.mPinCount > 0 && --file.mPinCount == 0 ) {
+			setPinned( file.mId, false );
+			evict( budget );
+		}
+	}
+
+	SampleCache::Stats SampleCache::getStats() const
+	{
+		Stats stats;
+		stats.mBudget = getBudget();
+		std::lock_guard<std::mutex> lock( mMutex );
+		stats.mBytes = mBytes;
+		stats.mPinnedBytes = mPinnedBytes;
+		stats.mNumEntries = static_cast<uint32_t>( mEntries.size() );
+		stats.mHits = mHits;
+		stats.mMisses = mMisses;
+		stats.mEvictions = mEvictions;
+		return stats;
+	}
+
+} } // namespace cinder::hap
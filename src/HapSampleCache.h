@@ -0,0 +1,90 @@
+/*
+ *  HapSampleCache.h
+ *
+ *  Process-wide cache of encoded Hap frames, shared by every movie under one memory budget.
+ *
+ */
+#pragma once
+
+#include "HapMovieReader.h"
+
+#include "cinder/Cinder.h"
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace cinder { namespace hap {
+
+	typedef std::shared_ptr<class SampleCache> SampleCacheRef;
+
+	//! Keeps recently read encoded frames in memory, least recently used first out once the budget is reached.
+	//! Frames are keyed by file and offset, so movies opened twice and frames stored once share entries.
+	//! The frames of pinned movies are never evicted, which keeps short loops off the disk after their first pass.
+	class SampleCache {
+	  public:
+		typedef std::shared_ptr<const std::vector<uint8_t>>	DataRef;
+
+		struct Stats {
+			Stats() : mBudget( 0 ), mBytes( 0 ), mPinnedBytes( 0 ), mNumEntries( 0 ), mHits( 0 ), mMisses( 0 ), mEvictions( 0 ) {}
+
+			size_t		mBudget;
+			//! Bytes held, pinned movies included
+			size_t		mBytes;
+			//! Bytes held for pinned movies. These may exceed the budget, in which case nothing else is cached.
+			size_t		mPinnedBytes;
+			uint32_t	mNumEntries;
+			uint32_t	mHits, mMisses, mEvictions;
+		};
+
+		//! Returns the shared cache, creating it if no movie is using it. It's released with the last movie.
+		static SampleCacheRef	get();
+		//! Maximum number of bytes held for movies that aren't pinned. Defaults to 256 MB, zero disables caching.
+		static void				setBudget( size_t bytes );
+		static size_t			getBudget();
+
+		//! Returns the encoded frame of sample \a index of \a reader, reading it and caching it if it isn't in memory
+		//! yet. Safe to call from several threads; the file is read without holding the cache's lock.
+		DataRef		read( const MovieReader &reader, size_t index );
+
+		//! Keeps every frame of \a path in memory once read. Calls are counted, each pin() needs an unpin().
+		void		pin( const fs::path &path );
+		void		unpin( const fs::path &path );
+
+		Stats		getStats() const;
+
+	  private:
+		SampleCache() : mBytes( 0 ), mPinnedBytes( 0 ), mHits( 0 ), mMisses( 0 ), mEvictions( 0 ) {}
+
+		struct File {
+			File() : mPinCount( 0 ) {}
+
+			uint32_t	mId;
+			uint32_t	mPinCount;
+		};
+
+		//! File id in the high bits, offset in the low bits. Offsets beyond 2^40 bytes aren't expected.
+		typedef uint64_t	Key;
+
+		struct Entry {
+			DataRef						mData;
+			uint32_t					mFileId;
+			//! Position in mLru, or mLru.end() while the file is pinned
+			std::list<Key>::iterator	mLruPosition;
+		};
+
+		File&		getFile( const fs::path &path );
+		//! Moves the entries of a file out of, or back into, the eviction order
+		void		setPinned( uint32_t fileId, bool pinned );
+		void		evict( size_t budget );
+
+		mutable std::mutex					mMutex;
+		std::unordered_map<std::string, File>	mFiles;
+		std::unordered_map<Key, Entry>		mEntries;
+		//! Unpinned entries, most recently used first
+		std::list<Key>						mLru;
+		size_t								mBytes, mPinnedBytes;
+		uint32_t							mHits, mMisses, mEvictions;
+	};
+
+} } // namespace cinder::hap
@@ -0,0 +1,377 @@
+/*
+ *  HapShaderCache.cpp
+ *
+ *  Shaders Hap frames are drawn with, built once per GL context and saved as program binaries.
+ *
+ */
+
+#include "HapShaderCache.h"
+#include "HapFormat.h"
+
+#include "cinder/Log.h"
+#include "cinder/gl/scoped.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+namespace cinder { namespace hap {
+
+	namespace {
+		std::mutex										sInstanceMutex;
+		std::map<gl::Context*, std::weak_ptr<ShaderCache>>	sInstances;
+		fs::path										sBinaryDirectory;
+
+		const char *sVersion = "#version 150\n";
+
+		const char *sVertexShader = R"(
+			uniform mat4	ciModelViewProjection;
+
+		#if defined( UNIT_QUAD )
+			// Corners of a unit square, placed by the uniforms so the vertices never change
+			uniform vec4	uRect;
+			uniform vec4	uTexCoords;
+
+			in vec2			ciPosition;
+		#else
+			in vec4			ciPosition;
+			in vec2			ciTexCoord0;
+		#endif
+
+			out vec2		vTexCoord0;
+
+			void main()
+			{
+			#if defined( UNIT_QUAD )
+				gl_Position = ciModelViewProjection * vec4( mix( uRect.xy, uRect.zw, ciPosition ), 0.0, 1.0 );
+				vTexCoord0 = mix( uTexCoords.xy, uTexCoords.zw, ciPosition );
+			#else
+				gl_Position = ciModelViewProjection * ciPosition;
+				vTexCoord0 = ciTexCoord0;
+			#endif
+			}
+		)";
+
+		const char *sFragmentShader = R"(
+			uniform sampler2D	uTexture;
+			uniform sampler2D	uAlphaTexture;
+
+			in vec2				vTexCoord0;
+
+			out vec4			oColor;
+
+			void main()
+			{
+				vec4 color = texture( uTexture, vTexCoord0 );
+			#if defined( HAP_Q )
+				// As ScaledCoCgYToRGBA.frag
+				color += vec4( -0.50196078431373, -0.50196078431373, 0.0, 0.0 );
+				float scale = ( color.z * ( 255.0 / 8.0 ) ) + 1.0;
+				float co = color.x / scale;
+				float cg = color.y / scale;
+				color = vec4( color.w + co - cg, color.w + cg, color.w - co - cg, 1.0 );
+			#endif
+			#if defined( ALPHA_TEXTURE )
+				color.a = texture( uAlphaTexture, vTexCoord0 ).r;
+			#endif
+			#if defined( PREMULTIPLIED )
+				color.rgb *= color.a;
+			#endif
+				oColor = color;
+			}
+		)";
+
+		const char *sVariantNames[ShaderCache::NUM_VARIANTS] = { "plain", "premultiplied", "hapq", "hapq-alpha" };
+	}
+
+	ShaderCacheRef ShaderCache::get()
+	{
+		std::lock_guard<std::mutex> lock( sInstanceMutex );
+		for( auto it = sInstances.begin(); it != sInstances.end(); ) {
+			if( it->second.expired() )
+				it = sInstances.erase( it );
+			else
+				++it;
+		}
+
+		gl::Context *context = gl::context();
+		ShaderCacheRef cache = sInstances[context].lock();
+		if( ! cache ) {
+			cache = ShaderCacheRef( new ShaderCache( context ) );
+			sInstances[context] = cache;
+		}
+		return cache;
+	}
+
+	void ShaderCache::setBinaryDirectory( const fs::path &directory )
+	{
+		std::lock_guard<std::mutex> lock( sInstanceMutex );
+		sBinaryDirectory = directory;
+	}
+
+	fs::path ShaderCache::getBinaryDirectory()
+	{
+		std::lock_guard<std::mutex> lock( sInstanceMutex );
+		return sBinaryDirectory;
+	}
+
+	ShaderCache::ShaderCache( gl::Context *context )
+	: mContext( context ), mBinaries( false )
+	{
+		// Core since 4.1, where drivers needn't list the extension. Only those reporting a binary format can hand programs back.
+		GLint major = 0, minor = 0;
+		glGetIntegerv( GL_MAJOR_VERSION, &major );
+		glGetIntegerv( GL_MINOR_VERSION, &minor );
+		if( major * 10 + minor >= 41 || gl::isExtensionAvailable( "GL_ARB_get_program_binary" ) ) {
+			GLint formats = 0;
+			glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &formats );
+			mBinaries = formats > 0;
+		}
+		for( GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION } ) {
+			const GLubyte *value = glGetString( name );
+			mDriver += value ? reinterpret_cast<const char*>( value ) : "";
+			mDriver += '\n';
+		}
+	}
+
+	ShaderCache::~ShaderCache()
+	{
+		{
+			// A context created later at the same address mustn't find this one. One that has replaced it is left alone.
+			std::lock_guard<std::mutex> lock( sInstanceMutex );
+			auto it = sInstances.find( mContext );
+			if( it != sInstances.end() && it->second.expired() )
+				sInstances.erase( it );
+		}
+
+		for( auto &program : mPrograms ) {
+			if( program.mHandle )
+				glDeleteProgram( program.mHandle );
+		}
+	}
+
+	GLuint ShaderCache::getProgram( Variant variant )
+	{
+		Program &program = mPrograms[static_cast<size_t>( variant )];
+		if( program.mHandle || program.mFailed )
+			return program.mHandle;
+
+		const fs::path path = getBinaryPath( variant );
+		if( ! path.empty() )
+			program.mHandle = load( path );
+		if( program.mHandle ) {
+			mStats.mLoaded++;
+		}
+		else {
+			program.mHandle = build( getVertexShader( true ), getFragmentShader( variant ), ! path.empty() );
+			if( ! program.mHandle ) {
+				program.mFailed = true;
+				return 0;
+			}
+			mStats.mBuilt++;
+			if( ! path.empty() )
+				save( program.mHandle, path );
+		}
+
+		program.mModelViewProjection = glGetUniformLocation( program.mHandle, "ciModelViewProjection" );
+		program.mRect = glGetUniformLocation( program.mHandle, "uRect" );
+		program.mTexCoords = glGetUniformLocation( program.mHandle, "uTexCoords" );
+		program.mTexture = glGetUniformLocation( program.mHandle, "uTexture" );
+		program.mAlphaTexture = glGetUniformLocation( program.mHandle, "uAlphaTexture" );
+		return program.mHandle;
+	}
+
+	gl::GlslProgRef ShaderCache::getGlsl( Variant variant )
+	{
+		Program &program = mPrograms[static_cast<size_t>( variant )];
+		if( ! program.mGlsl ) {
+			try {
+				program.mGlsl = gl::GlslProg::create( gl::GlslProg::Format().vertex( getVertexShader( false ) ).fragment( getFragmentShader( variant ) ) );
+				program.mGlsl->uniform( "uTexture", 0 );
+				if( variant == Variant::HAP_Q_ALPHA )
+					program.mGlsl->uniform( "uAlphaTexture", 1 );
+			}
+			catch( const gl::GlslProgExc &exc ) {
+				CI_LOG_E( "HAP ERROR :: " << sVariantNames[static_cast<size_t>( variant )] << " shader failed to build: " << exc.what() );
+			}
+		}
+		return program.mGlsl;
+	}
+
+	void ShaderCache::draw( Variant variant, const gl::TextureRef &texture, const Rectf &rect, const vec2 &upperLeftTexCoord, const vec2 &lowerRightTexCoord, const gl::TextureRef &alphaTexture )
+	{
+		const GLuint handle = getProgram( variant );
+		if( ! handle || ! texture || ( variant == Variant::HAP_Q_ALPHA && ! alphaTexture ) )
+			return;
+		const Program &program = mPrograms[static_cast<size_t>( variant )];
+
+		// Every draw shares one unit square, as a triangle strip, so no draw rewrites a buffer another is still reading
+		if( ! mVao ) {
+			const float corners[8] = { 0, 0, 1, 0, 0, 1, 1, 1 };
+			mVbo = gl::Vbo::create( GL_ARRAY_BUFFER, sizeof( corners ), corners, GL_STATIC_DRAW );
+			mVao = gl::Vao::create();
+			gl::ScopedVao vao( mVao );
+			gl::ScopedBuffer vbo( mVbo );
+			gl::enableVertexAttribArray( 0 );
+			gl::vertexAttribPointer( 0, 2, GL_FLOAT, GL_FALSE, 0, nullptr );
+		}
+
+		gl::ScopedVao vao( mVao );
+		gl::ScopedTextureBind bindTexture( texture, 0 );
+		std::unique_ptr<gl::ScopedTextureBind> bindAlpha( alphaTexture ? new gl::ScopedTextureBind( alphaTexture, 1 ) : nullptr );
+
+		// The program isn't a gl::GlslProg, so the one Cinder has bound is bound again after the draw
+		const gl::GlslProg *bound = gl::context()->getGlslProg();
+		const mat4 modelViewProjection = gl::getModelViewProjection();
+		glUseProgram( handle );
+		glUniformMatrix4fv( program.mModelViewProjection, 1, GL_FALSE, &modelViewProjection[0][0] );
+		glUniform4f( program.mRect, rect.x1, rect.y1, rect.x2, rect.y2 );
+		glUniform4f( program.mTexCoords, upperLeftTexCoord.x, upperLeftTexCoord.y, lowerRightTexCoord.x, lowerRightTexCoord.y );
+		glUniform1i( program.mTexture, 0 );
+		if( program.mAlphaTexture >= 0 )
+			glUniform1i( program.mAlphaTexture, 1 );
+		glDrawArrays( GL_TRIANGLE_STRIP, 0, 4 );
+		glUseProgram( bound ? bound->getHandle() : 0 );
+	}
+
+	std::string ShaderCache::getVertexShader( bool unitQuad )
+	{
+		return sVersion + std::string( unitQuad ? "#define UNIT_QUAD\n" : "" ) + sVertexShader;
+	}
+
+	std::string ShaderCache::getFragmentShader( Variant variant )
+	{
+		std::string defines;
+		switch( variant ) {
+			case Variant::PLAIN:			break;
+			case Variant::PREMULTIPLIED:	defines = "#define PREMULTIPLIED\n"; break;
+			case Variant::HAP_Q:			defines = "#define HAP_Q\n"; break;
+			case Variant::HAP_Q_ALPHA:		defines = "#define HAP_Q\n#define ALPHA_TEXTURE\n"; break;
+		}
+		return sVersion + defines + sFragmentShader;
+	}
+
+	GLuint ShaderCache::build( const std::string &vertex, const std::string &fragment, bool retrievable )
+	{
+		GLuint program = glCreateProgram();
+		bool compiled = true;
+		for( const auto &stage : { std::make_pair( GL_VERTEX_SHADER, &vertex ), std::make_pair( GL_FRAGMENT_SHADER, &fragment ) } ) {
+			const GLuint shader = glCreateShader( stage.first );
+			const GLchar *source = stage.second->c_str();
+			glShaderSource( shader, 1, &source, nullptr );
+			glCompileShader( shader );
+			GLint status = GL_FALSE;
+			glGetShaderiv( shader, GL_COMPILE_STATUS, &status );
+			if( status != GL_TRUE ) {
+				GLchar log[1024] = { 0 };
+				glGetShaderInfoLog( shader, sizeof( log ), nullptr, log );
+				CI_LOG_E( "HAP ERROR :: shader failed to compile: " << log );
+				compiled = false;
+			}
+			glAttachShader( program, shader );
+			// Deleted along with the program
+			glDeleteShader( shader );
+		}
+
+		// Fixed locations, so programs loaded from binaries need no lookups of their own
+		glBindAttribLocation( program, 0, "ciPosition" );
+		glBindAttribLocation( program, 1, "ciTexCoord0" );
+		glBindFragDataLocation( program, 0, "oColor" );
+		if( retrievable )
+			glProgramParameteri( program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+		if( compiled )
+			glLinkProgram( program );
+
+		GLint status = GL_FALSE;
+		glGetProgramiv( program, GL_LINK_STATUS, &status );
+		if( status != GL_TRUE ) {
+			if( compiled ) {
+				GLchar log[1024] = { 0 };
+				glGetProgramInfoLog( program, sizeof( log ), nullptr, log );
+				CI_LOG_E( "HAP ERROR :: shader failed to link: " << log );
+			}
+			glDeleteProgram( program );
+			return 0;
+		}
+		return program;
+	}
+
+	GLuint ShaderCache::load( const fs::path &path )
+	{
+		std::ifstream stream( path.string().c_str(), std::ios::binary );
+		uint32_t format = 0;
+		if( ! stream.read( reinterpret_cast<char*>( &format ), sizeof( format ) ) )
+			return 0;
+		const std::vector<char> binary( ( std::istreambuf_iterator<char>( stream ) ), std::istreambuf_iterator<char>() );
+		if( binary.empty() )
+			return 0;
+
+		const GLuint program = glCreateProgram();
+		glProgramBinary( program, format, binary.data(), static_cast<GLsizei>( binary.size() ) );
+		GLint status = GL_FALSE;
+		glGetProgramiv( program, GL_LINK_STATUS, &status );
+		if( status != GL_TRUE ) {
+			// Built again and saved over it
+			glDeleteProgram( program );
+			mStats.mRejectedBinaries++;
+			return 0;
+		}
+		return program;
+	}
+
+	void ShaderCache::save( GLuint program, const fs::path &path )
+	{
+		GLint length = 0;
+		glGetProgramiv( program, GL_PROGRAM_BINARY_LENGTH, &length );
+		if( length <= 0 )
+			return;
+		std::vector<char> binary( length );
+		GLenum format = 0;
+		glGetProgramBinary( program, length, nullptr, &format, binary.data() );
+
+		// Written aside and renamed, so a run that starts meanwhile never loads half a binary
+		try {
+			fs::create_directories( path.parent_path() );
+		}
+		catch( const fs::filesystem_error &exc ) {
+			CI_LOG_E( "HAP ERROR :: couldn't create shader binary directory: " << exc.what() );
+			return;
+		}
+		const fs::path temporary = path.string() + ".tmp";
+		{
+			std::ofstream stream( temporary.string().c_str(), std::ios::binary | std::ios::trunc );
+			const uint32_t header = format;
+			stream.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+			stream.write( binary.data(), binary.size() );
+			if( ! stream ) {
+				CI_LOG_E( "HAP ERROR :: couldn't write shader binary " << temporary );
+				return;
+			}
+		}
+		std::remove( path.string().c_str() );
+		if( std::rename( temporary.string().c_str(), path.string().c_str() ) != 0 ) {
+			CI_LOG_E( "HAP ERROR :: couldn't write shader binary " << path );
+			return;
+		}
+		mStats.mSaved++;
+	}
+
+	fs::path ShaderCache::getBinaryPath( Variant variant ) const
+	{
+		const fs::path directory = getBinaryDirectory();
+		if( ! mBinaries || directory.empty() )
+			return fs::path();
+
+		// A change to the shaders or the driver gives a new name rather than a binary the driver may refuse
+		const std::string key = mDriver + getVertexShader( true ) + getFragmentShader( variant );
+		std::ostringstream name;
+		name << "hap-" << sVariantNames[static_cast<size_t>( variant )] << "-" << std::hex << std::setw( 16 ) << std::setfill( '0' )
+			<< hashData( reinterpret_cast<const uint8_t*>( key.data() ), key.size() ) << ".bin";
+		return directory / name.str();
+	}
+
+} } // namespace cinder::hap
@@ -0,0 +1,110 @@
+/*
+ *  HapShaderCache.h
+ *
+ *  Shaders Hap frames are drawn with, built once per GL context and saved as program binaries.
+ *
+ */
+#pragma once
+
+#include "cinder/Cinder.h"
+#include "cinder/Filesystem.h"
+#include "cinder/Rect.h"
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Context.h"
+#include "cinder/gl/GlslProg.h"
+#include "cinder/gl/Texture.h"
+#include "cinder/gl/Vao.h"
+#include "cinder/gl/Vbo.h"
+
+namespace cinder { namespace hap {
+
+	typedef std::shared_ptr<class ShaderCache> ShaderCacheRef;
+
+	//! Builds each shader variant the first time it's drawn with, once per GL context. With a binary directory set and
+	//! a driver that supports program binaries, linked programs are saved there, keyed by the shader source and the
+	//! driver, and loaded on the next run instead of being compiled. A binary the driver rejects, as after a driver
+	//! update, is built again and replaced. Every call must be made with the cache's context current.
+	class ShaderCache {
+	  public:
+		enum class Variant {
+			//! Hap and Hap Alpha, sampled as they are
+			PLAIN,
+			//! Hap Alpha with its color multiplied by its alpha, for premultiplied blending
+			PREMULTIPLIED,
+			//! Hap Q's scaled YCoCg converted to RGB
+			HAP_Q,
+			//! Hap Q with alpha from the red channel of a second texture, as Hap Q Alpha stores it
+			HAP_Q_ALPHA
+		};
+		static const size_t	NUM_VARIANTS = 4;
+
+		struct Stats {
+			Stats() : mBuilt( 0 ), mLoaded( 0 ), mSaved( 0 ), mRejectedBinaries( 0 ) {}
+
+			//! Programs compiled from source, and programs loaded from binaries
+			uint32_t	mBuilt, mLoaded;
+			//! Binaries written to the binary directory
+			uint32_t	mSaved;
+			//! Binaries found but refused by the driver, then built again
+			uint32_t	mRejectedBinaries;
+		};
+
+		//! Returns the cache of the current context, creating it if nothing is using it. It's released with its last user,
+		//! which must be before the context is destroyed.
+		static ShaderCacheRef	get();
+		//! Directory program binaries are saved in and loaded from, created when the first one is saved. Empty, the
+		//! default, builds every program from source. Applies to programs not built yet, in every context.
+		static void				setBinaryDirectory( const fs::path &directory );
+		static fs::path			getBinaryDirectory();
+
+		~ShaderCache();
+
+		//! Handle of the program of \a variant, loaded or built the first time. 0 if it failed to build.
+		GLuint			getProgram( Variant variant );
+		//! The same shader as a Cinder program, for drawing with Cinder's own calls. It's always compiled from source,
+		//! as Cinder can't create a program from a binary. nullptr if it failed to build.
+		gl::GlslProgRef	getGlsl( Variant variant );
+		//! Draws \a texture in \a rect with the program of \a variant, from \a upperLeftTexCoord to
+		//! \a lowerRightTexCoord, transformed by the current model view projection. HAP_Q_ALPHA needs \a alphaTexture.
+		void			draw( Variant variant, const gl::TextureRef &texture, const Rectf &rect, const vec2 &upperLeftTexCoord, const vec2 &lowerRightTexCoord, const gl::TextureRef &alphaTexture = nullptr );
+
+		Stats			getStats() const { return mStats; }
+
+	  private:
+		ShaderCache( gl::Context *context );
+
+		struct Program {
+			Program() : mHandle( 0 ), mFailed( false ), mModelViewProjection( -1 ), mRect( -1 ), mTexCoords( -1 ), mTexture( -1 ), mAlphaTexture( -1 ) {}
+
+			GLuint			mHandle;
+			bool			mFailed;
+			GLint			mModelViewProjection, mRect, mTexCoords, mTexture, mAlphaTexture;
+			gl::GlslProgRef	mGlsl;
+		};
+
+		//! The programs draw() uses place a unit square with uniforms. getGlsl()'s take Cinder's positions and texture
+		//! coordinates, for drawing with Cinder's calls.
+		static std::string	getVertexShader( bool unitQuad );
+		static std::string	getFragmentShader( Variant variant );
+		//! Compiles and links a program, retrievable as a binary if \a retrievable. 0 if it failed.
+		static GLuint		build( const std::string &vertex, const std::string &fragment, bool retrievable );
+		//! 0 if there's no binary at \a path or the driver refuses it
+		GLuint				load( const fs::path &path );
+		void				save( GLuint program, const fs::path &path );
+		//! Where the binary of \a variant's program is kept, empty if binaries aren't used
+		fs::path			getBinaryPath( Variant variant ) const;
+
+		//! Key of the cache in the instances by context
+		gl::Context			*mContext;
+		Program				mPrograms[NUM_VARIANTS];
+		//! Program binaries can be retrieved and loaded by this context
+		bool				mBinaries;
+		//! Identifies the driver, so binaries are never loaded by another
+		std::string			mDriver;
+		//! Unit square drawn by draw()
+		gl::VaoRef			mVao;
+		gl::VboRef			mVbo;
+		Stats				mStats;
+	};
+
+} } // namespace cinder::hap
@@ -0,0 +1,260 @@
+/*
+ *  HapSnappy.cpp
+ *
+ *  Snappy second-stage compression as used by Hap frames.
+ *
+ */
+
+#include "HapSnappy.h"
+
+#include <cstring>
+
+namespace cinder { namespace hap { namespace snappy {
+
+	namespace {
+		// Input is compressed in independent fragments so that every copy offset fits in 16 bits
+		const size_t	kBlockSize = 1 << 16;
+		const int		kHashBits = 14;
+		// Minimum number of trailing bytes that are always emitted as literals, so the match loop can read ahead freely
+		const size_t	kInputMargin = 15;
+
+		enum { LITERAL = 0, COPY_1_BYTE_OFFSET = 1, COPY_2_BYTE_OFFSET = 2, COPY_4_BYTE_OFFSET = 3 };
+
+		inline uint32_t load32( const uint8_t *p )
+		{
+			uint32_t v;
+			memcpy( &v, p, sizeof( v ) );
+			return v;
+		}
+
+		inline uint32_t hash( uint32_t bytes )
+		{
+			return ( bytes * 0x1e35a7bd ) >> ( 32 - kHashBits );
+		}
+
+		uint8_t* emitLiteral( uint8_t *op, const uint8_t *literal, size_t length )
+		{
+			size_t n = length - 1;
+			if( n < 60 ) {
+				*op++ = static_cast<uint8_t>( LITERAL | ( n << 2 ) );
+			}
+			else {
+				uint8_t *base = op++;
+				int count = 0;
+				while( n > 0 ) {
+					*op++ = static_cast<uint8_t>( n & 0xff );
+					n >>= 8;
+					count++;
+				}
+				*base = static_cast<uint8_t>( LITERAL | ( ( 59 + count ) << 2 ) );
+			}
+			memcpy( op, literal, length );
+			return op + length;
+		}
+
+		uint8_t* emitCopyAtMost64( uint8_t *op, size_t offset, size_t length )
+		{
+			if( length < 12 && offset < 2048 ) {
+				*op++ = static_cast<uint8_t>( COPY_1_BYTE_OFFSET | ( ( length - 4 ) << 2 ) | ( ( offset >> 8 ) << 5 ) );
+				*op++ = static_cast<uint8_t>( offset & 0xff );
+			}
+			else {
+				*op++ = static_cast<uint8_t>( COPY_2_BYTE_OFFSET | ( ( length - 1 ) << 2 ) );
+				*op++ = static_cast<uint8_t>( offset & 0xff );
+				*op++ = static_cast<uint8_t>( offset >> 8 );
+			}
+			return op;
+		}
+
+		uint8_t* emitCopy( uint8_t *op, size_t offset, size_t length )
+		{
+			// Keep every remainder at least 4 bytes long so it stays encodable
+			while( length >= 68 ) {
+				op = emitCopyAtMost64( op, offset, 64 );
+				length -= 64;
+			}
+			if( length > 64 ) {
+				op = emitCopyAtMost64( op, offset, 60 );
+				length -= 60;
+			}
+			return emitCopyAtMost64( op, offset, length );
+		}
+
+		uint8_t* compressFragment( const uint8_t *input, size_t length, uint8_t *op, uint16_t *table )
+		{
+			const uint8_t *ip = input;
+			const uint8_t *end = input + length;
+			const uint8_t *nextEmit = input;
+
+			if( length >= kInputMargin ) {
+				const uint8_t *ipLimit = end - kInputMargin;
+				memset( table, 0, sizeof( uint16_t ) << kHashBits );
+
+				for( ++ip; ip < ipLimit; ) {
+					// Scan for a 4-byte match, stepping faster through incompressible data
+					const uint8_t *candidate = nullptr;
+					uint32_t skip = 32;
+					for(;;) {
+						uint32_t h = hash( load32( ip ) );
+						candidate = input + table[h];
+						table[h] = static_cast<uint16_t>( ip - input );
+						if( load32( ip ) == load32( candidate ) && candidate < ip )
+							break;
+						ip += ( skip++ >> 5 );
+						if( ip >= ipLimit )
+							goto emitRemainder;
+					}
+
+					op = emitLiteral( op, nextEmit, ip - nextEmit );
+
+					// Emit back-to-back copies for as long as the next position also matches
+					do {
+						const uint8_t *base = ip;
+						const uint8_t *matched = candidate + 4;
+						ip += 4;
+						while( ip < end && *ip == *matched ) {
+							ip++;
+							matched++;
+						}
+						op = emitCopy( op, base - candidate, ip - base );
+						nextEmit = ip;
+						if( ip >= ipLimit )
+							goto emitRemainder;
+
+						table[hash( load32( ip - 1 ) )] = static_cast<uint16_t>( ip - 1 - input );
+						uint32_t h = hash( load32( ip ) );
+						candidate = input + table[h];
+						table[h] = static_cast<uint16_t>( ip - input );
+					} while( load32( ip ) == load32( candidate ) );
+
+					++ip;
+				}
+			}
+
+		emitRemainder:
+			if( nextEmit < end )
+				op = emitLiteral( op, nextEmit, end - nextEmit );
+			return op;
+		}
+	} // anonymous namespace
+
+	size_t getMaxCompressedLength( size_t sourceLength )
+	{
+		return 32 + sourceLength + sourceLength / 6;
+	}
+
+	size_t compress( const uint8_t *source, size_t sourceLength, uint8_t *dest )
+	{
+		uint8_t *op = dest;
+
+		// Preamble: the uncompressed length as a little-endian varint
+		size_t n = sourceLength;
+		while( n >= 0x80 ) {
+			*op++ = static_cast<uint8_t>( n | 0x80 );
+			n >>= 7;
+		}
+		*op++ = static_cast<uint8_t>( n );
+
+		uint16_t table[1 << kHashBits];
+		for( size_t offset = 0; offset < sourceLength; offset += kBlockSize ) {
+			size_t length = sourceLength - offset < kBlockSize ? sourceLength - offset : kBlockSize;
+			op = compressFragment( source + offset, length, op, table );
+		}
+
+		return op - dest;
+	}
+
+	bool getUncompressedLength( const uint8_t *source, size_t sourceLength, size_t *result )
+	{
+		uint64_t length = 0;
+		for( size_t i = 0; i < sourceLength && i < 5; i++ ) {
+			length |= static_cast<uint64_t>( source[i] & 0x7f ) << ( 7 * i );
+			if( ! ( source[i] & 0x80 ) ) {
+				if( length > 0xffffffffu )
+					return false;
+				*result = static_cast<size_t>( length );
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool uncompress( const uint8_t *source, size_t sourceLength, uint8_t *dest, size_t destLength )
+	{
+		size_t expected;
+		if( ! getUncompressedLength( source, sourceLength, &expected ) || expected != destLength )
+			return false;
+
+		const uint8_t *ip = source;
+		const uint8_t *ipEnd = source + sourceLength;
+		while( *ip++ & 0x80 )
+			;
+
+		uint8_t *op = dest;
+		uint8_t *opEnd = dest + destLength;
+		while( ip < ipEnd ) {
+			const uint8_t tag = *ip++;
+			size_t length, offset;
+
+			switch( tag & 3 ) {
+				case LITERAL: {
+					length = tag >> 2;
+					if( length >= 60 ) {
+						size_t count = length - 59;
+						if( static_cast<size_t>( ipEnd - ip ) < count )
+							return false;
+						length = 0;
+						for( size_t i = 0; i < count; i++ )
+							length |= static_cast<size_t>( ip[i] ) << ( 8 * i );
+						ip += count;
+					}
+					length += 1;
+					if( static_cast<size_t>( ipEnd - ip ) < length || static_cast<size_t>( opEnd - op ) < length )
+						return false;
+					memcpy( op, ip, length );
+					ip += length;
+					op += length;
+					continue;
+				}
+				case COPY_1_BYTE_OFFSET:
+					if( ipEnd - ip < 1 )
+						return false;
+					length = 4 + ( ( tag >> 2 ) & 7 );
+					offset = ( static_cast<size_t>( tag >> 5 ) << 8 ) | ip[0];
+					ip += 1;
+					break;
+				case COPY_2_BYTE_OFFSET:
+					if( ipEnd - ip < 2 )
+						return false;
+					length = 1 + ( tag >> 2 );
+					offset = ip[0] | ( static_cast<size_t>( ip[1] ) << 8 );
+					ip += 2;
+					break;
+				default:
+					if( ipEnd - ip < 4 )
+						return false;
+					length = 1 + ( tag >> 2 );
+					offset = load32( ip );
+					ip += 4;
+					break;
+			}
+
+			if( offset == 0 || offset > static_cast<size_t>( op - dest ) || static_cast<size_t>( opEnd - op ) < length )
+				return false;
+
+			const uint8_t *from = op - offset;
+			if( offset >= length ) {
+				memcpy( op, from, length );
+				op += length;
+			}
+			else {
+				// Overlapping copies repeat the last `offset` bytes
+				for( size_t i = 0; i < length; i++ )
+					*op++ = *from++;
+			}
+		}
+
+		return op == opEnd;
+	}
+
+} } } // namespace cinder::hap::snappy
@@ -0,0 +1,25 @@
+/*
+ *  HapSnappy.h
+ *
+ *  Snappy second-stage compression as used by Hap frames.
+ *  See https://github.com/google/snappy/blob/master/format_description.txt
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cinder { namespace hap { namespace snappy {
+
+	//! Returns the worst-case compressed size of \a sourceLength bytes of input.
+	size_t	getMaxCompressedLength( size_t sourceLength );
+	//! Compresses \a sourceLength bytes into \a dest, which must hold at least getMaxCompressedLength() bytes. Returns the compressed size.
+	size_t	compress( const uint8_t *source, size_t sourceLength, uint8_t *dest );
+
+	//! Reads the uncompressed length stored in the preamble of a compressed buffer. Returns false if the preamble is malformed.
+	bool	getUncompressedLength( const uint8_t *source, size_t sourceLength, size_t *result );
+	//! Decompresses into \a dest, which must hold exactly the uncompressed length. Returns false on corrupt input.
+	bool	uncompress( const uint8_t *source, size_t sourceLength, uint8_t *dest, size_t destLength );
+
+} } } // namespace cinder::hap::snappy
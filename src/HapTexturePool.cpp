@@ -0,0 +1,145 @@
+/*
+ *  HapTexturePool.cpp
+ *
+ *  Process-wide pool of compressed textures, recycled by format and size across movies.
+ *
+ */
+
+#include "HapTexturePool.h"
+
+#include <algorithm>
+
+namespace cinder { namespace hap {
+
+	namespace {
+		std::mutex					sInstanceMutex;
+		std::weak_ptr<TexturePool>	sInstance;
+		size_t						sBudget = 128 * 1024 * 1024;
+	}
+
+	TexturePoolRef TexturePool::get()
+	{
+		std::lock_guard<std::mutex> lock( sInstanceMutex );
+		TexturePoolRef pool = sInstance.lock();
+		if( ! pool ) {
+			pool = TexturePoolRef( new TexturePool );
+			sInstance = pool;
+		}
+		return pool;
+	}
+
+	void TexturePool::setBudget( size_t bytes )
+	{
+		TexturePoolRef pool;
+		{
+			std::lock_guard<std::mutex> lock( sInstanceMutex );
+			sBudget = bytes;
+			pool = sInstance.lock();
+		}
+		if( pool ) {
+			std::vector<gl::Texture2dRef> evicted;
+			std::lock_guard<std::mutex> lock( pool->mMutex );
+			pool->evict( bytes, &evicted );
+		}
+	}
+
+	size_t TexturePool::getBudget()
+	{
+		std::lock_guard<std::mutex> lock( sInstanceMutex );
+		return sBudget;
+	}
+
+	size_t TexturePool::getBytes( GLint internalFormat, GLuint width, GLuint height )
+	{
+		const size_t pixels = static_cast<size_t>( width ) * height;
+		switch( internalFormat ) {
+			case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+			case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+				return pixels / 2;
+			case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+			case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+				return pixels;
+			default:
+				return pixels * 4;
+		}
+	}
+
+	gl::Texture2dRef TexturePool::acquire( GLuint width, GLuint height, const gl::Texture2d::Format &format )
+	{
+		Entry entry;
+		entry.mInternalFormat = format.getInternalFormat();
+		entry.mWidth = width;
+		entry.mHeight = height;
+		const size_t bytes = getBytes( entry.mInternalFormat, width, height );
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			auto it = std::find_if( mIdle.begin(), mIdle.end(), [&]( const Entry &idle ) {
+				return idle.mInternalFormat == entry.mInternalFormat && idle.mWidth == width && idle.mHeight == height;
+			} );
+			if( it != mIdle.end() ) {
+				entry.mTexture = it->mTexture;
+				mIdle.erase( it );
+				mIdleBytes -= bytes;
+				mHits++;
+			}
+			else
+				mMisses++;
+			mUsedBytes += bytes;
+			mNumUsed++;
+		}
+
+		if( ! entry.mTexture )
+			entry.mTexture = gl::Texture2d::create( width, height, format );
+
+		// The reference handed out shares the texture, and gives it back to the pool once it's dropped
+		std::weak_ptr<TexturePool> weakPool;
+		{
+			std::lock_guard<std::mutex> lock( sInstanceMutex );
+			weakPool = sInstance;
+		}
+		return gl::Texture2dRef( entry.mTexture.get(), [weakPool, entry]( gl::Texture2d* ) {
+			if( TexturePoolRef pool = weakPool.lock() )
+				pool->recycle( entry );
+		} );
+	}
+
+	void TexturePool::recycle( const Entry &entry )
+	{
+		const size_t budget = getBudget();
+		std::vector<gl::Texture2dRef> evicted;
+		std::lock_guard<std::mutex> lock( mMutex );
+		const size_t bytes = getBytes( entry.mInternalFormat, entry.mWidth, entry.mHeight );
+		mUsedBytes -= bytes;
+		mNumUsed--;
+		mIdle.push_front( entry );
+		mIdleBytes += bytes;
+		evict( budget, &evicted );
+	}
+
+	void TexturePool::evict( size_t budget, std::vector<gl::Texture2dRef> *evicted )
+	{
+		while( ! mIdle.empty() && mIdleBytes > budget ) {
+			const Entry &entry = mIdle.back();
+			mIdleBytes -= getBytes( entry.mInternalFormat, entry.mWidth, entry.mHeight );
+			evicted->push_back( entry.mTexture );
+			mIdle.pop_back();
+			mEvictions++;
+		}
+	}
+
+	TexturePool::Stats TexturePool::getStats() const
+	{
+		Stats stats;
+		stats.mBudget = getBudget();
+		std::lock_guard<std::mutex> lock( mMutex );
+		stats.mIdleBytes = mIdleBytes;
+		stats.mUsedBytes = mUsedBytes;
+		stats.mNumIdle = static_cast<uint32_t>( mIdle.size() );
+		stats.mNumUsed = mNumUsed;
+		stats.mHits = mHits;
+		stats.mMisses = mMisses;
+		stats.mEvictions = mEvictions;
+		return stats;
+	}
+
+} } // namespace cinder::hap
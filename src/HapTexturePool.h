@@ -0,0 +1,74 @@
+/*
+ *  HapTexturePool.h
+ *
+ *  Process-wide pool of compressed textures, recycled by format and size across movies.
+ *
+ */
+#pragma once
+
+#include "cinder/Cinder.h"
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Texture.h"
+
+#include <list>
+#include <mutex>
+
+namespace cinder { namespace hap {
+
+	typedef std::shared_ptr<class TexturePool> TexturePoolRef;
+
+	//! Hands out textures by internal format and backing size, reusing those released by any movie before allocating
+	//! a new one, so switching between clips of the same resolution doesn't allocate video memory. A texture goes back
+	//! to the pool when its last reference is dropped. Idle textures are kept up to the budget, least recently
+	//! released first out. Textures must be acquired and dropped on the thread of the GL context they belong to.
+	class TexturePool {
+	  public:
+		struct Stats {
+			Stats() : mBudget( 0 ), mIdleBytes( 0 ), mUsedBytes( 0 ), mNumIdle( 0 ), mNumUsed( 0 ), mHits( 0 ), mMisses( 0 ), mEvictions( 0 ) {}
+
+			size_t		mBudget;
+			//! Video memory held by textures waiting in the pool, and by textures handed out
+			size_t		mIdleBytes, mUsedBytes;
+			uint32_t	mNumIdle, mNumUsed;
+			//! Textures handed out from the pool, and those that had to be allocated
+			uint32_t	mHits, mMisses;
+			//! Idle textures deleted to stay within the budget
+			uint32_t	mEvictions;
+		};
+
+		//! Returns the shared pool, creating it if no movie is using it. It's released with the last movie.
+		static TexturePoolRef	get();
+		//! Maximum number of bytes held by idle textures. Defaults to 128 MB, zero deletes textures as they're dropped.
+		static void				setBudget( size_t bytes );
+		static size_t			getBudget();
+
+		//! Returns a texture of \a width by \a height with \a format, reused if the pool has an idle one with the same
+		//! internal format and size. Its other format settings are assumed to be the same as when it was created.
+		gl::Texture2dRef	acquire( GLuint width, GLuint height, const gl::Texture2d::Format &format );
+
+		Stats		getStats() const;
+
+	  private:
+		TexturePool() : mIdleBytes( 0 ), mUsedBytes( 0 ), mNumUsed( 0 ), mHits( 0 ), mMisses( 0 ), mEvictions( 0 ) {}
+
+		struct Entry {
+			GLint				mInternalFormat;
+			GLuint				mWidth, mHeight;
+			gl::Texture2dRef	mTexture;
+		};
+
+		//! Called when the last reference handed out to \a entry's texture is dropped
+		void		recycle( const Entry &entry );
+		//! Moves idle textures over \a budget to \a evicted, to be deleted once the lock is released
+		void		evict( size_t budget, std::vector<gl::Texture2dRef> *evicted );
+
+		static size_t	getBytes( GLint internalFormat, GLuint width, GLuint height );
+
+		mutable std::mutex		mMutex;
+		//! Idle textures, most recently released first
+		std::list<Entry>		mIdle;
+		size_t					mIdleBytes, mUsedBytes;
+		uint32_t				mNumUsed, mHits, mMisses, mEvictions;
+	};
+
+} } // namespace cinder::hap
@@ -0,0 +1,72 @@
+/*
+ *  HapUploadBackend.cpp
+ *
+ *  Where decoded Hap frames go: the interface, and backends that need no GPU.
+ *
+ */
+
+#include "HapUploadBackend.h"
+#include "HapDxt.h"
+#include "HapFormat.h"
+
+#include "cinder/Log.h"
+
+#include <algorithm>
+
+namespace cinder { namespace hap {
+
+	void CpuUploadBackend::create( const FrameFormat &format )
+	{
+		mFormat = format;
+		mUploaded.assign( static_cast<size_t>( format.mWidth ) * format.mHeight * 4, 0 );
+		mStats.mCreates++;
+	}
+
+	void CpuUploadBackend::uploadRows( const uint8_t *dxt, size_t size, uint32_t firstRow, uint32_t numRows )
+	{
+		const bool dxt1 = mFormat.mTextureFormat == SectionType::TEXTURE_RGB_DXT1;
+		const size_t blockSize = mFormat.getBlockSize(), rowPitch = mFormat.getRowPitch();
+		const uint32_t blocksWide = mFormat.getBlocksWide(), blocksHigh = mFormat.getBlocksHigh();
+		const uint32_t lastRow = std::min( firstRow + numRows, blocksHigh );
+		if( lastRow <= firstRow )
+			return;
+		if( size < ( lastRow - 1 ) * rowPitch + mFormat.getRowBytes() ) {
+			CI_LOG_E( "HAP ERROR :: frame of " << size << " bytes is too small for " << mFormat.mRoundedWidth << "x" << mFormat.mRoundedHeight );
+			return;
+		}
+
+		// Blocks past the picture's edge are skipped, partial ones clipped
+		const ptrdiff_t rowBytes = static_cast<ptrdiff_t>( mFormat.mWidth ) * 4;
+		uint8_t block[64];
+		for( uint32_t by = firstRow; by < lastRow; by++ ) {
+			for( uint32_t bx = 0; bx < blocksWide; bx++ ) {
+				const uint8_t *src = dxt + by * rowPitch + bx * blockSize;
+				if( dxt1 )
+					dxt::decompressBlockDxt1( src, block );
+				else if( mFormat.mTextureFormat == SectionType::TEXTURE_YCOCG_DXT5 )
+					dxt::decompressBlockYCoCgDxt5( src, block );
+				else
+					dxt::decompressBlockDxt5( src, block );
+				dxt::insertBlock( block, mFormat.mWidth, mFormat.mHeight, rowBytes, bx * 4, by * 4, mUploaded.data() );
+			}
+		}
+		mStats.mBytes += ( lastRow - firstRow ) * mFormat.getRowBytes();
+		if( lastRow == blocksHigh )
+			mStats.mUploads++;
+	}
+
+	void CpuUploadBackend::fence()
+	{
+		// The frame fenced stays readable while the next one is decompressed
+		mPixels.swap( mUploaded );
+		if( mUploaded.size() != mPixels.size() )
+			mUploaded.resize( mPixels.size() );
+	}
+
+	void CpuUploadBackend::release()
+	{
+		std::vector<uint8_t>().swap( mUploaded );
+		std::vector<uint8_t>().swap( mPixels );
+	}
+
+} } // namespace cinder::hap
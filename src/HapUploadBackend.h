@@ -0,0 +1,134 @@
+/*
+ *  HapUploadBackend.h
+ *
+ *  Where decoded Hap frames go: the interface, and backends that need no GPU.
+ *
+ */
+#pragma once
+
+#include "HapFormat.h"
+
+#include "cinder/Cinder.h"
+
+#include <vector>
+
+namespace cinder { namespace hap {
+
+	typedef std::shared_ptr<class UploadBackend> UploadBackendRef;
+	typedef std::shared_ptr<class NullUploadBackend> NullUploadBackendRef;
+	typedef std::shared_ptr<class CpuUploadBackend> CpuUploadBackendRef;
+
+	//! Receives the DXT frames a movie shows, one create() per frame format and then an upload(), or uploadRows() of
+	//! every row in bands, and a fence() per frame. Calls are made on the thread that draws the movie, except that
+	//! create() and upload() run on the UploadThread while the movie uploads in the background. No two calls ever
+	//! overlap.
+	class UploadBackend {
+	  public:
+		struct FrameFormat {
+			FrameFormat() : mWidth( 0 ), mHeight( 0 ), mRoundedWidth( 0 ), mRoundedHeight( 0 ), mTextureFormat( 0 ) {}
+			FrameFormat( uint32_t width, uint32_t height, uint32_t roundedWidth, uint32_t roundedHeight, uint8_t textureFormat )
+			: mWidth( width ), mHeight( height ), mRoundedWidth( roundedWidth ), mRoundedHeight( roundedHeight ), mTextureFormat( textureFormat ) {}
+
+			bool operator==( const FrameFormat &other ) const { return mWidth == other.mWidth && mHeight == other.mHeight && mRoundedWidth == other.mRoundedWidth && mRoundedHeight == other.mRoundedHeight && mTextureFormat == other.mTextureFormat; }
+			bool operator!=( const FrameFormat &other ) const { return ! ( *this == other ); }
+
+			//! Bytes per 4x4 block
+			size_t		getBlockSize() const { return mTextureFormat == SectionType::TEXTURE_RGB_DXT1 ? 8 : 16; }
+			//! Blocks covering the picture, the last row and column partly outside it if its size isn't a multiple of 4
+			uint32_t	getBlocksWide() const { return ( mWidth + 3 ) / 4; }
+			uint32_t	getBlocksHigh() const { return ( mHeight + 3 ) / 4; }
+			//! Bytes from one row of blocks to the next in the DXT data
+			size_t		getRowPitch() const { return mRoundedWidth / 4 * getBlockSize(); }
+			//! Bytes of a row of the blocks covering the picture. Less than getRowPitch() when the data is padded.
+			size_t		getRowBytes() const { return getBlocksWide() * getBlockSize(); }
+
+			//! Size of the picture, any size
+			uint32_t	mWidth, mHeight;
+			//! Size the DXT data covers, a multiple of 4 that may include padding past the blocks covering the picture
+			uint32_t	mRoundedWidth, mRoundedHeight;
+			//! One of the hap::SectionType texture formats
+			uint8_t		mTextureFormat;
+		};
+
+		struct Stats {
+			Stats() : mCreates( 0 ), mUploads( 0 ), mBytes( 0 ), mSkippedBytes( 0 ) {}
+
+			uint32_t	mCreates, mUploads;
+			uint64_t	mBytes;
+			//! Bytes not uploaded because the destination already held them. Zero for backends that take every row.
+			uint64_t	mSkippedBytes;
+		};
+
+		virtual ~UploadBackend() {}
+
+		//! Prepares for frames of \a format. Called before the first upload and whenever the format changes, as when a
+		//! movie switches to its proxy.
+		virtual void	create( const FrameFormat &format ) = 0;
+		//! Takes a frame in the format last created, laid out as FrameFormat::getRowPitch() says. Only the blocks
+		//! covering the picture need to be shown. \a dxt is only valid during the call.
+		virtual void	upload( const uint8_t *dxt, size_t size ) = 0;
+		//! Takes \a numRows rows of blocks from \a firstRow on, so a large frame can go up in bands spread over time.
+		//! \a dxt is the whole frame, as for upload(), and only valid during the call. The frame is complete once every
+		//! row has been taken; an incomplete frame is dropped by the next frame's first band or upload().
+		virtual void	uploadRows( const uint8_t *dxt, size_t size, uint32_t firstRow, uint32_t numRows ) = 0;
+		//! The frame just uploaded is now the one to show, whatever showed the one before it can be fenced
+		virtual void	fence() = 0;
+		//! Frees whatever create() and upload() allocated. Called before the backend is replaced and when the movie is
+		//! destroyed. A create() may follow.
+		virtual void	release() = 0;
+
+		virtual Stats	getStats() const = 0;
+	};
+
+	//! Only counts frames and bytes. For measuring the reading and decoding of a movie without a GPU.
+	class NullUploadBackend : public UploadBackend {
+	  public:
+		static NullUploadBackendRef create() { return NullUploadBackendRef( new NullUploadBackend ); }
+
+		void	create( const FrameFormat &format ) override { mFormat = format; mStats.mCreates++; }
+		void	upload( const uint8_t *dxt, size_t size ) override { uploadRows( dxt, size, 0, mFormat.getBlocksHigh() ); }
+		void	uploadRows( const uint8_t *, size_t, uint32_t firstRow, uint32_t numRows ) override
+		{
+			mStats.mBytes += numRows * mFormat.getRowBytes();
+			if( firstRow + numRows >= mFormat.getBlocksHigh() )
+				mStats.mUploads++;
+		}
+		void	fence() override {}
+		void	release() override {}
+		Stats	getStats() const override { return mStats; }
+
+	  private:
+		NullUploadBackend() {}
+
+		FrameFormat	mFormat;
+		Stats		mStats;
+	};
+
+	//! Decompresses every frame to RGBA in memory, converting Hap Q's YCoCg back to RGB. For tests, as in
+	//! tools/HapUploadCheck, and for rendering without a GPU.
+	class CpuUploadBackend : public UploadBackend {
+	  public:
+		static CpuUploadBackendRef create() { return CpuUploadBackendRef( new CpuUploadBackend ); }
+
+		void	create( const FrameFormat &format ) override;
+		void	upload( const uint8_t *dxt, size_t size ) override { uploadRows( dxt, size, 0, mFormat.getBlocksHigh() ); }
+		void	uploadRows( const uint8_t *dxt, size_t size, uint32_t firstRow, uint32_t numRows ) override;
+		void	fence() override;
+		void	release() override;
+		Stats	getStats() const override { return mStats; }
+
+		//! RGBA pixels of the last frame fenced, getWidth() by getHeight() with no padding
+		const std::vector<uint8_t>&	getPixels() const { return mPixels; }
+		uint32_t	getWidth() const { return mFormat.mWidth; }
+		uint32_t	getHeight() const { return mFormat.mHeight; }
+
+	  private:
+		CpuUploadBackend() {}
+
+		FrameFormat				mFormat;
+		//! The frame uploaded, and the one fenced last
+		std::vector<uint8_t>	mUploaded, mPixels;
+		Stats					mStats;
+	};
+
+} } // namespace cinder::hap
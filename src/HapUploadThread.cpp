@@ -0,0 +1,125 @@
+/*
+ *  HapUploadThread.cpp
+ *
+ *  Process-wide thread that uploads frames with a GL context shared with the render thread's.
+ *
+ */
+
+#include "HapUploadThread.h"
+
+#include "cinder/Thread.h"
+
+#include <chrono>
+
+namespace cinder { namespace hap {
+
+	namespace {
+		std::mutex						sInstanceMutex;
+		std::weak_ptr<UploadThread>		sInstance;
+	}
+
+	UploadThreadRef UploadThread::get()
+	{
+		std::lock_guard<std::mutex> lock( sInstanceMutex );
+		UploadThreadRef thread = sInstance.lock();
+		if( ! thread ) {
+			thread = UploadThreadRef( new UploadThread );
+			sInstance = thread;
+		}
+		return thread;
+	}
+
+	UploadThread::UploadThread()
+	: mQuit( false ), mJobsRun( 0 ), mTotalSeconds( 0 )
+	{
+		// Some platforms leave a context current once it's created, so the render thread's is made current again
+		gl::Context *renderContext = gl::context();
+		mContext = gl::Context::create( renderContext );
+		renderContext->makeCurrent();
+		mThread = std::thread( &UploadThread::threadLoop, this );
+	}
+
+	UploadThread::~UploadThread()
+	{
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			mQuit = true;
+		}
+		mWakeCond.notify_all();
+		mThread.join();
+	}
+
+	UploadThread::JobRef UploadThread::submit( const std::function<void()> &run )
+	{
+		JobRef job( new Job( run ) );
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			mJobs.push_back( job );
+		}
+		mWakeCond.notify_one();
+		return job;
+	}
+
+	bool UploadThread::finish( const JobRef &job )
+	{
+		if( ! job->isDone() )
+			return false;
+		if( job->mFence ) {
+			glWaitSync( job->mFence, 0, GL_TIMEOUT_IGNORED );
+			// Deleting it only takes effect once the wait is over
+			glDeleteSync( job->mFence );
+			job->mFence = nullptr;
+		}
+		return true;
+	}
+
+	void UploadThread::wait( const JobRef &job )
+	{
+		{
+			std::unique_lock<std::mutex> lock( mMutex );
+			mDoneCond.wait( lock, [&] { return job->isDone(); } );
+		}
+		finish( job );
+	}
+
+	UploadThread::Stats UploadThread::getStats() const
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		Stats stats;
+		stats.mJobsRun = mJobsRun;
+		stats.mJobsQueued = static_cast<uint32_t>( mJobs.size() );
+		stats.mTotalSeconds = mTotalSeconds;
+		return stats;
+	}
+
+	void UploadThread::threadLoop()
+	{
+		ThreadSetup threadSetup;
+		mContext->makeCurrent();
+
+		std::unique_lock<std::mutex> lock( mMutex );
+		while( true ) {
+			mWakeCond.wait( lock, [this] { return mQuit || ! mJobs.empty(); } );
+			// Jobs left at exit still run, so nobody waits on them forever
+			if( mJobs.empty() )
+				break;
+			JobRef job = mJobs.front();
+			mJobs.pop_front();
+			lock.unlock();
+
+			const auto start = std::chrono::steady_clock::now();
+			job->mRun();
+			job->mFence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+			// Another context's wait on the fence would never end if it stayed unflushed in this one
+			glFlush();
+			job->mSeconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+			lock.lock();
+			job->mDone.store( true, std::memory_order_release );
+			mJobsRun++;
+			mTotalSeconds += job->mSeconds;
+			mDoneCond.notify_all();
+		}
+	}
+
+} } // namespace cinder::hap
@@ -0,0 +1,93 @@
+/*
+ *  HapUploadThread.h
+ *
+ *  Process-wide thread that uploads frames with a GL context shared with the render thread's.
+ *
+ */
+#pragma once
+
+#include "cinder/Cinder.h"
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Context.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace cinder { namespace hap {
+
+	typedef std::shared_ptr<class UploadThread> UploadThreadRef;
+
+	//! Runs upload jobs one at a time, in the order they're submitted, on a thread whose GL context shares objects
+	//! with the render thread's. Each job is fenced and flushed once it has run. The render thread hands that fence
+	//! to its own context with finish(), which makes the GPU, not the CPU, wait for the upload before anything
+	//! drawn after it. Textures a job uploads to must be bound again after finish() for the new contents to show.
+	class UploadThread {
+	  public:
+		class Job;
+		typedef std::shared_ptr<Job>	JobRef;
+
+		class Job {
+		  public:
+			//! True once the job has run and its commands have been flushed
+			bool	isDone() const { return mDone.load( std::memory_order_acquire ); }
+			//! Seconds the job took on the upload thread, once it's done
+			double	getSeconds() const { return mSeconds; }
+
+		  private:
+			Job( const std::function<void()> &run ) : mRun( run ), mFence( nullptr ), mSeconds( 0 ), mDone( false ) {}
+
+			friend class UploadThread;
+			std::function<void()>	mRun;
+			GLsync					mFence;
+			double					mSeconds;
+			std::atomic<bool>		mDone;
+		};
+
+		struct Stats {
+			Stats() : mJobsRun( 0 ), mJobsQueued( 0 ), mTotalSeconds( 0 ) {}
+
+			uint32_t	mJobsRun;
+			//! Jobs submitted but not run yet
+			uint32_t	mJobsQueued;
+			//! Seconds spent running jobs, in total
+			double		mTotalSeconds;
+		};
+
+		//! Returns the shared upload thread, starting it if nothing is using it. It stops when the last user lets go.
+		//! Starting it creates its context, so the first call must be made with the context to share current.
+		static UploadThreadRef	get();
+
+		~UploadThread();
+
+		//! Queues \a run to be called on the upload thread, with its context current. Never blocks.
+		JobRef		submit( const std::function<void()> &run );
+		//! Render thread: returns false if \a job hasn't run yet. Otherwise makes the current context wait on the GPU
+		//! for its commands, so what it uploaded can be drawn, and returns true. Never blocks.
+		bool		finish( const JobRef &job );
+		//! Render thread: blocks until \a job has run, then finish()es it. For when a job's data is about to go away.
+		void		wait( const JobRef &job );
+
+		Stats		getStats() const;
+
+	  private:
+		UploadThread();
+
+		void		threadLoop();
+
+		gl::ContextRef			mContext;
+		std::thread				mThread;
+		mutable std::mutex		mMutex;
+		std::condition_variable	mWakeCond;
+		//! Signalled when a job is done, for wait()
+		std::condition_variable	mDoneCond;
+		std::deque<JobRef>		mJobs;
+		bool					mQuit;
+		uint32_t				mJobsRun;
+		double					mTotalSeconds;
+	};
+
+} } // namespace cinder::hap
@@ -21,6 +21,11 @@ extern "C" {
 #include "cinder/gl/Context.h"
 #include "cinder/GeomIo.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
 
 #if defined( CINDER_MAC )
 	#include <QTKit/QTKit.h>
@@ -79,33 +84,27 @@ namespace cinder { namespace qtime {
 		return _AverageFps;
 	}
 	
-	gl::GlslProgRef MovieGlHap::Obj::sHapQShader = nullptr;
-	
 	MovieGlHap::Obj::Obj()
 	: MovieBase::Obj()
-  //, mDefaultShader( gl::getStockShader( gl::ShaderDef().texture() ) )
   , mTextureUpdateFunc(nullptr)
+	, mUploadedSample( SIZE_MAX ), mUploadedOffset( UINT64_MAX ), mUploadedProxy( false ), mGlBackend( hap::GlUploadBackend::create() ), mUploadBackend( mGlBackend )
+	, mUploadSample( SIZE_MAX ), mUploadOffset( UINT64_MAX ), mUploadProxy( false ), mUploadHoldsFrame( false ), mLastSelectTime( -1 ), mRefreshInterval( 0 )
+	, mUploadBands( 1 ), mBandFrame( nullptr ), mBandSample( SIZE_MAX ), mBandOffset( UINT64_MAX ), mBandRow( 0 ), mMovieSample( SIZE_MAX ), mDirection( 1 ), mLoop( false ), mPalindrome( false )
+	, mPresentationPolicy( hap::PresentationClock::Policy::NEAREST ), mScanOutTime( -1 ), mSelectedScanOutTime( -1 ), mPinned( false ), mSynced( false )
+	, mNumUploads( 0 ), mNumSkippedUploads( 0 ), mNumFramesNotReady( 0 ), mNumApproximateFrames( 0 ), mNumLateUploads( 0 ), mNumBandsAhead( 0 ), mNumBandsLate( 0 ), mUploadTime( 0 )
+	, mSeekTime( -1 ), mSeekSample( SIZE_MAX ), mNumSeeksShown( 0 ), mNumSeeksSuperseded( 0 ), mSeekLatencySum( 0 ), mMaxSeekLatency( 0 )
 	{
-		//std::call_once( mHapQOnceFlag, []() {
-		//	MovieGlHap::Obj::sHapQShader = gl::GlslProg::create( app::loadResource(RES_HAP_VERT),  app::loadResource(RES_HAP_FRAG) );
-		//} );
-
-    //// Just make sure that TexCoord is in there
-    //auto rectAttribSet = geom::Rect().getAvailableAttribs();
-    //if (rectAttribSet.count(geom::TEX_COORD_0) == 0)
-    //{
-    //  //ExitProcess(0);
-    //}
-
-    //Rectf fsQuad(-1.0f, -1.0f, 1.0f, 1.0f);
-    //mFullscreenQuadDefaultBatch = gl::Batch::create(geom::Rect(fsQuad), mDefaultShader);
-    //mFullscreenQuadHapQBatch = gl::Batch::create(geom::Rect(fsQuad), MovieGlHap::Obj::sHapQShader);
 	}
 	
 	MovieGlHap::Obj::~Obj()
 	{
 		// see note on prepareForDestruction()
 		prepareForDestruction();
+		waitForUpload();
+		if( mPinned )
+			hap::SampleCache::get()->unpin( mSampleReader->getFilePath() );
+		mUploadBackend->release();
+		mGlBackend->release();
 		if (mTexture)
       mTexture.reset();
 	}
@@ -122,6 +121,15 @@ namespace cinder { namespace qtime {
 	: MovieBase(), mObj( new Obj() )
 	{
 		MovieBase::initFromPath( path );
+		openSampleReader( path );
+		allocateVisualContext();
+	}
+
+	MovieGlHap::MovieGlHap( const fs::path &path, const hap::MovieDecoderRef &decoder )
+	: MovieBase(), mObj( new Obj() )
+	{
+		MovieBase::initFromPath( path );
+		openSampleReader( path, decoder );
 		allocateVisualContext();
 	}
 	
@@ -136,6 +144,8 @@ namespace cinder { namespace qtime {
 	: MovieBase(), mObj( new Obj() )
 	{
 		MovieBase::initFromDataSource( dataSource, mimeTypeHint );
+		if( dataSource->isFilePath() )
+			openSampleReader( dataSource->getFilePath() );
 		allocateVisualContext();
 	}
 
@@ -145,7 +155,10 @@ namespace cinder { namespace qtime {
     mObj->mTextureUpdateFunc = textureUpdateFunc;
     mObj->unlock();
 
-    updateFrame();
+		if( ! mObj->mDecoder )
+			updateFrame();
+		else if( ! mObj->mSynced )
+			updateHapFrame();
   }
 
   MovieGlHap::~MovieGlHap()
@@ -155,8 +168,8 @@ namespace cinder { namespace qtime {
 
 	void MovieGlHap::allocateVisualContext()
 	{
-		// Load HAP Movie
-		if( HapQTQuickTimeMovieHasHapTrackPlayable( getObj()->mMovie ) )
+		// Load HAP Movie. With the background decoder QuickTime only keeps the clock and plays the audio.
+		if( ! mObj->mDecoder && HapQTQuickTimeMovieHasHapTrackPlayable( getObj()->mMovie ) )
 		{
 			// QT Visual Context attributes
 			OSStatus err = noErr;
@@ -195,6 +208,9 @@ namespace cinder { namespace qtime {
                 GetMediaSampleDescription(media, 1, (SampleDescriptionHandle)imageDescription);
                 OSType codecType = (*imageDescription)->cType;
                 DisposeHandle((Handle)imageDescription);
+
+                if( mObj->mDecoder )
+                    SetTrackEnabled( track, false );
                 
                 switch (codecType) {
                     case 'Hap1': mCodec = Codec::HAP; break;
@@ -210,6 +226,476 @@ namespace cinder { namespace qtime {
 
     // Goes here, no errors
 	}
+
+	void MovieGlHap::openSampleReader( const fs::path &path, const hap::MovieDecoderRef &decoder )
+	{
+		try {
+			mObj->mSampleReader = decoder ? decoder->getReader() : hap::MovieReader::create( path );
+			mObj->mDecoder = decoder ? decoder : hap::MovieDecoder::create( mObj->mSampleReader );
+			mObj->mClock = hap::PresentationClock::create( mObj->mSampleReader, mObj->mPresentationPolicy );
+		}
+		catch( const std::exception &exc ) {
+			CI_LOG_W( "HAP :: decoding with QuickTime, couldn't read sample table: " << exc.what() );
+		}
+	}
+
+	void MovieGlHap::setLoop( bool loop, bool palindrome )
+	{
+		MovieBase::setLoop( loop, palindrome );
+		mObj->mLoop = loop;
+		mObj->mPalindrome = palindrome;
+	}
+
+	void MovieGlHap::updateHapFrame()
+	{
+		Obj &obj = *mObj;
+		::MoviesTask( obj.mMovie, 0 );
+
+		const hap::MovieReader &reader = *obj.mDecoder->getReader();
+		if( reader.getNumSamples() == 0 || obj.mDecoder->isSuspended() )
+			return;
+		const double movieTime = ::GetMovieTime( obj.mMovie, nullptr ) / static_cast<double>( ::GetMovieTimeScale( obj.mMovie ) );
+		const size_t movieSample = reader.getSampleIndex( movieTime );
+		// Movie rates are 16.16 fixed point
+		const double speed = std::abs( ::GetMovieRate( obj.mMovie ) / 65536.0 );
+
+		// QuickTime reverses palindrome loops without changing the sign of the rate, so those follow the playhead instead
+		if( obj.mPalindrome && obj.mMovieSample != SIZE_MAX && movieSample != obj.mMovieSample )
+			obj.mDirection = movieSample > obj.mMovieSample ? 1 : -1;
+		else if( ! obj.mPalindrome && ::GetMovieRate( obj.mMovie ) != 0 )
+			obj.mDirection = ::GetMovieRate( obj.mMovie ) > 0 ? 1 : -1;
+		obj.mMovieSample = movieSample;
+
+		const double rate = obj.mDirection * speed;
+		// Palindromes turn around at the ends rather than wrapping
+		const bool palindrome = obj.mLoop && obj.mPalindrome;
+		const bool loop = obj.mLoop && ! palindrome;
+
+		// Pick the frame for the moment the refresh reaches the display, once per refresh. The decoder reads ahead
+		// from there at the same rate and in the same direction.
+		size_t sample = obj.mClock->getLastSample();
+		const bool select = obj.mScanOutTime < 0 || obj.mScanOutTime != obj.mSelectedScanOutTime || sample == SIZE_MAX;
+		if( select ) {
+			const double now = app::getElapsedSeconds();
+			double scanOutDelay = obj.mScanOutTime < 0 ? 0 : obj.mScanOutTime - now;
+			// Frames uploaded in the background show from the update after, so they're picked for the refresh after this one
+			const double selectTime = obj.mScanOutTime < 0 ? now : obj.mScanOutTime;
+			if( obj.mLastSelectTime >= 0 && selectTime > obj.mLastSelectTime )
+				obj.mRefreshInterval = std::min( selectTime - obj.mLastSelectTime, 0.1 );
+			obj.mLastSelectTime = selectTime;
+			if( obj.isUploadingInBackground() )
+				scanOutDelay += obj.mRefreshInterval;
+			sample = obj.mClock->selectFrame( movieTime + scanOutDelay * rate, rate, loop );
+			obj.mSelectedScanOutTime = obj.mScanOutTime;
+		}
+
+		// With a frame step, the last sample on the step stays up until the next one
+		double playhead = obj.mClock->getLastSelectionTime();
+		const size_t frameStep = static_cast<size_t>( obj.mDecoder->getFrameStep() );
+		if( sample % frameStep != 0 ) {
+			sample -= sample % frameStep;
+			const hap::MovieReader::Sample &info = reader.getSample( sample );
+			playhead = ( info.mTime + info.mDuration / 2.0 ) / reader.getTimeScale();
+		}
+
+		if( select ) {
+			obj.mDecoder->setPlayhead( playhead, rate, loop, palindrome );
+			if( obj.mSeekTime >= 0 && obj.mSeekSample == SIZE_MAX )
+				obj.mSeekSample = sample;
+		}
+
+		// Nothing new goes up until the frame uploading in the background is done
+		if( obj.mUpload && ! obj.completeUpload( false ) ) {
+			if( select )
+				obj.mNumLateUploads++;
+			return;
+		}
+
+		if( sample == obj.mUploadedSample ) {
+			obj.finishSeek();
+			// Once per refresh, the frame on screen staying up leaves time for a band of the next one
+			if( select )
+				uploadBand();
+			return;
+		}
+
+		hap::MovieDecoder::Frame *frame = acquireHapFrame( sample );
+		if( ! frame ) {
+			// Scrubbing, the closest frame decoded so far is better than the one on screen
+			hap::DecodedFrameCacheRef decodedCache = obj.mDecoder->isScrubbing() ? obj.mDecoder->getDecodedFrameCache() : nullptr;
+			const size_t nearest = decodedCache ? decodedCache->findNearest( sample ) : SIZE_MAX;
+			uint8_t textureFormat;
+			hap::DecodedFrameCache::DataRef dxt = nearest != SIZE_MAX ? decodedCache->get( nearest, &textureFormat ) : nullptr;
+			if( dxt && ( reader.getSample( nearest ).mOffset != obj.mUploadedOffset || obj.mUploadedProxy ) ) {
+				if( obj.isUploadingInBackground() ) {
+					obj.mUploadData = dxt;
+					obj.beginUpload( reader, *dxt, textureFormat, nearest, reader.getSample( nearest ).mOffset, false, false );
+				}
+				else {
+					obj.uploadFrame( reader, *dxt, textureFormat, false );
+					obj.mUploadedSample = nearest;
+					obj.mUploadedOffset = reader.getSample( nearest ).mOffset;
+					obj.mUploadedProxy = false;
+				}
+				obj.mNumApproximateFrames++;
+			}
+			return;
+		}
+
+		presentHapFrame( frame, sample );
+		if( select )
+			uploadBand();
+	}
+
+	bool MovieGlHap::uploadBand()
+	{
+		Obj &obj = *mObj;
+		if( ! obj.mDecoder || ! obj.isUploadingInBands() )
+			return false;
+
+		// The frame going up stays at the front of the ring until it's due. Anything else means it was discarded.
+		hap::MovieDecoder::Frame *next = obj.mDecoder->peekFrame();
+		if( obj.mBandFrame && ( obj.mBandFrame != next || next->mSample != obj.mBandSample || next->mOffset != obj.mBandOffset ) )
+			obj.mBandFrame = nullptr;
+		if( ! obj.mBandFrame ) {
+			// Only a frame with new pixels is worth uploading ahead
+			if( ! next || next->mDuplicate || next->mSample == obj.mUploadedSample || ( next->mOffset == obj.mUploadedOffset && next->mProxy == obj.mUploadedProxy ) )
+				return false;
+			obj.mBandFrame = next;
+			obj.mBandSample = next->mSample;
+			obj.mBandOffset = next->mOffset;
+			obj.mBandRow = 0;
+		}
+
+		hap::MovieDecoder::Frame *frame = obj.mBandFrame;
+		const hap::UploadBackend::FrameFormat format = Obj::getFrameFormat( frame->mProxy ? *obj.mDecoder->getProxy() : *obj.mDecoder->getReader(), frame->mTextureFormat );
+		const uint32_t rows = format.getBlocksHigh();
+		if( obj.mBandRow >= rows )
+			return false;
+		const uint32_t bandRows = static_cast<uint32_t>( ( rows + obj.mUploadBands - 1 ) / obj.mUploadBands );
+		obj.uploadRows( format, frame->getDxt(), obj.mBandRow, bandRows );
+		obj.mBandRow += bandRows;
+		obj.mNumBandsAhead++;
+		return true;
+	}
+
+	void MovieGlHap::setUploadBands( size_t count )
+	{
+		mObj->mUploadBands = std::max<size_t>( 1, count );
+		// Bands already up stay valid, the rest of the frame goes up in bands of the new size
+	}
+
+	hap::MovieDecoder::Frame* MovieGlHap::acquireHapFrame( size_t sample )
+	{
+		Obj &obj = *mObj;
+		// A frame held for an upload in the background would be discarded under it
+		obj.waitForUpload();
+		hap::MovieDecoder::Frame *frame = obj.mDecoder->acquireFrame( sample );
+		// Unless it's the frame acquired, the frame going up in bands may have been discarded
+		if( obj.mBandFrame && ( frame != obj.mBandFrame || frame->mSample != obj.mBandSample || frame->mOffset != obj.mBandOffset ) )
+			obj.mBandFrame = nullptr;
+		if( frame && frame->mDuplicate && ( frame->mOffset != obj.mUploadedOffset || frame->mProxy != obj.mUploadedProxy ) ) {
+			// The frame it repeats never made it to the screen, so its pixels are gone. Decode it again from here.
+			obj.mDecoder->releaseFrame();
+			obj.mDecoder->restart();
+			frame = nullptr;
+		}
+		if( ! frame )
+			obj.mNumFramesNotReady++;
+		return frame;
+	}
+
+	void MovieGlHap::presentHapFrame( hap::MovieDecoder::Frame *frame, size_t sample )
+	{
+		Obj &obj = *mObj;
+		if( frame->mOffset == obj.mUploadedOffset && frame->mProxy == obj.mUploadedProxy )
+			obj.mNumSkippedUploads++;
+		else if( obj.isUploadingInBackground() ) {
+			// The frame stays acquired until its upload is done
+			obj.beginUpload( frame->mProxy ? *obj.mDecoder->getProxy() : *obj.mDecoder->getReader(), frame->getDxt(), frame->mTextureFormat, sample, frame->mOffset, frame->mProxy, true );
+			obj.mBandFrame = nullptr;
+			return;
+		}
+		else if( frame == obj.mBandFrame && ! obj.mTextureUpdateFunc ) {
+			// Most or all of it went up in bands ahead of time, only the rows still missing go up now
+			const hap::UploadBackend::FrameFormat format = Obj::getFrameFormat( frame->mProxy ? *obj.mDecoder->getProxy() : *obj.mDecoder->getReader(), frame->mTextureFormat );
+			const uint32_t rows = format.getBlocksHigh();
+			if( obj.mBandRow < rows ) {
+				const uint32_t bandRows = static_cast<uint32_t>( ( rows + obj.mUploadBands - 1 ) / obj.mUploadBands );
+				obj.mNumBandsLate += ( rows - obj.mBandRow + bandRows - 1 ) / bandRows;
+				obj.uploadRows( format, frame->getDxt(), obj.mBandRow, rows - obj.mBandRow );
+			}
+			obj.showUpload();
+			obj.mNumUploads++;
+		}
+		else
+			obj.uploadFrame( frame->mProxy ? *obj.mDecoder->getProxy() : *obj.mDecoder->getReader(), frame->getDxt(), frame->mTextureFormat, frame->mProxy );
+
+		obj.mUploadedSample = sample;
+		obj.mUploadedOffset = frame->mOffset;
+		obj.mUploadedProxy = frame->mProxy;
+		obj.mBandFrame = nullptr;
+		obj.mDecoder->releaseFrame();
+		obj.finishSeek();
+	}
+
+	void MovieGlHap::Obj::uploadFrame( const hap::MovieReader &reader, const std::vector<uint8_t> &dxt, uint8_t textureFormat, bool proxy )
+	{
+		const auto start = std::chrono::steady_clock::now();
+		upload( getFrameFormat( reader, textureFormat ), dxt.data(), dxt.size() );
+		mNumUploads++;
+		mUploadTime += std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	}
+
+	void MovieGlHap::Obj::uploadRows( const hap::UploadBackend::FrameFormat &format, const std::vector<uint8_t> &dxt, uint32_t firstRow, uint32_t numRows )
+	{
+		const auto start = std::chrono::steady_clock::now();
+		if( format != mUploadFormat ) {
+			mUploadBackend->create( format );
+			mUploadFormat = format;
+		}
+		mUploadBackend->uploadRows( dxt.data(), dxt.size(), firstRow, numRows );
+		mUploadTime += std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+	}
+
+	void MovieGlHap::Obj::showUpload()
+	{
+		mUploadBackend->fence();
+		if( mUploadBackend == mGlBackend )
+			mTexture = mGlBackend->getTexture();
+	}
+
+	hap::UploadBackend::FrameFormat MovieGlHap::Obj::getFrameFormat( const hap::MovieReader &reader, uint8_t textureFormat )
+	{
+		// Frames decoded from a movie are packed, each row of blocks right after the one before
+		const GLuint width = reader.getWidth(), height = reader.getHeight();
+		return hap::UploadBackend::FrameFormat( width, height, ( width + 3 ) & ~3, ( height + 3 ) & ~3, textureFormat );
+	}
+
+	void MovieGlHap::Obj::beginUpload( const hap::MovieReader &reader, const std::vector<uint8_t> &dxt, uint8_t textureFormat, size_t sample, uint64_t offset, bool proxy, bool holdsFrame )
+	{
+		const hap::UploadBackend::FrameFormat format = getFrameFormat( reader, textureFormat );
+		const bool create = format != mUploadFormat;
+		mUploadFormat = format;
+
+		// Only create() and upload() run on the upload thread. fence() stays here, where the draws it fences are issued.
+		const hap::UploadBackendRef backend = mUploadBackend;
+		const uint8_t *data = dxt.data();
+		const size_t size = dxt.size();
+		mUpload = mUploadThread->submit( [=] {
+			if( create )
+				backend->create( format );
+			backend->upload( data, size );
+		} );
+		mUploadSample = sample;
+		mUploadOffset = offset;
+		mUploadProxy = proxy;
+		mUploadHoldsFrame = holdsFrame;
+	}
+
+	bool MovieGlHap::Obj::completeUpload( bool wait )
+	{
+		if( wait )
+			mUploadThread->wait( mUpload );
+		else if( ! mUploadThread->finish( mUpload ) )
+			return false;
+
+		showUpload();
+		if( mUploadHoldsFrame )
+			mDecoder->releaseFrame();
+		mNumUploads++;
+		mUploadTime += mUpload->getSeconds();
+
+		mUploadedSample = mUploadSample;
+		mUploadedOffset = mUploadOffset;
+		mUploadedProxy = mUploadProxy;
+		mUpload.reset();
+		mUploadData.reset();
+		mUploadHoldsFrame = false;
+		finishSeek();
+		return true;
+	}
+
+	void MovieGlHap::Obj::finishSeek()
+	{
+		if( mSeekTime < 0 || mUploadedSample != mSeekSample )
+			return;
+
+		const double latency = app::getElapsedSeconds() - mSeekTime;
+		mSeekLatencySum += latency;
+		mMaxSeekLatency = std::max( mMaxSeekLatency, latency );
+		mNumSeeksShown++;
+		mSeekTime = -1;
+	}
+
+	void MovieGlHap::Obj::startSeek()
+	{
+		if( mSeekTime >= 0 )
+			mNumSeeksSuperseded++;
+		mSeekTime = app::getElapsedSeconds();
+		mSeekSample = SIZE_MAX;
+		// Pick the frame on the next update even if it's for a refresh already picked for
+		mSelectedScanOutTime = -1;
+	}
+
+	void MovieGlHap::seekToTime( float seconds )
+	{
+		MovieBase::seekToTime( seconds );
+		if( mObj->mDecoder )
+			mObj->startSeek();
+	}
+
+	void MovieGlHap::seekToFrame( int frame )
+	{
+		MovieBase::seekToFrame( frame );
+		if( mObj->mDecoder )
+			mObj->startSeek();
+	}
+
+	bool MovieGlHap::setProxy( const fs::path &path )
+	{
+		if( ! mObj->mDecoder )
+			return false;
+
+		hap::MovieReaderRef proxy;
+		try {
+			proxy = hap::MovieReader::create( path );
+		}
+		catch( const std::exception &exc ) {
+			CI_LOG_E( "HAP ERROR :: couldn't open proxy " << path << ": " << exc.what() );
+			return false;
+		}
+		const hap::MovieReader &reader = *mObj->mSampleReader;
+		if( proxy->getCodec() != reader.getCodec() || proxy->getNumSamples() != reader.getNumSamples() ) {
+			CI_LOG_E( "HAP ERROR :: proxy " << path << " doesn't match the movie's codec and samples" );
+			return false;
+		}
+
+		mObj->mDecoder->setProxy( proxy );
+		// Frames of the previous proxy can't be uploaded to a texture of this one's size
+		mObj->mDecoder->restart();
+		return true;
+	}
+
+	void MovieGlHap::setUseProxy( bool use )
+	{
+		if( mObj->mDecoder )
+			mObj->mDecoder->useProxy( use );
+	}
+
+	void MovieGlHap::setFrameStep( int step )
+	{
+		if( mObj->mDecoder )
+			mObj->mDecoder->setFrameStep( step );
+	}
+
+	void MovieGlHap::setSuspended( bool suspended )
+	{
+		if( mObj->mDecoder )
+			mObj->mDecoder->setSuspended( suspended );
+	}
+
+	void MovieGlHap::setScrubbing( bool scrubbing )
+	{
+		if( mObj->mDecoder )
+			mObj->mDecoder->setScrubbing( scrubbing );
+	}
+
+	void MovieGlHap::setUploadBackend( const hap::UploadBackendRef &backend )
+	{
+		const hap::UploadBackendRef next = backend ? backend : mObj->mGlBackend;
+		if( next == mObj->mUploadBackend )
+			return;
+
+		mObj->waitForUpload();
+		mObj->lock();
+		mObj->mUploadBackend->release();
+		mObj->mUploadBackend = next;
+		mObj->mUploadFormat = hap::UploadBackend::FrameFormat();
+		mObj->mBandFrame = nullptr;
+		mObj->mTexture.reset();
+		// Upload the frame on screen again to the new backend
+		mObj->mUploadedSample = SIZE_MAX;
+		mObj->mUploadedOffset = UINT64_MAX;
+		mObj->unlock();
+	}
+
+	void MovieGlHap::setBackgroundUpload( bool enable )
+	{
+		if( enable == ( mObj->mUploadThread != nullptr ) )
+			return;
+
+		mObj->waitForUpload();
+		mObj->mUploadThread = enable ? hap::UploadThread::get() : nullptr;
+	}
+
+	void MovieGlHap::setScanOutTime( double seconds )
+	{
+		mObj->mScanOutTime = seconds;
+	}
+
+	void MovieGlHap::setPresentationPolicy( hap::PresentationClock::Policy policy )
+	{
+		mObj->mPresentationPolicy = policy;
+		if( mObj->mClock )
+			mObj->mClock->setPolicy( policy );
+	}
+
+	void MovieGlHap::setPinned( bool pinned )
+	{
+		if( ! mObj->mSampleReader || pinned == mObj->mPinned )
+			return;
+
+		if( pinned )
+			hap::SampleCache::get()->pin( mObj->mSampleReader->getFilePath() );
+		else
+			hap::SampleCache::get()->unpin( mObj->mSampleReader->getFilePath() );
+		mObj->mPinned = pinned;
+	}
+
+	bool MovieGlHap::setCacheDecodedFrames( bool cache )
+	{
+		if( ! mObj->mDecoder )
+			return false;
+		if( cache == isCachingDecodedFrames() )
+			return true;
+
+		hap::DecodedFrameCacheRef decodedCache;
+		if( cache ) {
+			decodedCache = hap::DecodedFrameCache::create( mObj->mSampleReader );
+			if( ! decodedCache )
+				return false;
+		}
+		mObj->mDecoder->setDecodedFrameCache( decodedCache );
+		return true;
+	}
+
+	MovieGlHap::Stats MovieGlHap::getStats() const
+	{
+		Stats stats;
+		if( mObj->mDecoder ) {
+			stats.mDecoder = mObj->mDecoder->getStats();
+			stats.mPresentation = mObj->mClock->getStats();
+			if( hap::DecodedFrameCacheRef decodedCache = mObj->mDecoder->getDecodedFrameCache() )
+				stats.mDecodedCacheBytes = decodedCache->getBytes();
+		}
+		stats.mFramesUploaded = mObj->mNumUploads;
+		stats.mSkippedUploads = mObj->mNumSkippedUploads;
+		stats.mFramesNotReady = mObj->mNumFramesNotReady;
+		stats.mApproximateFrames = mObj->mNumApproximateFrames;
+		stats.mUploadTime = mObj->mUploadTime;
+		stats.mLateUploads = mObj->mNumLateUploads;
+		stats.mBandsAhead = mObj->mNumBandsAhead;
+		stats.mBandsLate = mObj->mNumBandsLate;
+		stats.mUpload = mObj->mUploadBackend->getStats();
+		stats.mTextureWaits = mObj->mGlBackend->getNumTextureWaits();
+		stats.mPixelBuffers = mObj->mGlBackend->getPixelBufferStats();
+		stats.mSeeksShown = mObj->mNumSeeksShown;
+		stats.mSeeksSuperseded = mObj->mNumSeeksSuperseded;
+		stats.mAverageSeekLatency = mObj->mNumSeeksShown ? mObj->mSeekLatencySum / mObj->mNumSeeksShown : 0;
+		stats.mMaxSeekLatency = mObj->mMaxSeekLatency;
+		return stats;
+	}
 	
 //#if defined( CINDER_MAC )
 //	static void CVOpenGLTextureDealloc( gl::Texture *texture, void *refcon )
@@ -235,7 +721,7 @@ namespace cinder { namespace qtime {
 			
 			CI_ASSERT( cvImage != nullptr );
 			
-			// Check the buffer padding
+			// Check the buffer padding. Only the blocks covering the picture are uploaded, whatever the padding.
 			size_t extraRight, extraBottom;
 			::CVPixelBufferGetExtendedPixels( cvImage, nullptr, &extraRight, nullptr, &extraBottom );
 			GLuint roundedWidth = width + extraRight;
@@ -244,16 +730,19 @@ namespace cinder { namespace qtime {
 			// Valid DXT will be a multiple of 4 wide and high
 			CI_ASSERT( !(roundedWidth % 4 != 0 || roundedHeight % 4 != 0) );
 			OSType newPixelFormat = ::CVPixelBufferGetPixelFormatType( cvImage );
-			GLenum internalFormat;
+			uint8_t textureFormat;
 			unsigned int bitsPerPixel;
 			switch (newPixelFormat) {
 				case kHapPixelFormatTypeRGB_DXT1:
-					internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+					textureFormat = hap::SectionType::TEXTURE_RGB_DXT1;
 					bitsPerPixel = 4;
 					break;
 				case kHapPixelFormatTypeRGBA_DXT5:
+					textureFormat = hap::SectionType::TEXTURE_RGBA_DXT5;
+					bitsPerPixel = 8;
+					break;
 				case kHapPixelFormatTypeYCoCg_DXT5:
-					internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+					textureFormat = hap::SectionType::TEXTURE_YCOCG_DXT5;
 					bitsPerPixel = 8;
 					break;
 				default:
@@ -272,67 +761,36 @@ namespace cinder { namespace qtime {
 			
 			GLvoid *baseAddress = ::CVPixelBufferGetBaseAddress( cvImage );
 
-      if (mTextureUpdateFunc)
-      {
-        // Otherwise won't fit into the texture
-        // Will need to make a better texture creation logic for this case
-        assert(extraRight == 0 && extraBottom == 0);
-
-        mTextureUpdateFunc(roundedWidth, roundedHeight, dataLength, baseAddress);
-      }
-			else 
-      {
-        if (!mTexture)
-        {
-          // On NVIDIA hardware there is a massive slowdown if DXT textures aren't POT-dimensioned, so we use POT-dimensioned backing
-          GLuint backingWidth = 1;
-          while (backingWidth < roundedWidth) backingWidth <<= 1;
-
-          GLuint backingHeight = 1;
-          while (backingHeight < roundedHeight) backingHeight <<= 1;
-
-          // We allocate the texture with no pixel data, then use CompressedTexSubImage to update the content region
-          gl::Texture2d::Format format;
-          format.wrap(GL_CLAMP_TO_EDGE).magFilter(GL_LINEAR).minFilter(GL_LINEAR).internalFormat(internalFormat).dataType(GL_UNSIGNED_INT_8_8_8_8_REV).immutableStorage();// .pixelDataFormat( GL_BGRA );
-          mTexture = gl::Texture2d::create(backingWidth, backingHeight, format);
-          mTexture->setCleanBounds(Area(0, 0, width, height));
-
-          //CI_LOG_I("Created texture.");
-
-#if defined( CINDER_MAC )
-          /// There is no default format GL_TEXTURE_STORAGE_HINT_APPLE param so we fill it manually
-          gl::ScopedTextureBind bind( mTexture->getTarget(), mTexture->getId() );
-          glTexParameteri( mTexture->getTarget(), GL_TEXTURE_STORAGE_HINT_APPLE, GL_STORAGE_SHARED_APPLE );
-#endif
-        }
-
-        gl::ScopedTextureBind bind( mTexture );
-#if defined( CINDER_MAC )
-			  glTextureRangeAPPLE( mTexture->getTarget(), dataLength, baseAddress );
-			  /* WARNING: Even though it is present here:
-			   * https://github.com/Vidvox/hap-quicktime-playback-demo/blob/master/HapQuickTimePlayback/HapPixelBufferTexture.m#L186
-			   * the following call does not appear necessary. Furthermore, it corrupts display
-			   * when movies are loaded more than once
-			   */
-  //			glPixelStorei( GL_UNPACK_CLIENT_STORAGE_APPLE, 1 );
-#endif
-        auto internalFormat = mTexture->getInternalFormat();
-			  glCompressedTexSubImage2D(mTexture->getTarget(),
-									                0,
-									                0,
-									                0,
-									                roundedWidth,
-									                roundedHeight,
-									                mTexture->getInternalFormat(),
-									                dataLength,
-									                baseAddress);
-        }
+			upload( hap::UploadBackend::FrameFormat( width, height, roundedWidth, roundedHeight, textureFormat ), static_cast<const uint8_t*>( baseAddress ), dataLength );
 		}
 		
 		::CVPixelBufferUnlockBaseAddress( cvImage, kCVPixelBufferLock_ReadOnly );
 		::CVPixelBufferRelease(cvImage);
 	}
 
+	void MovieGlHap::Obj::upload( const hap::UploadBackend::FrameFormat &format, const uint8_t *dxt, size_t size )
+	{
+		if( mTextureUpdateFunc ) {
+			// The callback's texture is the picture size rounded to 4 and it takes no row pitch, so padded rows are packed
+			const size_t rowBytes = format.getRowBytes(), rowPitch = format.getRowPitch(), rows = format.getBlocksHigh();
+			if( rowPitch != rowBytes ) {
+				mPackedFrame.resize( rowBytes * rows );
+				for( size_t row = 0; row < rows; row++ )
+					std::memcpy( &mPackedFrame[row * rowBytes], dxt + row * rowPitch, rowBytes );
+				dxt = mPackedFrame.data();
+			}
+			mTextureUpdateFunc( format.getBlocksWide() * 4, format.getBlocksHigh() * 4, static_cast<uint32_t>( rowBytes * rows ), const_cast<uint8_t*>( dxt ) );
+			return;
+		}
+
+		if( format != mUploadFormat ) {
+			mUploadBackend->create( format );
+			mUploadFormat = format;
+		}
+		mUploadBackend->upload( dxt, size );
+		showUpload();
+	}
+
   MovieBase::Obj* MovieGlHap::getObj() const
 	{
 	  return mObj.get();
@@ -340,6 +798,13 @@ namespace cinder { namespace qtime {
 
   gl::TextureRef MovieGlHap::getTexture()
 	{
+		// The background decoder only ever touches the texture from this thread, so there's nothing to lock
+		if( mObj->mDecoder ) {
+			if( ! mObj->mSynced )
+				updateHapFrame();
+			return mObj->mTexture;
+		}
+
 		updateFrame();
 		
 		mObj->lock();
@@ -351,12 +816,16 @@ namespace cinder { namespace qtime {
 	
 	gl::GlslProgRef MovieGlHap::getGlsl() const
 	{
-		return isHapQ() ? MovieGlHap::Obj::sHapQShader : mObj->mDefaultShader;
+		return mObj->getShaders()->getGlsl( isHapQ() ? hap::ShaderCache::Variant::HAP_Q : hap::ShaderCache::Variant::PLAIN );
 	}
 	
 	void MovieGlHap::draw()
 	{
-		updateFrame();
+		const bool locked = ! mObj->mDecoder;
+		if( locked )
+			updateFrame();
+		else if( ! mObj->mSynced )
+			updateHapFrame();
 		
     //gl::disableAlphaBlending();
 
@@ -364,43 +833,18 @@ namespace cinder { namespace qtime {
     //gl::drawSolidRect(Rectf(0, 0, getWidth(), getHeight()), vec2(0, 0));
     //return;
 
-		mObj->lock();
+		if( locked )
+			mObj->lock();
 		if (mObj->mTexture)
     {
 			Rectf centeredRect = Rectf(mObj->mTexture->getBounds()).getCenteredFit(app::getWindowBounds(), true);
 			gl::color(Color::white());
 			
-			auto drawRect = [&]()
-      {
-				gl::ScopedTextureBind tex(mObj->mTexture);
-				float cw = static_cast<float>(mObj->mTexture->getActualWidth());
-        float ch = static_cast<float>(mObj->mTexture->getActualHeight());
-        float w  = static_cast<float>(mObj->mTexture->getWidth());
-        float h  = static_cast<float>(mObj->mTexture->getHeight());
-				//gl::drawSolidRect(centeredRect , vec2(0, 0), vec2(cw / w, ch / h) );
-
-        // No tex coords here?
-				gl::drawSolidRect(centeredRect, vec2(0, 0), vec2(w / cw, h / ch));
-        //gl::drawSolidRect(Rectf(0, 0, getWidth(), getHeight()), vec2(0, 0));
-			};
-			
-			if (isHapQ()) 
-      {
-        //mObj->mFullscreenQuadHapQBatch->draw();
-
-				gl::ScopedGlslProg bind(MovieGlHap::Obj::sHapQShader);
-				drawRect();
-			}
-      else
-      {
-        //gl::draw(mObj->mTexture, Rectf(0, 0, getWidth(), getHeight()));
-        
-        //gl::ScopedTextureBind tex(mObj->mTexture);
-        //mObj->mFullscreenQuadDefaultBatch->draw();
-
-				gl::ScopedGlslProg bind(mObj->mDefaultShader);
-				drawRect();
-			}
+			float cw = static_cast<float>(mObj->mTexture->getActualWidth());
+			float ch = static_cast<float>(mObj->mTexture->getActualHeight());
+			float w  = static_cast<float>(mObj->mTexture->getWidth());
+			float h  = static_cast<float>(mObj->mTexture->getHeight());
+			mObj->getShaders()->draw( isHapQ() ? hap::ShaderCache::Variant::HAP_Q : hap::ShaderCache::Variant::PLAIN, mObj->mTexture, centeredRect, vec2(0, 0), vec2(w / cw, h / ch) );
 		}
     else
     {
@@ -408,6 +852,7 @@ namespace cinder { namespace qtime {
       gl::color(Color(0.0f, 1.0f, 0.0f));;
       gl::drawSolidRect(app::getWindowBounds(), vec2(0, 0));
     }
-		mObj->unlock();
+		if( locked )
+			mObj->unlock();
 	}
 } } //namespace cinder::qtime
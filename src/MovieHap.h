@@ -11,7 +11,6 @@
 #include "cinder/gl/gl.h"
 #include "cinder/gl/GlslProg.h"
 #include "cinder/gl/Texture.h"
-#include "cinder/gl/Batch.h"
 
 #if defined( CINDER_MSW )
 #define _STDINT_H
@@ -19,6 +18,12 @@
 #endif
 #include "cinder/qtime/QuicktimeGl.h"
 
+#include "HapMovieDecoder.h"
+#include "HapGlUploadBackend.h"
+#include "HapPresentationClock.h"
+#include "HapUploadThread.h"
+#include "HapShaderCache.h"
+
 
 typedef std::function<void(uint32_t width, uint32_t height, uint32_t dataLength, void* baseAddress)> TextureUpdateFunc;
 
@@ -30,9 +35,46 @@ namespace cinder { namespace qtime {
 	class MovieGlHap : public MovieBase {
 	public:
 		enum class Codec { HAP, HAP_A, HAP_Q, UNSUPPORTED };
+
+		struct Stats {
+			Stats() : mFramesUploaded( 0 ), mSkippedUploads( 0 ), mFramesNotReady( 0 ), mDecodedCacheBytes( 0 ),
+				mApproximateFrames( 0 ), mSeeksShown( 0 ), mSeeksSuperseded( 0 ), mAverageSeekLatency( 0 ), mMaxSeekLatency( 0 ), mUploadTime( 0 ), mLateUploads( 0 ), mBandsAhead( 0 ), mBandsLate( 0 ), mTextureWaits( 0 ) {}
+
+			//! Counters of the background decoder and of the frames picked for each refresh. All zero when QuickTime
+			//! decodes the movie.
+			hap::MovieDecoder::Stats		mDecoder;
+			hap::PresentationClock::Stats	mPresentation;
+			uint32_t					mFramesUploaded;
+			//! New frames that weren't uploaded because they're stored at the same offset as the frame on screen
+			uint32_t					mSkippedUploads;
+			//! Times the frame due on screen hadn't been decoded yet, so the previous one was shown again
+			uint32_t					mFramesNotReady;
+			//! Decoded frames held for this movie by setCacheDecodedFrames()
+			size_t						mDecodedCacheBytes;
+			//! Frames shown while scrubbing because they were the closest decoded to a frame that wasn't ready
+			uint32_t					mApproximateFrames;
+			//! Calls to seekToTime() or seekToFrame() whose frame has been uploaded, and those followed by another seek first
+			uint32_t					mSeeksShown, mSeeksSuperseded;
+			//! Seconds from seekToTime() or seekToFrame() until the frame sought was uploaded
+			double						mAverageSeekLatency, mMaxSeekLatency;
+			//! Seconds spent uploading frames, in total, on the upload thread while uploading in the background
+			double						mUploadTime;
+			//! Refreshes that kept the frame before because the one uploading in the background wasn't done
+			uint32_t					mLateUploads;
+			//! Bands uploaded ahead of their frame, and bands still missing when it was due, which went up then
+			uint32_t					mBandsAhead, mBandsLate;
+			//! Frames sent to the upload backend in use
+			hap::UploadBackend::Stats	mUpload;
+			//! Uploads to a texture that draws still in flight may sample, because every other one was in use too
+			uint32_t					mTextureWaits;
+			//! Uploads staged in pixel buffers, all zero if setPixelBufferUpload() is off
+			hap::PixelBufferRing::Stats	mPixelBuffers;
+		};
 		
 		~MovieGlHap();
 		MovieGlHap( const fs::path &path );
+		//! Plays \a path with a decoder that has already been started on it, as hap::MovieDecoder::create( hap::MovieReader::create( path ) )
+		MovieGlHap( const fs::path &path, const hap::MovieDecoderRef &decoder );
 		MovieGlHap( const class MovieLoader &loader );
 		MovieGlHap( const void *data, size_t dataSize, const std::string &fileNameHint, const std::string &mimeTypeHint = "" );
 		MovieGlHap( DataSourceRef dataSource, const std::string mimeTypeHint = "" );
@@ -50,29 +92,192 @@ namespace cinder { namespace qtime {
 		
 		const Codec&	getCodecName() const { return mCodec; }
 		float			getPlaybackFramerate() const;
+		//! Number of new frames that weren't uploaded because they're stored at the same offset as the frame on screen
+		uint32_t		getNumSkippedUploads() const { return mObj->mNumSkippedUploads; }
+		Stats			getStats() const;
+		//! True when frames are read and decoded by the block on a background thread rather than by QuickTime
+		bool			isDecodingInBackground() const { return mObj->mDecoder != nullptr; }
+
+		//! Same as MovieBase::setLoop(), the background decoder needs to know which way to read ahead
+		void			setLoop( bool loop = true, bool palindrome = false );
+		//! Same as MovieBase::seekToTime(), the frame sought is picked right away and the time until it's shown is measured
+		void			seekToTime( float seconds );
+		void			seekToFrame( int frame );
+		//! For dragging a timeline. Only the frame sought is decoded and decodes for frames sought earlier are abandoned.
+		//! Until it's ready the closest frame already decoded is shown, if the movie caches its decoded frames.
+		void			setScrubbing( bool scrubbing = true );
+		//! Frames are uploaded to \a count textures in turn, so an upload never overwrites the texture that draws
+		//! still queued on the GPU sample. getTexture() returns the one uploaded last. Defaults to 3, 1 reuses one texture.
+		void			setNumTextures( size_t count ) { mObj->waitForUpload(); mObj->mGlBackend->setNumTextures( count ); }
+		size_t			getNumTextures() const { return mObj->mGlBackend->getNumTextures(); }
+		//! Stages frames in a ring of pixel buffers so uploads are copied to the texture by the GPU asynchronously
+		//! rather than by the driver during the upload call. On by default. Call it from the thread that draws.
+		void			setPixelBufferUpload( bool enable = true ) { mObj->waitForUpload(); mObj->mGlBackend->setPixelBufferUpload( enable ); }
+		bool			isUsingPixelBufferUpload() const { return mObj->mGlBackend->isUsingPixelBufferUpload(); }
+		//! Rounds texture sizes up to powers of two, as some NVIDIA drivers need for fast DXT sampling. On by default.
+		//! Turn it off for odd sized movies like LED canvases, whose textures are then only rounded to 4.
+		void			setPowerOfTwoTextures( bool enable = true ) { mObj->waitForUpload(); mObj->mGlBackend->setPowerOfTwoTextures( enable ); }
+		bool			isUsingPowerOfTwoTextures() const { return mObj->mGlBackend->isUsingPowerOfTwoTextures(); }
+		//! Uploads only the rows of blocks that changed since the frame last uploaded to the same texture, found by
+		//! hashing each row. Saves most of the bandwidth on mostly static content like signage, at the cost of a pass
+		//! over every frame. Off by default. getStats().mUpload.mSkippedBytes counts the bytes saved.
+		void			setDeltaUpload( bool enable = true ) { mObj->waitForUpload(); mObj->mGlBackend->setDeltaUpload( enable ); }
+		bool			isUsingDeltaUpload() const { return mObj->mGlBackend->isUsingDeltaUpload(); }
+		//! Sends frames to \a backend rather than to the movie's textures, nullptr going back to them. getTexture()
+		//! returns nullptr meanwhile. Call it from the thread that draws.
+		void			setUploadBackend( const hap::UploadBackendRef &backend );
+		const hap::UploadBackendRef&	getUploadBackend() const { return mObj->mUploadBackend; }
+		//! Uploads frames on the shared hap::UploadThread rather than on the render thread. A frame shows on the first
+		//! update after its upload is done, so frames are picked one refresh ahead. Movies in a MovieGlHapSyncGroup,
+		//! and movies with a texture update callback, still upload on the render thread. Call it from the thread that
+		//! draws, with its context current.
+		void			setBackgroundUpload( bool enable = true );
+		bool			isUploadingInBackground() const { return mObj->mUploadThread != nullptr; }
+		//! Splits each frame's upload into \a count bands of block rows, for frames too large to upload in one go
+		//! without a stall. While the frame on screen stays up, each update uploads a band of the next frame decoded,
+		//! so it's mostly or wholly on the GPU by the time it's due and appears with no extra latency. Bands still
+		//! missing then go up at once. 1, the default, uploads each frame whole when it's due. Doesn't apply while
+		//! uploading in the background, in a sync group, through a texture update callback or to a single texture.
+		void			setUploadBands( size_t count );
+		size_t			getUploadBands() const { return mObj->mUploadBands; }
+		//! Uploads one more band of the next frame now, for calling between render passes so bands go up interleaved
+		//! with other work. Returns false if there's nothing to upload.
+		bool			uploadBand();
+		bool			isScrubbing() const { return mObj->mDecoder && mObj->mDecoder->isScrubbing(); }
+		//! A smaller encode of the same movie, with the same codec and frames, to decode while setUseProxy() is on.
+		//! Returns false if it doesn't match. Proxy frames are uploaded to a texture of their own size.
+		bool			setProxy( const fs::path &path );
+		bool			hasProxy() const { return mObj->mDecoder && mObj->mDecoder->getProxy(); }
+		void			setUseProxy( bool use = true );
+		bool			isUsingProxy() const { return mObj->mDecoder && mObj->mDecoder->isUsingProxy(); }
+		//! Decodes and shows only every \a step-th frame, each held until the next. 1 shows every frame.
+		void			setFrameStep( int step );
+		int				getFrameStep() const { return mObj->mDecoder ? mObj->mDecoder->getFrameStep() : 1; }
+		//! Stops decoding and holds the frame on screen. The movie's clock keeps running.
+		void			setSuspended( bool suspended = true );
+		bool			isSuspended() const { return mObj->mDecoder && mObj->mDecoder->isSuspended(); }
+		//! Predicted time, on the app::getElapsedSeconds() clock, at which the frame being rendered reaches the display.
+		//! Call it every frame before getTexture() or draw() so frames are picked for that moment rather than for now.
+		//! Without it, every getTexture() or draw() call counts as a display refresh.
+		void			setScanOutTime( double seconds );
+		//! How frames are picked when the display and movie frame rates differ. Defaults to NEAREST.
+		void			setPresentationPolicy( hap::PresentationClock::Policy policy );
+		//! Keeps every encoded frame in memory once it has been read, outside the budget of hap::SampleCache.
+		//! Meant for short loops, which then stop reading from disk after their first pass.
+		void			setPinned( bool pinned = true );
+		bool			isPinned() const { return mObj->mPinned; }
+		//! Keeps every decoded frame in memory, so each frame is only decoded on the loop's first pass. The whole movie
+		//! is cached or nothing: returns false if its decoded size doesn't fit in the budget of hap::DecodedFrameCache.
+		bool			setCacheDecodedFrames( bool cache = true );
+		bool			isCachingDecodedFrames() const { return mObj->mDecoder && mObj->mDecoder->getDecodedFrameCache(); }
 		
 		static MovieGlHapRef create( const fs::path &path ) { return MovieGlHapRef( new MovieGlHap( path ) ); }
+		static MovieGlHapRef create( const fs::path &path, const hap::MovieDecoderRef &decoder ) { return MovieGlHapRef( new MovieGlHap( path, decoder ) ); }
 		static MovieGlHapRef create( const MovieLoaderRef &loader );
 		static MovieGlHapRef create( const void *data, size_t dataSize, const std::string &fileNameHint, const std::string &mimeTypeHint = "" )
 		{ return MovieGlHapRef( new MovieGlHap( data, dataSize, fileNameHint, mimeTypeHint ) ); }
 		static MovieGlHapRef create( DataSourceRef dataSource, const std::string mimeTypeHint = "" )
 		{ return MovieGlHapRef( new MovieGlHap( dataSource, mimeTypeHint ) ); }
 	protected:
+		friend class MovieGlHapSyncGroup;
+		friend class MovieGlHapCueBank;
 		
 		void allocateVisualContext();
+		//! Reads the movie's sample table and starts the background decoder, unless \a decoder has been started
+		//! already. Movies not backed by a file keep being decoded by QuickTime.
+		void openSampleReader( const fs::path &path, const hap::MovieDecoderRef &decoder = nullptr );
+		//! Advances QuickTime's clock and uploads the decoded frame for the current movie time, if it's ready
+		void updateHapFrame();
+		//! Returns the decoded frame for \a sample if it's ready to upload, counting it as not ready otherwise
+		hap::MovieDecoder::Frame*	acquireHapFrame( size_t sample );
+		//! Uploads a frame returned by acquireHapFrame(), unless it's the one on screen already, and releases it
+		void presentHapFrame( hap::MovieDecoder::Frame *frame, size_t sample );
 
 		struct Obj : public MovieBase::Obj {
 			Obj();
 			~Obj();
 		  void		releaseFrame() override;
 		  void		newFrame( CVImageBufferRef cvImage ) override;
+			//! Hands a frame to the upload backend and makes it the one shown, or to mTextureUpdateFunc if it's set
+			void		upload( const hap::UploadBackend::FrameFormat &format, const uint8_t *dxt, size_t size );
+			//! Hands rows of a frame to the upload backend, timing the upload
+			void		uploadRows( const hap::UploadBackend::FrameFormat &format, const std::vector<uint8_t> &dxt, uint32_t firstRow, uint32_t numRows );
+			//! Shows the frame the upload backend has taken last
+			void		showUpload();
+			//! Format of the frames \a reader decodes
+			static hap::UploadBackend::FrameFormat	getFrameFormat( const hap::MovieReader &reader, uint8_t textureFormat );
+			//! Uploads a frame decoded by the background decoder
+			void		uploadFrame( const hap::MovieReader &reader, const std::vector<uint8_t> &dxt, uint8_t textureFormat, bool proxy );
+			//! True if the next frame goes to mUploadThread
+			bool		isUploadingInBackground() const { return mUploadThread && ! mTextureUpdateFunc && ! mSynced; }
+			//! Starts uploading a frame on mUploadThread. \a dxt must stay valid until completeUpload(), which shows it.
+			void		beginUpload( const hap::MovieReader &reader, const std::vector<uint8_t> &dxt, uint8_t textureFormat, size_t sample, uint64_t offset, bool proxy, bool holdsFrame );
+			//! Shows the frame uploaded in the background, releasing the decoder's frame if it was held for the upload.
+			//! Returns false if the upload isn't done, unless \a wait is set.
+			bool		completeUpload( bool wait );
+			//! Shows the frame uploading in the background, if there is one, once it's done
+			void		waitForUpload() { if( mUpload ) completeUpload( true ); }
+			//! Bands into a single texture would show on screen before the rest of their frame
+			bool		isUploadingInBands() const { return mUploadBands > 1 && ! mUploadThread && ! mTextureUpdateFunc && ! mSynced && ( mUploadBackend != mGlBackend || mGlBackend->getNumTextures() > 1 ); }
+			void		startSeek();
+			//! Records a seek, and the time it took, once the frame it picked has been uploaded
+			void		finishSeek();
       gl::Texture2dRef	mTexture;
       TextureUpdateFunc mTextureUpdateFunc;
-			gl::GlslProgRef		mDefaultShader;
-			static gl::GlslProgRef	sHapQShader;
-      gl::BatchRef      mFullscreenQuadHapQBatch;
-      gl::BatchRef      mFullscreenQuadDefaultBatch;
-			std::once_flag			mHapQOnceFlag;
+			//! Shaders of the context the movie draws in, taken with the first draw
+			const hap::ShaderCacheRef&	getShaders() { if( ! mShaders ) mShaders = hap::ShaderCache::get(); return mShaders; }
+			hap::ShaderCacheRef		mShaders;
+
+			hap::MovieReaderRef		mSampleReader;
+			hap::MovieDecoderRef	mDecoder;
+			hap::PresentationClockRef	mClock;
+			//! Sample picked when the texture was last updated. The frame uploaded is an earlier one if that sample was skipped.
+			size_t					mUploadedSample;
+			uint64_t				mUploadedOffset;
+			bool					mUploadedProxy;
+			//! mTexture is the GL backend's texture while it's the one in use
+			hap::GlUploadBackendRef	mGlBackend;
+			hap::UploadBackendRef	mUploadBackend;
+			//! Format the backend was last created for, all zero before the first frame
+			hap::UploadBackend::FrameFormat	mUploadFormat;
+			//! Padded frames for mTextureUpdateFunc with the padding cut out
+			std::vector<uint8_t>	mPackedFrame;
+			//! Runs the upload backend while uploading in the background, nullptr otherwise
+			hap::UploadThreadRef	mUploadThread;
+			//! The upload running in the background and the frame it's for. Nothing else touches the backend until it's done.
+			hap::UploadThread::JobRef	mUpload;
+			size_t					mUploadSample;
+			uint64_t				mUploadOffset;
+			bool					mUploadProxy;
+			//! The decoder's frame is the one uploading, so it's released once the upload is done
+			bool					mUploadHoldsFrame;
+			//! Holds a frame of the decoded frame cache while it's uploading
+			hap::DecodedFrameCache::DataRef	mUploadData;
+			//! Time between the refreshes frames were picked for, which frames uploaded in the background are picked ahead by
+			double					mLastSelectTime, mRefreshInterval;
+			size_t					mUploadBands;
+			//! Decoded frame going up in bands ahead of time, still in the decoder's ring, and the first row not up yet.
+			//! nullptr if there's none. Its sample and offset tell it from a later frame decoded into the same slot.
+			hap::MovieDecoder::Frame	*mBandFrame;
+			size_t					mBandSample;
+			uint64_t				mBandOffset;
+			uint32_t				mBandRow;
+			//! Sample at QuickTime's movie time on the last update
+			size_t					mMovieSample;
+			int						mDirection;
+			bool					mLoop, mPalindrome;
+			hap::PresentationClock::Policy	mPresentationPolicy;
+			double					mScanOutTime, mSelectedScanOutTime;
+			bool					mPinned;
+			//! Frames are picked and presented by a MovieGlHapSyncGroup rather than by getTexture() and draw()
+			bool					mSynced;
+			uint32_t				mNumUploads, mNumSkippedUploads, mNumFramesNotReady, mNumApproximateFrames, mNumLateUploads, mNumBandsAhead, mNumBandsLate;
+			double					mUploadTime;
+			//! Time of the last seek whose frame hasn't been shown yet, -1 if there's none, and the sample it picked
+			double					mSeekTime;
+			size_t					mSeekSample;
+			uint32_t				mNumSeeksShown, mNumSeeksSuperseded;
+			double					mSeekLatencySum, mMaxSeekLatency;
 		};
 
 		std::unique_ptr<Obj>		mObj;
@@ -0,0 +1,360 @@
+/*
+ *  MovieHapCompositor.cpp
+ *
+ *  Composites several same-size Hap movies in a single draw from texture arrays.
+ *
+ */
+
+#include "MovieHapCompositor.h"
+#include "HapFormat.h"
+
+#include "cinder/Log.h"
+#include "cinder/app/App.h"
+#include "cinder/gl/scoped.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace cinder { namespace qtime {
+
+	namespace {
+		const char *sVertexShader = R"(
+			uniform mat4	ciModelViewProjection;
+
+			in vec4			ciPosition;
+			in vec2			ciTexCoord0;
+
+			out vec2		vTexCoord0;
+
+			void main()
+			{
+				gl_Position = ciModelViewProjection * ciPosition;
+				vTexCoord0 = ciTexCoord0;
+			}
+		)";
+
+		// Layers are blended bottom to top as in the W3C compositing spec, into a premultiplied result
+		const char *sFragmentShader = R"(
+			uniform sampler2DArray	uDxt1Layers, uDxt5Layers;
+			uniform int				uNumLayers;
+			// Bit 0 is set if the layer has a frame, bit 1 if it's in the DXT5 array, bit 2 if it's Hap Q's scaled YCoCg
+			uniform int				uLayerFlags[MAX_LAYERS];
+			uniform float			uLayerOpacity[MAX_LAYERS];
+			uniform int				uLayerBlendMode[MAX_LAYERS];
+
+			in vec2					vTexCoord0;
+
+			out vec4				oColor;
+
+			vec3 blend( vec3 backdrop, vec3 source, int mode )
+			{
+				if( mode == 1 )
+					return min( backdrop + source, vec3( 1.0 ) );
+				if( mode == 2 )
+					return backdrop * source;
+				if( mode == 3 )
+					return backdrop + source - backdrop * source;
+				return source;
+			}
+
+			void main()
+			{
+				vec4 result = vec4( 0.0 );
+				for( int i = 0; i < uNumLayers; i++ ) {
+					int flags = uLayerFlags[i];
+					if( ( flags & 1 ) == 0 )
+						continue;
+
+					vec3 coord = vec3( vTexCoord0, float( i ) );
+					vec4 color = ( flags & 2 ) != 0 ? texture( uDxt5Layers, coord ) : texture( uDxt1Layers, coord );
+					if( ( flags & 4 ) != 0 ) {
+						// As ScaledCoCgYToRGBA.frag
+						color += vec4( -0.50196078431373, -0.50196078431373, 0.0, 0.0 );
+						float scale = ( color.z * ( 255.0 / 8.0 ) ) + 1.0;
+						float co = color.x / scale;
+						float cg = color.y / scale;
+						color = vec4( color.w + co - cg, color.w + cg, color.w - co - cg, 1.0 );
+					}
+
+					float alpha = color.a * uLayerOpacity[i];
+					vec3 backdrop = result.a > 0.0 ? result.rgb / result.a : vec3( 0.0 );
+					vec3 source = ( 1.0 - result.a ) * color.rgb + result.a * blend( backdrop, color.rgb, uLayerBlendMode[i] );
+					result = vec4( alpha * source + ( 1.0 - alpha ) * result.rgb, alpha + ( 1.0 - alpha ) * result.a );
+				}
+				oColor = result;
+			}
+		)";
+	}
+
+	//! Upload backend of one layer. Frames are gathered, packed, in memory, which is all that runs on the upload thread
+	//! when the movie uploads in the background, and copied into the arrays by fence(), once the movie shows them.
+	//! Frames that go up in bands are never seen half done.
+	class MovieGlHapCompositor::Layer : public hap::UploadBackend {
+	  public:
+		Layer( MovieGlHapCompositor *compositor, size_t index, float opacity, BlendMode blendMode )
+		: mCompositor( compositor ), mIndex( index ), mOpacity( opacity ), mBlendMode( blendMode ), mSkipping( false ), mHasFrame( false )
+		{}
+
+		void	create( const FrameFormat &format ) override
+		{
+			mFormat = format;
+			mSkipping = static_cast<int>( format.mWidth ) != mCompositor->mSize.x || static_cast<int>( format.mHeight ) != mCompositor->mSize.y;
+			mStats.mCreates++;
+		}
+
+		void	upload( const uint8_t *dxt, size_t size ) override { uploadRows( dxt, size, 0, mFormat.getBlocksHigh() ); }
+
+		void	uploadRows( const uint8_t *dxt, size_t size, uint32_t firstRow, uint32_t numRows ) override
+		{
+			const size_t rowBytes = mFormat.getRowBytes(), rowPitch = mFormat.getRowPitch();
+			const uint32_t blocksHigh = mFormat.getBlocksHigh();
+			const uint32_t lastRow = std::min( firstRow + numRows, blocksHigh );
+			if( mSkipping || lastRow <= firstRow )
+				return;
+			if( size < ( lastRow - 1 ) * rowPitch + rowBytes ) {
+				CI_LOG_E( "HAP ERROR :: frame of " << size << " bytes is too small for " << mFormat.mRoundedWidth << "x" << mFormat.mRoundedHeight );
+				return;
+			}
+
+			mPending.resize( rowBytes * blocksHigh );
+			for( uint32_t row = firstRow; row < lastRow; row++ )
+				std::memcpy( &mPending[row * rowBytes], dxt + row * rowPitch, rowBytes );
+			mStats.mBytes += ( lastRow - firstRow ) * rowBytes;
+			if( lastRow == blocksHigh )
+				mStats.mUploads++;
+		}
+
+		void	fence() override
+		{
+			if( mSkipping ) {
+				mCompositor->mStats.mSkippedFrames++;
+				return;
+			}
+			// The frame shown stays in mFrame, so it can be copied again into a new array
+			mFrame.swap( mPending );
+			mFrameFormat = mFormat;
+			mHasFrame = true;
+			mCompositor->uploadLayer( *this );
+		}
+
+		void	release() override
+		{
+			std::vector<uint8_t>().swap( mPending );
+			std::vector<uint8_t>().swap( mFrame );
+			mHasFrame = false;
+		}
+
+		Stats	getStats() const override { return mStats; }
+
+		//! Hap Alpha and Hap Q frames go to the DXT5 array
+		bool	isDxt5() const { return mFrameFormat.mTextureFormat != hap::SectionType::TEXTURE_RGB_DXT1; }
+		bool	isYCoCg() const { return mFrameFormat.mTextureFormat == hap::SectionType::TEXTURE_YCOCG_DXT5; }
+
+		MovieGlHapCompositor	*mCompositor;
+		size_t					mIndex;
+		float					mOpacity;
+		BlendMode				mBlendMode;
+		//! Format of the frame being uploaded, and of the one in mFrame
+		FrameFormat				mFormat, mFrameFormat;
+		//! Frames of another size than the compositor's are dropped
+		bool					mSkipping;
+		//! The frame being uploaded, and the one last fenced, with their rows packed
+		std::vector<uint8_t>	mPending, mFrame;
+		bool					mHasFrame;
+		Stats					mStats;
+	};
+
+	MovieGlHapCompositor::MovieGlHapCompositor()
+	: mSize( 0 ), mShaderFailed( false )
+	{
+	}
+
+	MovieGlHapCompositor::~MovieGlHapCompositor()
+	{
+		for( auto &movie : mMovies )
+			movie->setUploadBackend( nullptr );
+	}
+
+	bool MovieGlHapCompositor::add( const MovieGlHapRef &movie, float opacity, BlendMode blendMode )
+	{
+		if( findLayer( movie ) != SIZE_MAX )
+			return true;
+		if( mMovies.size() == MAX_LAYERS ) {
+			CI_LOG_E( "HAP ERROR :: a compositor draws at most " << MAX_LAYERS << " layers" );
+			return false;
+		}
+		const ivec2 size( movie->getWidth(), movie->getHeight() );
+		if( ! mMovies.empty() && size != mSize ) {
+			CI_LOG_E( "HAP ERROR :: a " << size.x << "x" << size.y << " movie can't be composited with " << mSize.x << "x" << mSize.y << " layers" );
+			return false;
+		}
+
+		mSize = size;
+		LayerRef layer( new Layer( this, mLayers.size(), opacity, blendMode ) );
+		mMovies.push_back( movie );
+		mLayers.push_back( layer );
+		// The frame on screen is uploaded again, to the layer, on the movie's next update
+		movie->setUploadBackend( layer );
+		return true;
+	}
+
+	void MovieGlHapCompositor::remove( const MovieGlHapRef &movie )
+	{
+		const size_t index = findLayer( movie );
+		if( index == SIZE_MAX )
+			return;
+
+		movie->setUploadBackend( nullptr );
+		mMovies.erase( mMovies.begin() + index );
+		mLayers.erase( mLayers.begin() + index );
+		if( mLayers.empty() ) {
+			mSize = ivec2( 0 );
+			mArrays[0] = mArrays[1] = TextureArray();
+			mPixelBuffers.reset();
+			return;
+		}
+
+		// The layers above move down one
+		for( size_t i = index; i < mLayers.size(); i++ ) {
+			mLayers[i]->mIndex = i;
+			if( mLayers[i]->mHasFrame )
+				uploadLayer( *mLayers[i] );
+		}
+	}
+
+	void MovieGlHapCompositor::setOpacity( const MovieGlHapRef &movie, float opacity )
+	{
+		const size_t index = findLayer( movie );
+		if( index != SIZE_MAX )
+			mLayers[index]->mOpacity = opacity;
+	}
+
+	float MovieGlHapCompositor::getOpacity( const MovieGlHapRef &movie ) const
+	{
+		const size_t index = findLayer( movie );
+		return index != SIZE_MAX ? mLayers[index]->mOpacity : 0;
+	}
+
+	void MovieGlHapCompositor::setBlendMode( const MovieGlHapRef &movie, BlendMode blendMode )
+	{
+		const size_t index = findLayer( movie );
+		if( index != SIZE_MAX )
+			mLayers[index]->mBlendMode = blendMode;
+	}
+
+	MovieGlHapCompositor::BlendMode MovieGlHapCompositor::getBlendMode( const MovieGlHapRef &movie ) const
+	{
+		const size_t index = findLayer( movie );
+		return index != SIZE_MAX ? mLayers[index]->mBlendMode : BlendMode::NORMAL;
+	}
+
+	void MovieGlHapCompositor::draw()
+	{
+		draw( Rectf( vec2( 0 ), vec2( mSize ) ).getCenteredFit( app::getWindowBounds(), true ) );
+	}
+
+	void MovieGlHapCompositor::draw( const Rectf &bounds )
+	{
+		// Each movie picks its frame, and fences it into the arrays if it's new
+		for( auto &movie : mMovies )
+			movie->getTexture();
+
+		const gl::GlslProgRef &shader = getShader();
+		if( mLayers.empty() || ! shader )
+			return;
+
+		int flags[MAX_LAYERS], blendModes[MAX_LAYERS];
+		float opacities[MAX_LAYERS];
+		bool hasFrame = false;
+		for( size_t i = 0; i < mLayers.size(); i++ ) {
+			const Layer &layer = *mLayers[i];
+			flags[i] = ( layer.mHasFrame ? 1 : 0 ) | ( layer.isDxt5() ? 2 : 0 ) | ( layer.isYCoCg() ? 4 : 0 );
+			blendModes[i] = static_cast<int>( layer.mBlendMode );
+			opacities[i] = layer.mOpacity;
+			hasFrame = hasFrame || layer.mHasFrame;
+		}
+		if( ! hasFrame )
+			return;
+
+		gl::ScopedGlslProg glsl( shader );
+		gl::ScopedTextureBind dxt1( GL_TEXTURE_2D_ARRAY, mArrays[0].mTexture ? mArrays[0].mTexture->getId() : 0, 0 );
+		gl::ScopedTextureBind dxt5( GL_TEXTURE_2D_ARRAY, mArrays[1].mTexture ? mArrays[1].mTexture->getId() : 0, 1 );
+		gl::ScopedBlendPremult blend;
+		shader->uniform( "uDxt1Layers", 0 );
+		shader->uniform( "uDxt5Layers", 1 );
+		shader->uniform( "uNumLayers", static_cast<int>( mLayers.size() ) );
+		shader->uniform( "uLayerFlags", flags, static_cast<int>( mLayers.size() ) );
+		shader->uniform( "uLayerBlendMode", blendModes, static_cast<int>( mLayers.size() ) );
+		shader->uniform( "uLayerOpacity", opacities, static_cast<int>( mLayers.size() ) );
+
+		// The arrays cover the blocks, the picture may end partway through the last ones
+		const vec2 blocksSize( static_cast<float>( ( mSize.x + 3 ) & ~3 ), static_cast<float>( ( mSize.y + 3 ) & ~3 ) );
+		gl::drawSolidRect( bounds, vec2( 0 ), vec2( mSize ) / blocksSize );
+		mStats.mDraws++;
+	}
+
+	size_t MovieGlHapCompositor::findLayer( const MovieGlHapRef &movie ) const
+	{
+		const auto it = std::find( mMovies.begin(), mMovies.end(), movie );
+		return it != mMovies.end() ? static_cast<size_t>( it - mMovies.begin() ) : SIZE_MAX;
+	}
+
+	void MovieGlHapCompositor::uploadLayer( Layer &layer )
+	{
+		TextureArray &array = mArrays[layer.isDxt5() ? 1 : 0];
+		if( ! array.mTexture || array.mTexture->getDepth() < static_cast<GLint>( mLayers.size() ) ) {
+			// Copies this layer's frame along with the others
+			allocateArray( array, layer.isDxt5() ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT );
+			return;
+		}
+		copyLayer( array, layer );
+	}
+
+	void MovieGlHapCompositor::allocateArray( TextureArray &array, GLenum internalFormat )
+	{
+		if( array.mTexture )
+			mStats.mReallocations++;
+
+		gl::Texture3d::Format format;
+		format.target( GL_TEXTURE_2D_ARRAY ).wrap( GL_CLAMP_TO_EDGE ).magFilter( GL_LINEAR ).minFilter( GL_LINEAR ).internalFormat( internalFormat ).immutableStorage();
+		array.mTexture = gl::Texture3d::create( ( mSize.x + 3 ) & ~3, ( mSize.y + 3 ) & ~3, static_cast<GLint>( mLayers.size() ), format );
+		array.mInternalFormat = internalFormat;
+
+		for( const auto &layer : mLayers ) {
+			if( layer->mHasFrame && &mArrays[layer->isDxt5() ? 1 : 0] == &array )
+				copyLayer( array, *layer );
+		}
+	}
+
+	void MovieGlHapCompositor::copyLayer( const TextureArray &array, const Layer &layer )
+	{
+		const GLsizei width = layer.mFrameFormat.getBlocksWide() * 4, height = layer.mFrameFormat.getBlocksHigh() * 4;
+		const size_t size = layer.mFrame.size();
+		if( ! mPixelBuffers )
+			mPixelBuffers = hap::PixelBufferRing::create( size );
+
+		gl::ScopedTextureBind bind( array.mTexture );
+		mPixelBuffers->upload( layer.mFrame.data(), size, [&]( const GLvoid *pixels ) {
+			glCompressedTexSubImage3D( GL_TEXTURE_2D_ARRAY, 0, 0, 0, static_cast<GLint>( layer.mIndex ), width, height, 1, array.mInternalFormat, static_cast<GLsizei>( size ), pixels );
+		} );
+		mStats.mLayerUploads++;
+	}
+
+	const gl::GlslProgRef& MovieGlHapCompositor::getShader()
+	{
+		if( mShader || mShaderFailed )
+			return mShader;
+
+		try {
+			const std::string version = "#version 150\n";
+			const std::string fragment = version + "#define MAX_LAYERS " + std::to_string( MAX_LAYERS ) + "\n" + sFragmentShader;
+			mShader = gl::GlslProg::create( gl::GlslProg::Format().vertex( version + sVertexShader ).fragment( fragment ) );
+		}
+		catch( const gl::GlslProgExc &exc ) {
+			CI_LOG_E( "HAP ERROR :: compositor shader failed to build: " << exc.what() );
+			mShaderFailed = true;
+		}
+		return mShader;
+	}
+
+} } // namespace cinder::qtime
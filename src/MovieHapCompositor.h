@@ -0,0 +1,107 @@
+/*
+ *  MovieHapCompositor.h
+ *
+ *  Composites several same-size Hap movies in a single draw from texture arrays.
+ *
+ */
+#pragma once
+
+#include "MovieHap.h"
+#include "HapPixelBufferRing.h"
+
+#include "cinder/gl/GlslProg.h"
+#include "cinder/gl/Texture.h"
+
+namespace cinder { namespace qtime {
+
+	typedef std::shared_ptr<class MovieGlHapCompositor> MovieGlHapCompositorRef;
+
+	//! Stacks movies of the same size as layers and draws them all with one shader pass. Each layer's frames go to its
+	//! own layer of a texture array, through an upload backend the compositor sets on its movie, rather than to the
+	//! movie's textures. Hap frames share one DXT1 array and Hap Alpha and Hap Q frames a DXT5 one; the shader decodes
+	//! Hap Q's YCoCg per layer, then blends the layers bottom to top with their own opacity and blend mode. A frame
+	//! goes into the array when its movie shows it, staged in a pixel buffer so draws still reading the layer aren't
+	//! waited on. The first layer added sets the size. Call everything from the thread that draws.
+	class MovieGlHapCompositor {
+	  public:
+		enum class BlendMode { NORMAL, ADD, MULTIPLY, SCREEN };
+
+		//! Most layers one compositor draws
+		static const size_t	MAX_LAYERS = 16;
+
+		struct Stats {
+			Stats() : mDraws( 0 ), mLayerUploads( 0 ), mSkippedFrames( 0 ), mReallocations( 0 ) {}
+
+			uint32_t	mDraws;
+			//! Frames copied into a layer of the arrays
+			uint32_t	mLayerUploads;
+			//! Frames dropped because they weren't the compositor's size, as proxy frames aren't
+			uint32_t	mSkippedFrames;
+			//! Times an array was allocated again, with room for more layers
+			uint32_t	mReallocations;
+		};
+
+		static MovieGlHapCompositorRef create() { return MovieGlHapCompositorRef( new MovieGlHapCompositor ); }
+		~MovieGlHapCompositor();
+
+		//! Adds \a movie on top of the layers so far, taking over its upload backend. Returns false, and leaves the
+		//! movie alone, if it isn't the size of the layers already added or there are MAX_LAYERS of them. The movie's
+		//! getTexture() returns nullptr while it's a layer, and frames handed to a texture update callback skip the
+		//! compositor.
+		bool		add( const MovieGlHapRef &movie, float opacity = 1, BlendMode blendMode = BlendMode::NORMAL );
+		//! Gives the movie its own textures back
+		void		remove( const MovieGlHapRef &movie );
+		const std::vector<MovieGlHapRef>&	getMovies() const { return mMovies; }
+
+		void		setOpacity( const MovieGlHapRef &movie, float opacity );
+		float		getOpacity( const MovieGlHapRef &movie ) const;
+		void		setBlendMode( const MovieGlHapRef &movie, BlendMode blendMode );
+		BlendMode	getBlendMode( const MovieGlHapRef &movie ) const;
+
+		//! Size of the layers, zero until the first one is added
+		ivec2		getSize() const { return mSize; }
+
+		//! Updates every layer's movie, as their getTexture() would, then draws the composite fit centered in the window
+		void		draw();
+		//! Updates every layer's movie and draws the composite in \a bounds. The result is premultiplied by its
+		//! alpha and blended over what's drawn already.
+		void		draw( const Rectf &bounds );
+
+		Stats		getStats() const { return mStats; }
+
+	  private:
+		MovieGlHapCompositor();
+
+		class Layer;
+		typedef std::shared_ptr<Layer>	LayerRef;
+
+		//! Array of one internal format, with room for mMovies.size() layers or more
+		struct TextureArray {
+			TextureArray() : mInternalFormat( 0 ) {}
+
+			gl::Texture3dRef	mTexture;
+			GLenum				mInternalFormat;
+		};
+
+		size_t		findLayer( const MovieGlHapRef &movie ) const;
+		//! Called by \a layer's fence(): copies the frame it has just been given into its layer of the arrays
+		void		uploadLayer( Layer &layer );
+		//! Allocates \a array with room for every layer and copies into it the frames of the layers it holds
+		void		allocateArray( TextureArray &array, GLenum internalFormat );
+		void		copyLayer( const TextureArray &array, const Layer &layer );
+		//! Created with the first draw, nullptr if it failed to build
+		const gl::GlslProgRef&	getShader();
+
+		std::vector<MovieGlHapRef>	mMovies;
+		//! In the order of mMovies, bottom to top
+		std::vector<LayerRef>		mLayers;
+		ivec2					mSize;
+		//! DXT1 frames, and DXT5 ones
+		TextureArray			mArrays[2];
+		hap::PixelBufferRingRef	mPixelBuffers;
+		gl::GlslProgRef			mShader;
+		bool					mShaderFailed;
+		Stats					mStats;
+	};
+
+} } // namespace cinder::qtime
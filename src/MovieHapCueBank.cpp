@@ -0,0 +1,111 @@
+/*
+ *  MovieHapCueBank.cpp
+ *
+ *  Opens the next Hap clips in the background so cutting to them never shows an empty frame.
+ *
+ */
+
+#include "MovieHapCueBank.h"
+
+#include "cinder/Log.h"
+
+namespace cinder { namespace qtime {
+
+	void MovieGlHapCueBank::cue( int index, const fs::path &path, bool loop )
+	{
+		// A live movie replaced here keeps playing until the next cut
+		Slot &slot = mSlots[index];
+		slot = Slot();
+		slot.mPath = path;
+		slot.mLoop = loop;
+		// Creating the decoder starts reading ahead from the first frame right away
+		slot.mOpening = std::async( std::launch::async, [path] {
+			return hap::MovieDecoder::create( hap::MovieReader::create( path ) );
+		} );
+	}
+
+	bool MovieGlHapCueBank::isReady( int index ) const
+	{
+		auto it = mSlots.find( index );
+		return it != mSlots.end() && it->second.mReady;
+	}
+
+	void MovieGlHapCueBank::prepare( Slot &slot )
+	{
+		if( slot.mOpening.valid() ) {
+			if( slot.mOpening.wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready )
+				return;
+
+			try {
+				slot.mMovie = MovieGlHap::create( slot.mPath, slot.mOpening.get() );
+				slot.mMovie->setLoop( slot.mLoop );
+			}
+			catch( const std::exception &exc ) {
+				CI_LOG_E( "HAP ERROR :: couldn't cue " << slot.mPath << ": " << exc.what() );
+				slot.mMovie.reset();
+				mStats.mFailedCues++;
+				return;
+			}
+		}
+
+		if( ! slot.mMovie || slot.mReady || slot.mMovie == getLive() )
+			return;
+
+		// Off screen, so nothing but the upload happens. The first frame stays in the texture until the cut.
+		slot.mMovie->getTexture();
+		const MovieGlHap::Obj &obj = *slot.mMovie->mObj;
+		slot.mReady = obj.mClock->getLastSample() != SIZE_MAX && obj.mUploadedSample == obj.mClock->getLastSample();
+	}
+
+	void MovieGlHapCueBank::update()
+	{
+		for( auto &indexSlot : mSlots )
+			prepare( indexSlot.second );
+
+		int index = mPendingCut.load();
+		if( index < 0 )
+			return;
+		// A clip still opening is waited for like one not uploaded yet. Only a slot never cued, or whose open failed, has nothing.
+		auto it = mSlots.find( index );
+		if( it == mSlots.end() || ( ! it->second.mMovie && ! it->second.mOpening.valid() ) ) {
+			CI_LOG_E( "HAP ERROR :: nothing to cut to in slot " << index );
+			mPendingCut.compare_exchange_strong( index, -1 );
+			mPendingSince = 0;
+			return;
+		}
+
+		Slot &slot = it->second;
+		MovieGlHapRef live = getLive();
+		if( slot.mMovie && slot.mMovie == live ) {
+			live->seekToTime( 0 );
+			live->play();
+		}
+		else if( ! slot.mReady ) {
+			if( mPendingSince++ == 0 )
+				mStats.mDelayedCuts++;
+			mStats.mRefreshesWaited++;
+			return;
+		}
+		else {
+			slot.mMovie->play();
+			live = std::atomic_exchange( &mLive, slot.mMovie );
+			mLiveIndex.store( index );
+
+			// The clip cut away from goes back on standby, rewound, unless its slot has been cued with another since
+			if( live ) {
+				live->stop();
+				live->seekToTime( 0 );
+				for( auto &indexSlot : mSlots ) {
+					if( indexSlot.second.mMovie == live )
+						indexSlot.second.mReady = false;
+				}
+			}
+		}
+
+		mStats.mCuts++;
+		mPendingSince = 0;
+		// A cut requested meanwhile is made on the next update
+		mPendingCut.compare_exchange_strong( index, -1 );
+	}
+
+} } // namespace cinder::qtime
@@ -0,0 +1,81 @@
+/*
+ *  MovieHapCueBank.h
+ *
+ *  Opens the next Hap clips in the background so cutting to them never shows an empty frame.
+ *
+ */
+#pragma once
+
+#include "MovieHap.h"
+
+#include <atomic>
+#include <future>
+#include <map>
+
+namespace cinder { namespace qtime {
+
+	typedef std::shared_ptr<class MovieGlHapCueBank> MovieGlHapCueBankRef;
+
+	//! Keeps clips on standby in numbered slots. A cued clip's sample table is read and its first frames decoded on
+	//! other threads, then update() opens it with QuickTime and uploads its first frame while it's still off screen.
+	//! cut() makes it the live movie on the next update(), so the frame after the cut is already the new clip's first.
+	//! A clip that was live goes back on standby, rewound, when another one is cut to.
+	class MovieGlHapCueBank {
+	  public:
+		struct Stats {
+			Stats() : mCuts( 0 ), mDelayedCuts( 0 ), mRefreshesWaited( 0 ), mFailedCues( 0 ) {}
+
+			uint32_t	mCuts;
+			//! Cuts requested before their clip was ready, and the refreshes they waited for it. The live movie keeps
+			//! playing meanwhile.
+			uint32_t	mDelayedCuts, mRefreshesWaited;
+			//! Clips that couldn't be opened
+			uint32_t	mFailedCues;
+		};
+
+		static MovieGlHapCueBankRef create() { return MovieGlHapCueBankRef( new MovieGlHapCueBank ); }
+
+		//! Main thread: starts opening \a path in slot \a index, replacing whatever was cued there. Replacing a
+		//! clip that's still being opened, or destroying the bank, waits until it's open.
+		void		cue( int index, const fs::path &path, bool loop = true );
+		//! Main thread: true once the clip in slot \a index can be cut to without a gap
+		bool		isReady( int index ) const;
+		//! Any thread: cuts to slot \a index on the next update() that finds it ready. Cutting to the live slot
+		//! restarts its clip.
+		void		cut( int index ) { mPendingCut.store( index ); }
+
+		//! Main thread, once per refresh before drawing: brings cued clips up and makes a pending cut
+		void		update();
+
+		//! Any thread: the movie on screen, nullptr before the first cut
+		MovieGlHapRef	getLive() const { return std::atomic_load( &mLive ); }
+		int				getLiveIndex() const { return mLiveIndex.load(); }
+		Stats			getStats() const { return mStats; }
+
+	  private:
+		MovieGlHapCueBank() : mPendingCut( -1 ), mLiveIndex( -1 ), mPendingSince( 0 ) {}
+
+		struct Slot {
+			Slot() : mLoop( true ), mReady( false ) {}
+
+			fs::path						mPath;
+			bool							mLoop;
+			//! Reads the sample table and starts decoding, until the slot's movie is opened from it
+			std::future<hap::MovieDecoderRef>	mOpening;
+			MovieGlHapRef					mMovie;
+			//! The movie's first frame is in its texture
+			bool							mReady;
+		};
+
+		//! Opens the movie once its decoder is ready, and uploads its first frame
+		void		prepare( Slot &slot );
+
+		std::map<int, Slot>		mSlots;
+		MovieGlHapRef			mLive;
+		std::atomic<int>		mPendingCut, mLiveIndex;
+		//! Refreshes the pending cut has waited
+		uint32_t				mPendingSince;
+		Stats					mStats;
+	};
+
+} } // namespace cinder::qtime
@@ -0,0 +1,214 @@
+/*
+ *  MovieHapDecodeBudget.cpp
+ *
+ *  Degrades the playback of Hap movies step by step when decoding and uploading fall behind.
+ *
+ */
+
+#include "MovieHapDecodeBudget.h"
+#include "HapDecodeScheduler.h"
+
+#include "cinder/Log.h"
+#include "cinder/app/App.h"
+
+#include <algorithm>
+
+namespace cinder { namespace qtime {
+
+	namespace {
+		const char* getActionName( MovieGlHapDecodeBudget::Action action )
+		{
+			switch( action ) {
+				case MovieGlHapDecodeBudget::Action::FRAME_STEP:	return "frame step";
+				case MovieGlHapDecodeBudget::Action::PROXY:		return "proxy";
+				case MovieGlHapDecodeBudget::Action::DROP_LAYER:	return "dropped layer";
+			}
+			return "";
+		}
+	}
+
+	MovieGlHapDecodeBudget::MovieGlHapDecodeBudget( const Format &format )
+	: mFormat( format ), mFrameStep( 1 ), mWindowStart( -1 ), mCalmSince( -1 ), mWindowRefreshes( 0 )
+	{
+	}
+
+	void MovieGlHapDecodeBudget::add( const MovieGlHapRef &movie, int priority )
+	{
+		if( ! movie->isDecodingInBackground() )
+			return;
+		for( auto &member : mMembers ) {
+			if( member.mMovie == movie ) {
+				member.mPriority = priority;
+				return;
+			}
+		}
+
+		const MovieGlHap::Stats stats = movie->getStats();
+		Member member = { movie, priority, stats.mDecoder.mAverageDecodeTime * stats.mDecoder.mFramesDecoded, stats.mUploadTime, stats.mDecoder.mFramesDropped };
+		mMembers.push_back( member );
+		movie->setFrameStep( mFrameStep );
+	}
+
+	void MovieGlHapDecodeBudget::remove( const MovieGlHapRef &movie )
+	{
+		auto it = std::find_if( mMembers.begin(), mMembers.end(), [&]( const Member &member ) { return member.mMovie == movie; } );
+		if( it == mMembers.end() )
+			return;
+
+		movie->setFrameStep( 1 );
+		for( auto step = mSteps.begin(); step != mSteps.end(); ) {
+			if( step->mMovie == movie ) {
+				if( step->mAction == Action::PROXY )
+					movie->setUseProxy( false );
+				else
+					movie->setSuspended( false );
+				step = mSteps.erase( step );
+			}
+			else
+				++step;
+		}
+		mMembers.erase( it );
+	}
+
+	std::vector<MovieGlHapDecodeBudget::Member*> MovieGlHapDecodeBudget::getMembersByPriority()
+	{
+		std::vector<Member*> members;
+		for( auto &member : mMembers )
+			members.push_back( &member );
+		std::stable_sort( members.begin(), members.end(), []( const Member *a, const Member *b ) { return a->mPriority < b->mPriority; } );
+		return members;
+	}
+
+	void MovieGlHapDecodeBudget::update()
+	{
+		const double now = app::getElapsedSeconds();
+		if( mWindowStart < 0 )
+			mWindowStart = now;
+		mWindowRefreshes++;
+		const double elapsed = now - mWindowStart;
+		if( elapsed < mFormat.mWindow || mMembers.empty() )
+			return;
+
+		// Decode time is spread over the scheduler's threads, upload time all lands on one, this one or the upload thread
+		double decodeTime = 0, uploadTime = 0;
+		uint32_t missedFrames = 0;
+		for( auto &member : mMembers ) {
+			const MovieGlHap::Stats stats = member.mMovie->getStats();
+			const double totalDecodeTime = stats.mDecoder.mAverageDecodeTime * stats.mDecoder.mFramesDecoded;
+			// Late frames aren't counted: the frame at the playhead after every start or seek is already late when it's
+			// scheduled, with the cores idle. Frames dropped for not being ready in time are the overload that shows.
+			const uint32_t totalMissed = stats.mDecoder.mFramesDropped;
+			decodeTime += totalDecodeTime - member.mDecodeTime;
+			uploadTime += stats.mUploadTime - member.mUploadTime;
+			missedFrames += totalMissed - member.mMissedFrames;
+			member.mDecodeTime = totalDecodeTime;
+			member.mUploadTime = stats.mUploadTime;
+			member.mMissedFrames = totalMissed;
+		}
+
+		const uint32_t numThreads = std::max<uint32_t>( 1, hap::DecodeScheduler::get()->getStats().mNumThreads );
+		mStats.mDecodeLoad = decodeTime / ( elapsed * numThreads );
+		mStats.mUploadLoad = uploadTime / ( mWindowRefreshes * mFormat.mFrameBudget );
+		mStats.mMissedFrames = missedFrames;
+		mWindowStart = now;
+		mWindowRefreshes = 0;
+
+		const double load = std::max( mStats.mDecodeLoad, mStats.mUploadLoad );
+		if( load > mFormat.mMaxLoad || missedFrames > 0 ) {
+			degrade( load );
+			mCalmSince = -1;
+		}
+		else if( load < mFormat.mRecoverLoad ) {
+			if( mCalmSince < 0 )
+				mCalmSince = now;
+			else if( now - mCalmSince >= mFormat.mRecoverAfter && ! mSteps.empty() ) {
+				recover( load );
+				mCalmSince = now;
+			}
+		}
+		else
+			mCalmSince = -1;
+	}
+
+	bool MovieGlHapDecodeBudget::degrade( double load )
+	{
+		if( mFormat.mPolicy != Policy::SKIP_FRAMES ) {
+			const std::vector<Member*> members = getMembersByPriority();
+			size_t numActive = 0;
+			for( auto member : members )
+				numActive += member->mMovie->isSuspended() ? 0 : 1;
+
+			for( auto member : members ) {
+				MovieGlHap &movie = *member->mMovie;
+				if( mFormat.mPolicy == Policy::USE_PROXIES && movie.hasProxy() && ! movie.isUsingProxy() ) {
+					movie.setUseProxy( true );
+					Step step = { Action::PROXY, member->mMovie };
+					mSteps.push_back( step );
+					report( Action::PROXY, true, member->mMovie, load );
+					return true;
+				}
+				if( mFormat.mPolicy == Policy::DROP_LAYERS && numActive > 1 && ! movie.isSuspended() ) {
+					movie.setSuspended( true );
+					Step step = { Action::DROP_LAYER, member->mMovie };
+					mSteps.push_back( step );
+					report( Action::DROP_LAYER, true, member->mMovie, load );
+					return true;
+				}
+			}
+		}
+
+		if( mFrameStep >= mFormat.mMaxFrameStep )
+			return false;
+		mFrameStep++;
+		for( auto &member : mMembers )
+			member.mMovie->setFrameStep( mFrameStep );
+		Step step = { Action::FRAME_STEP, nullptr };
+		mSteps.push_back( step );
+		report( Action::FRAME_STEP, true, nullptr, load );
+		return true;
+	}
+
+	void MovieGlHapDecodeBudget::recover( double load )
+	{
+		const Step step = mSteps.back();
+		mSteps.pop_back();
+		switch( step.mAction ) {
+			case Action::FRAME_STEP:
+				mFrameStep--;
+				for( auto &member : mMembers )
+					member.mMovie->setFrameStep( mFrameStep );
+			break;
+			case Action::PROXY:
+				step.mMovie->setUseProxy( false );
+			break;
+			case Action::DROP_LAYER:
+				step.mMovie->setSuspended( false );
+			break;
+		}
+		report( step.mAction, false, step.mMovie, load );
+	}
+
+	void MovieGlHapDecodeBudget::report( Action action, bool degraded, const MovieGlHapRef &movie, double load )
+	{
+		if( degraded )
+			mStats.mDegradations++;
+		else
+			mStats.mRecoveries++;
+		CI_LOG_I( "HAP :: " << ( degraded ? "load " : "recovered, load " ) << load << ", " << ( degraded ? "added " : "removed " ) << getActionName( action )
+			<< " (frame step " << mFrameStep << ", " << mSteps.size() << " steps)" );
+
+		if( mTransitionCallback ) {
+			Transition transition = { app::getElapsedSeconds(), action, degraded, movie, mFrameStep, load };
+			mTransitionCallback( transition );
+		}
+	}
+
+	MovieGlHapDecodeBudget::Stats MovieGlHapDecodeBudget::getStats() const
+	{
+		Stats stats = mStats;
+		stats.mLevel = static_cast<uint32_t>( mSteps.size() );
+		stats.mFrameStep = mFrameStep;
+		return stats;
+	}
+
+} } // namespace cinder::qtime
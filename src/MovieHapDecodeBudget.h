@@ -0,0 +1,133 @@
+/*
+ *  MovieHapDecodeBudget.h
+ *
+ *  Degrades the playback of Hap movies step by step when decoding and uploading fall behind.
+ *
+ */
+#pragma once
+
+#include "MovieHap.h"
+
+#include <functional>
+
+namespace cinder { namespace qtime {
+
+	typedef std::shared_ptr<class MovieGlHapDecodeBudget> MovieGlHapDecodeBudgetRef;
+
+	//! Watches how busy the decode threads are and how long uploads take on the render thread, and when they don't
+	//! fit the frame budget, lowers the load one step at a time as its policy says. Once the load has stayed low for a
+	//! while the steps are undone in reverse order. Every step either way is logged and passed to the transition
+	//! callback. Nothing here ever waits for a decode, so the render loop keeps its pace while frames are shed.
+	class MovieGlHapDecodeBudget {
+	  public:
+		enum class Policy {
+			//! Decodes every second frame of every movie, then every third, up to Format::maxFrameStep()
+			SKIP_FRAMES,
+			//! Switches movies that have a proxy to it, lowest priority first, then skips frames
+			USE_PROXIES,
+			//! Suspends movies, lowest priority first, always keeping the highest one, then skips frames
+			DROP_LAYERS
+		};
+
+		enum class Action { FRAME_STEP, PROXY, DROP_LAYER };
+
+		struct Format {
+			Format() : mFrameBudget( 1 / 60.0 ), mPolicy( Policy::SKIP_FRAMES ), mMaxLoad( 0.9 ), mRecoverLoad( 0.6 ), mWindow( 0.5 ), mRecoverAfter( 3 ), mMaxFrameStep( 4 ) {}
+
+			//! Seconds between display refreshes
+			Format&		frameBudget( double seconds ) { mFrameBudget = seconds; return *this; }
+			Format&		policy( Policy policy ) { mPolicy = policy; return *this; }
+			//! The load is degraded above \a maxLoad, or as soon as frames miss their deadline, and recovers once it has
+			//! stayed below \a recoverLoad for recoverAfter() seconds. 1 is all decode threads busy, or uploads taking
+			//! the whole frame budget.
+			Format&		load( double maxLoad, double recoverLoad ) { mMaxLoad = maxLoad; mRecoverLoad = recoverLoad; return *this; }
+			//! Seconds over which the load is measured before each decision
+			Format&		window( double seconds ) { mWindow = seconds; return *this; }
+			Format&		recoverAfter( double seconds ) { mRecoverAfter = seconds; return *this; }
+			Format&		maxFrameStep( int step ) { mMaxFrameStep = step; return *this; }
+
+			double		mFrameBudget;
+			Policy		mPolicy;
+			double		mMaxLoad, mRecoverLoad;
+			double		mWindow, mRecoverAfter;
+			int			mMaxFrameStep;
+		};
+
+		struct Transition {
+			//! Seconds on the app::getElapsedSeconds() clock
+			double			mTime;
+			Action			mAction;
+			//! True when load was shed, false when a step was undone
+			bool			mDegraded;
+			//! The movie switched or suspended, nullptr for frame steps
+			MovieGlHapRef	mMovie;
+			//! Frame step in force after the transition
+			int				mFrameStep;
+			//! Load that triggered it
+			double			mLoad;
+		};
+
+		struct Stats {
+			Stats() : mDecodeLoad( 0 ), mUploadLoad( 0 ), mMissedFrames( 0 ), mLevel( 0 ), mFrameStep( 1 ), mDegradations( 0 ), mRecoveries( 0 ) {}
+
+			//! Share of the decode threads' time spent decoding the movies, over the last window
+			double		mDecodeLoad;
+			//! Upload time per refresh as a share of the frame budget, over the last window
+			double		mUploadLoad;
+			//! Frames the decoders dropped over the last window
+			uint32_t	mMissedFrames;
+			//! Steps in force
+			uint32_t	mLevel;
+			int			mFrameStep;
+			uint32_t	mDegradations, mRecoveries;
+		};
+
+		static MovieGlHapDecodeBudgetRef create( const Format &format = Format() ) { return MovieGlHapDecodeBudgetRef( new MovieGlHapDecodeBudget( format ) ); }
+
+		//! Movies with a higher \a priority keep their full quality longest. Only movies decoded in the background count.
+		void		add( const MovieGlHapRef &movie, int priority = 0 );
+		//! Undoes the steps applied to \a movie
+		void		remove( const MovieGlHapRef &movie );
+
+		//! Call once per refresh, after the movies have been updated. Decides at the end of each window.
+		void		update();
+
+		void		setTransitionCallback( const std::function<void( const Transition& )> &callback ) { mTransitionCallback = callback; }
+		Stats		getStats() const;
+
+	  private:
+		MovieGlHapDecodeBudget( const Format &format );
+
+		struct Member {
+			MovieGlHapRef	mMovie;
+			int				mPriority;
+			//! Totals when the window started
+			double			mDecodeTime, mUploadTime;
+			uint32_t		mMissedFrames;
+		};
+
+		struct Step {
+			Action			mAction;
+			MovieGlHapRef	mMovie;
+		};
+
+		//! Applies the next step of the policy. Returns false if there's none left.
+		bool		degrade( double load );
+		//! Undoes the last step applied
+		void		recover( double load );
+		void		report( Action action, bool degraded, const MovieGlHapRef &movie, double load );
+		//! Members by priority, lowest first
+		std::vector<Member*>	getMembersByPriority();
+
+		Format					mFormat;
+		std::vector<Member>		mMembers;
+		std::vector<Step>		mSteps;
+		int						mFrameStep;
+
+		double					mWindowStart, mCalmSince;
+		uint32_t				mWindowRefreshes;
+		Stats					mStats;
+		std::function<void( const Transition& )>	mTransitionCallback;
+	};
+
+} } // namespace cinder::qtime
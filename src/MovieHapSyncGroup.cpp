@@ -0,0 +1,152 @@
+/*
+ *  MovieHapSyncGroup.cpp
+ *
+ *  Plays several Hap movies frame-locked to one master clock.
+ *
+ */
+
+#include "MovieHapSyncGroup.h"
+
+#include "cinder/Log.h"
+#include "cinder/app/App.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace cinder { namespace qtime {
+
+	MovieGlHapSyncGroup::MovieGlHapSyncGroup()
+	: mTime( 0 ), mRate( 1 ), mLastUpdateTime( -1 ), mPlaying( false ), mLoop( false ), mShownSample( SIZE_MAX ),
+		mRefreshes( 0 ), mFrameSetsShown( 0 ), mSlips( 0 )
+	{
+	}
+
+	MovieGlHapSyncGroup::~MovieGlHapSyncGroup()
+	{
+		for( auto &movie : mMovies )
+			movie->mObj->mSynced = false;
+	}
+
+	bool MovieGlHapSyncGroup::add( const MovieGlHapRef &movie )
+	{
+		if( ! movie->mObj->mDecoder || movie->mObj->mSampleReader->getNumSamples() == 0 ) {
+			CI_LOG_E( "HAP ERROR :: only movies decoded in the background can be synced" );
+			return false;
+		}
+		if( std::find( mMovies.begin(), mMovies.end(), movie ) != mMovies.end() )
+			return true;
+
+		movie->stop();
+		movie->mObj->mSynced = true;
+		mMovies.push_back( movie );
+		mMemberSlips.push_back( 0 );
+		if( ! mClock )
+			mClock = hap::PresentationClock::create( movie->mObj->mSampleReader );
+		return true;
+	}
+
+	void MovieGlHapSyncGroup::remove( const MovieGlHapRef &movie )
+	{
+		auto it = std::find( mMovies.begin(), mMovies.end(), movie );
+		if( it == mMovies.end() )
+			return;
+
+		movie->mObj->mSynced = false;
+		mMemberSlips.erase( mMemberSlips.begin() + ( it - mMovies.begin() ) );
+		const bool master = it == mMovies.begin();
+		mMovies.erase( it );
+		if( master )
+			mClock = mMovies.empty() ? nullptr : hap::PresentationClock::create( mMovies.front()->mObj->mSampleReader );
+	}
+
+	void MovieGlHapSyncGroup::seekToFrame( size_t frame )
+	{
+		if( mMovies.empty() )
+			return;
+
+		const hap::MovieReader &master = *mMovies.front()->mObj->mSampleReader;
+		const hap::MovieReader::Sample &info = master.getSample( std::min( frame, master.getNumSamples() - 1 ) );
+		mTime = info.mTime / static_cast<double>( master.getTimeScale() );
+	}
+
+	void MovieGlHapSyncGroup::update( double scanOutTime )
+	{
+		const double now = app::getElapsedSeconds();
+		if( mPlaying && mLastUpdateTime >= 0 )
+			mTime += ( now - mLastUpdateTime ) * mRate;
+		mLastUpdateTime = now;
+		if( mMovies.empty() )
+			return;
+
+		const hap::MovieReader &master = *mMovies.front()->mObj->mSampleReader;
+		const double duration = master.getDurationSeconds();
+		if( mLoop && duration > 0 ) {
+			mTime = std::fmod( mTime, duration );
+			if( mTime < 0 )
+				mTime += duration;
+		}
+		else
+			mTime = std::max( 0.0, std::min( mTime, duration ) );
+
+		const double rate = mPlaying ? mRate : 0;
+		const double scanOutDelay = scanOutTime < 0 ? 0 : scanOutTime - now;
+		size_t sample = mClock->selectFrame( mTime + scanOutDelay * rate, rate, mLoop );
+		const double selectionTime = mClock->getLastSelectionTime();
+		mRefreshes++;
+
+		// Members decoding every few frames only have the samples on their step
+		size_t frameStep = 1;
+		for( auto &movie : mMovies )
+			frameStep = std::max<size_t>( frameStep, movie->getFrameStep() );
+		sample -= sample % frameStep;
+
+		// Every member reads ahead from the same frame index, whether or not its samples line up with the master's in time
+		std::vector<hap::MovieDecoder::Frame*> frames( mMovies.size(), nullptr );
+		std::vector<size_t> samples( mMovies.size() );
+		bool ready = true;
+		for( size_t i = 0; i < mMovies.size(); i++ ) {
+			MovieGlHap &movie = *mMovies[i];
+			const hap::MovieReader &reader = *movie.mObj->mSampleReader;
+			samples[i] = std::min( sample, reader.getNumSamples() - 1 );
+			const hap::MovieReader::Sample &info = reader.getSample( samples[i] );
+			const double playhead = reader.getSampleIndex( selectionTime ) == samples[i] ? selectionTime : ( info.mTime + info.mDuration / 2.0 ) / reader.getTimeScale();
+			movie.mObj->mDecoder->setPlayhead( playhead, rate, mLoop );
+
+			// Suspended members hold their frame without holding up the others
+			if( movie.mObj->mUploadedSample == samples[i] || movie.isSuspended() )
+				continue;
+			frames[i] = movie.acquireHapFrame( samples[i] );
+			if( ! frames[i] ) {
+				mMemberSlips[i]++;
+				ready = false;
+			}
+		}
+
+		// Frames acquired but held back stay at the front of their decoder's ring for the next refresh
+		if( ! ready ) {
+			mSlips++;
+			return;
+		}
+
+		for( size_t i = 0; i < mMovies.size(); i++ ) {
+			if( frames[i] )
+				mMovies[i]->presentHapFrame( frames[i], samples[i] );
+		}
+		if( sample != mShownSample )
+			mFrameSetsShown++;
+		mShownSample = sample;
+	}
+
+	MovieGlHapSyncGroup::Stats MovieGlHapSyncGroup::getStats() const
+	{
+		Stats stats;
+		if( mClock )
+			stats.mPresentation = mClock->getStats();
+		stats.mRefreshes = mRefreshes;
+		stats.mFrameSetsShown = mFrameSetsShown;
+		stats.mSlips = mSlips;
+		stats.mMemberSlips = mMemberSlips;
+		return stats;
+	}
+
+} } // namespace cinder::qtime
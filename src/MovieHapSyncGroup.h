@@ -0,0 +1,79 @@
+/*
+ *  MovieHapSyncGroup.h
+ *
+ *  Plays several Hap movies frame-locked to one master clock.
+ *
+ */
+#pragma once
+
+#include "MovieHap.h"
+
+namespace cinder { namespace qtime {
+
+	typedef std::shared_ptr<class MovieGlHapSyncGroup> MovieGlHapSyncGroupRef;
+
+	//! Shows the same frame index in every member on every refresh. Each member keeps decoding on its own, but a new
+	//! frame set is only presented once every member has its frame ready; until then they all hold the previous one.
+	//! The group keeps its own clock, so members are stopped when they're added and their audio isn't heard. Members
+	//! are expected to have the same frame rate, length and frame step, the first one added sets the rate and length.
+	class MovieGlHapSyncGroup {
+	  public:
+		struct Stats {
+			Stats() : mRefreshes( 0 ), mFrameSetsShown( 0 ), mSlips( 0 ) {}
+
+			//! Frames picked from the master clock, as for a single movie
+			hap::PresentationClock::Stats	mPresentation;
+			uint32_t				mRefreshes;
+			//! Refreshes that presented a different frame set from the one before
+			uint32_t				mFrameSetsShown;
+			//! Refreshes on which the frame set due was held back because a member's frame wasn't ready
+			uint32_t				mSlips;
+			//! Slips each member caused, in the order of getMovies()
+			std::vector<uint32_t>	mMemberSlips;
+		};
+
+		static MovieGlHapSyncGroupRef create() { return MovieGlHapSyncGroupRef( new MovieGlHapSyncGroup ); }
+		~MovieGlHapSyncGroup();
+
+		//! Returns false, and leaves the movie alone, if it isn't decoded in the background. From now on its
+		//! getTexture() and draw() show the frames presented by update().
+		bool		add( const MovieGlHapRef &movie );
+		void		remove( const MovieGlHapRef &movie );
+		const std::vector<MovieGlHapRef>&	getMovies() const { return mMovies; }
+
+		void		play() { mPlaying = true; }
+		void		stop() { mPlaying = false; }
+		bool		isPlaying() const { return mPlaying; }
+		//! Negative rates play backwards
+		void		setRate( double rate ) { mRate = rate; }
+		double		getRate() const { return mRate; }
+		void		setLoop( bool loop = true ) { mLoop = loop; }
+		bool		isLooping() const { return mLoop; }
+		void		seekToTime( double seconds ) { mTime = seconds; }
+		void		seekToFrame( size_t frame );
+		//! Time of the master clock in seconds
+		double		getCurrentTime() const { return mTime; }
+		//! Index of the frame set on screen, SIZE_MAX before the first one is presented
+		size_t		getCurrentFrame() const { return mShownSample; }
+
+		//! Call once per display refresh before drawing the members. Advances the master clock and presents the frame
+		//! set due, if every member has decoded its frame. \a scanOutTime is as for MovieGlHap::setScanOutTime().
+		void		update( double scanOutTime = -1 );
+
+		Stats		getStats() const;
+
+	  private:
+		MovieGlHapSyncGroup();
+
+		std::vector<MovieGlHapRef>	mMovies;
+		//! Picks frames on the first member's sample table
+		hap::PresentationClockRef	mClock;
+
+		double					mTime, mRate, mLastUpdateTime;
+		bool					mPlaying, mLoop;
+		size_t					mShownSample;
+		uint32_t				mRefreshes, mFrameSetsShown, mSlips;
+		std::vector<uint32_t>	mMemberSlips;
+	};
+
+} } // namespace cinder::qtime
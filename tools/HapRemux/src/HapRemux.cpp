@@ -0,0 +1,117 @@
+/*
+ *  HapRemux.cpp
+ *
+ *  Command-line trimming, cutting and joining of Hap movies without re-encoding.
+ *
+ */
+
+#include "cinder/Cinder.h"
+#include "cinder/Timer.h"
+
+#include "HapRemuxer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+using namespace ci;
+using namespace std;
+
+//! An input movie and the parts of it to keep
+struct Input {
+	Input( const fs::path &path ) : mPath( path ), mIn( 0 ), mOut( -1 ) {}
+
+	fs::path					mPath;
+	double						mIn, mOut;
+	vector<pair<double, double>>	mCuts;
+};
+
+static void printUsage()
+{
+	cout << "Usage: HapRemux <input> [--in <t>] [--out <t>] [--cut <t1>-<t2>]... [<input> ...] -o <output>" << endl
+		<< "  Joins the inputs, in order, into one movie. Frames are copied as they are, so the inputs" << endl
+		<< "  must share codec and dimensions. Times are in seconds and apply to the preceding input." << endl
+		<< endl
+		<< "  --in <t>          Start the input at <t>" << endl
+		<< "  --out <t>         End the input at <t>" << endl
+		<< "  --cut <t1>-<t2>   Remove <t1> up to <t2> from the input (repeatable)" << endl;
+}
+
+static bool parseArgs( int argc, char *argv[], vector<Input> *inputs, fs::path *output )
+{
+	for( int i = 1; i < argc; i++ ) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if( arg == "-o" && hasValue )
+			*output = argv[++i];
+		else if( ( arg == "--in" || arg == "--out" || arg == "--cut" ) && hasValue ) {
+			if( inputs->empty() )
+				return false;
+			Input &input = inputs->back();
+			if( arg == "--in" )
+				input.mIn = stod( argv[++i] );
+			else if( arg == "--out" )
+				input.mOut = stod( argv[++i] );
+			else {
+				double from, to;
+				if( sscanf( argv[++i], "%lf-%lf", &from, &to ) != 2 || to <= from )
+					return false;
+				input.mCuts.push_back( make_pair( from, to ) );
+			}
+		}
+		else if( arg.size() > 1 && arg[0] == '-' )
+			return false;
+		else
+			inputs->push_back( Input( arg ) );
+	}
+
+	return ! inputs->empty() && ! output->empty();
+}
+
+int main( int argc, char *argv[] )
+{
+	vector<Input> inputs;
+	fs::path output;
+	try {
+		if( ! parseArgs( argc, argv, &inputs, &output ) ) {
+			printUsage();
+			return 1;
+		}
+	}
+	catch( const exception & ) {
+		printUsage();
+		return 1;
+	}
+
+	try {
+		Timer timer( true );
+		auto remuxer = hap::Remuxer::create();
+		for( auto &input : inputs ) {
+			auto reader = hap::MovieReader::create( input.mPath );
+			double out = input.mOut < 0 ? reader->getDurationSeconds() : min( input.mOut, reader->getDurationSeconds() );
+
+			// Cuts split [in, out) into the ranges that are kept
+			sort( input.mCuts.begin(), input.mCuts.end() );
+			double start = input.mIn;
+			for( const auto &cut : input.mCuts ) {
+				if( cut.first > start )
+					remuxer->addRange( reader, start, min( cut.first, out ) );
+				start = max( start, cut.second );
+			}
+			remuxer->addRange( reader, start, out );
+		}
+
+		remuxer->write( output );
+		timer.stop();
+
+		printf( "%s: %u frames, %.2f s, written in %.2f s (%.1f MB/s)\n", output.string().c_str(), static_cast<unsigned>( remuxer->getNumFrames() ), remuxer->getDuration(),
+				timer.getSeconds(), fs::file_size( output ) / timer.getSeconds() / ( 1024 * 1024 ) );
+	}
+	catch( const exception &exc ) {
+		cerr << exc.what() << endl;
+		return 1;
+	}
+
+	return 0;
+}
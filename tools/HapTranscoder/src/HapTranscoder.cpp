@@ -0,0 +1,495 @@
+/*
+ *  HapTranscoder.cpp
+ *
+ *  Command-line batch transcoder from image sequences or raw RGBA files to Hap movies.
+ *
+ *  Every job runs as a pipeline of read, convert (RGBA to DXT), compress (Snappy and Hap
+ *  framing) and mux stages on their own threads. A fixed pool of frames circulates through
+ *  the stages, so a slow stage holds up the ones before it instead of letting queues grow.
+ *
+ */
+
+#include "cinder/Cinder.h"
+#include "cinder/ConcurrentCircularBuffer.h"
+#include "cinder/ImageIo.h"
+#include "cinder/Surface.h"
+#include "cinder/Thread.h"
+#include "cinder/Timer.h"
+
+#include "HapEncoder.h"
+#include "HapMovieWriter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <thread>
+
+using namespace ci;
+using namespace std;
+
+struct Options {
+	Options()
+	: mCodec( hap::Codec::HAP ), mCompressor( hap::Compressor::SNAPPY ), mQuality( hap::dxt::Quality::HIGH ), mFrameRate( 30.0 ),
+		mWidth( 0 ), mHeight( 0 ), mChunkCount( 1 ), mConvertThreads( max( 1u, thread::hardware_concurrency() ) ),
+		mReadWorkers( 2 ), mCompressWorkers( 2 ), mFramesInFlight( 16 ), mTemporalReuse( true )
+	{}
+
+	hap::Codec				mCodec;
+	hap::Compressor			mCompressor;
+	hap::dxt::Quality		mQuality;
+	double					mFrameRate;
+	int32_t					mWidth, mHeight;		// raw RGBA input only
+	uint32_t				mChunkCount, mConvertThreads, mReadWorkers, mCompressWorkers, mFramesInFlight;
+	bool					mTemporalReuse;
+	vector<fs::path>		mInputs;
+	fs::path				mOutput;
+};
+
+//! Describes one input: either a folder of images or a raw RGBA file, and the movie it becomes
+struct Job {
+	fs::path			mOutput;
+	vector<fs::path>	mImages;
+	fs::path			mRawFile;
+	int32_t				mWidth, mHeight;
+	uint32_t			mNumFrames;
+};
+
+struct Frame {
+	uint32_t			mIndex;
+	Surface8u			mSurface;
+	vector<uint8_t>		mRaw;
+	const uint8_t		*mPixels;
+	ptrdiff_t			mRowBytes;
+	vector<uint8_t>		mDxt;
+	vector<uint8_t>		mEncoded;
+};
+typedef shared_ptr<Frame> FrameRef;
+
+//! Per-stage counters. Busy time is summed over all of a stage's workers.
+struct StageStats {
+	StageStats( const string &name, uint32_t workers ) : mName( name ), mWorkers( workers ), mFrames( 0 ), mBytes( 0 ), mBusyMicros( 0 ) {}
+
+	void add( uint64_t bytes, const Timer &timer )
+	{
+		mFrames++;
+		mBytes += bytes;
+		mBusyMicros += static_cast<uint64_t>( timer.getSeconds() * 1e6 );
+	}
+
+	void print( double wallSeconds ) const
+	{
+		double busy = mBusyMicros / 1e6;
+		double fpsPerWorker = busy > 0 ? mFrames / busy : 0;
+		double utilization = wallSeconds > 0 ? busy / ( wallSeconds * mWorkers ) * 100.0 : 0;
+		printf( "  %-9s %2u worker(s)  %6.1f fps/worker  %8.1f MB/s/worker  %5.1f%% busy\n",
+				mName.c_str(), mWorkers, fpsPerWorker, busy > 0 ? mBytes / busy / ( 1024 * 1024 ) : 0, utilization );
+	}
+
+	string					mName;
+	uint32_t				mWorkers;
+	atomic<uint64_t>		mFrames, mBytes, mBusyMicros;
+};
+
+class Transcoder {
+  public:
+	Transcoder( const Options &options, const Job &job );
+	bool run();
+
+  private:
+	void readLoop();
+	void convertLoop();
+	void compressLoop();
+	void muxLoop();
+
+	void fail( const string &error );
+
+	const Options						&mOptions;
+	const Job							&mJob;
+	hap::EncoderRef						mEncoder;
+	hap::MovieWriterRef					mWriter;
+
+	ConcurrentCircularBuffer<FrameRef>	mFreeFrames, mReadFrames, mConvertedFrames, mCompressedFrames;
+	atomic<uint32_t>					mNextReadIndex;
+	atomic<bool>						mFailed;
+	mutex								mErrorMutex;
+	string								mError;
+
+	StageStats							mReadStats, mConvertStats, mCompressStats, mMuxStats;
+};
+
+Transcoder::Transcoder( const Options &options, const Job &job )
+: mOptions( options ), mJob( job ),
+	mFreeFrames( options.mFramesInFlight ), mReadFrames( options.mFramesInFlight ),
+	mConvertedFrames( options.mFramesInFlight + options.mCompressWorkers ), mCompressedFrames( options.mFramesInFlight ),
+	mNextReadIndex( 0 ), mFailed( false ),
+	mReadStats( "read", options.mReadWorkers ), mConvertStats( "convert", 1 ),
+	mCompressStats( "compress", options.mCompressWorkers ), mMuxStats( "mux", 1 )
+{
+	mEncoder = hap::Encoder::create( job.mWidth, job.mHeight, hap::Encoder::Format()
+										.codec( options.mCodec ).compressor( options.mCompressor ).quality( options.mQuality )
+										.chunkCount( options.mChunkCount ).numThreads( options.mConvertThreads )
+										.temporalReuse( options.mTemporalReuse ) );
+	mWriter = hap::MovieWriter::create( job.mOutput, job.mWidth, job.mHeight, hap::MovieWriter::Format()
+										.codec( options.mCodec ).frameRate( options.mFrameRate ) );
+
+	for( uint32_t i = 0; i < options.mFramesInFlight; i++ )
+		mFreeFrames.pushFront( make_shared<Frame>() );
+}
+
+void Transcoder::fail( const string &error )
+{
+	{
+		lock_guard<mutex> lock( mErrorMutex );
+		if( mError.empty() )
+			mError = error;
+	}
+	mFailed = true;
+	mFreeFrames.cancel();
+	mReadFrames.cancel();
+	mConvertedFrames.cancel();
+	mCompressedFrames.cancel();
+}
+
+void Transcoder::readLoop()
+{
+	ThreadSetup threadSetup;
+	ifstream raw;
+
+	try {
+		while( ! mFailed ) {
+			// Taking a free frame first is what applies back-pressure to the whole pipeline
+			FrameRef frame;
+			mFreeFrames.popBack( &frame );
+			if( ! frame )
+				return;
+
+			uint32_t index = mNextReadIndex++;
+			if( index >= mJob.mNumFrames ) {
+				mFreeFrames.pushFront( frame );
+				return;
+			}
+
+			Timer timer( true );
+			frame->mIndex = index;
+			if( mJob.mImages.empty() ) {
+				const size_t frameSize = static_cast<size_t>( mJob.mWidth ) * mJob.mHeight * 4;
+				if( ! raw.is_open() )
+					raw.open( mJob.mRawFile.string().c_str(), ios::binary );
+				frame->mRaw.resize( frameSize );
+				raw.seekg( static_cast<streamoff>( index ) * frameSize );
+				raw.read( reinterpret_cast<char*>( frame->mRaw.data() ), frameSize );
+				if( ! raw )
+					throw runtime_error( "Couldn't read frame " + to_string( index ) + " of " + mJob.mRawFile.string() );
+				frame->mPixels = frame->mRaw.data();
+				frame->mRowBytes = mJob.mWidth * 4;
+			}
+			else {
+				// The base SurfaceConstraints always yield RGBA, unlike the platform defaults
+				frame->mSurface = Surface8u( loadImage( mJob.mImages[index] ), SurfaceConstraints(), true );
+				if( frame->mSurface.getWidth() != mJob.mWidth || frame->mSurface.getHeight() != mJob.mHeight )
+					throw runtime_error( mJob.mImages[index].string() + " doesn't match the size of the first image." );
+				frame->mPixels = frame->mSurface.getData();
+				frame->mRowBytes = frame->mSurface.getRowBytes();
+			}
+			timer.stop();
+			mReadStats.add( static_cast<uint64_t>( mJob.mHeight ) * frame->mRowBytes, timer );
+
+			mReadFrames.pushFront( frame );
+		}
+	}
+	catch( const exception &exc ) {
+		fail( exc.what() );
+	}
+}
+
+void Transcoder::convertLoop()
+{
+	ThreadSetup threadSetup;
+
+	try {
+		// Readers finish out of order; frames are converted in order so later stages see a steady stream
+		map<uint32_t, FrameRef> pending;
+		for( uint32_t next = 0; next < mJob.mNumFrames && ! mFailed; ) {
+			auto it = pending.find( next );
+			if( it == pending.end() ) {
+				FrameRef frame;
+				mReadFrames.popBack( &frame );
+				if( frame )
+					pending[frame->mIndex] = frame;
+				continue;
+			}
+
+			FrameRef frame = it->second;
+			pending.erase( it );
+
+			Timer timer( true );
+			mEncoder->convert( frame->mPixels, frame->mRowBytes, &frame->mDxt );
+			frame->mSurface = Surface8u();
+			timer.stop();
+			mConvertStats.add( frame->mDxt.size(), timer );
+
+			mConvertedFrames.pushFront( frame );
+			next++;
+		}
+
+		// One empty frame per compress worker tells them to finish
+		for( uint32_t i = 0; i < mOptions.mCompressWorkers; i++ )
+			mConvertedFrames.pushFront( FrameRef() );
+	}
+	catch( const exception &exc ) {
+		fail( exc.what() );
+	}
+}
+
+void Transcoder::compressLoop()
+{
+	ThreadSetup threadSetup;
+
+	try {
+		while( ! mFailed ) {
+			FrameRef frame;
+			mConvertedFrames.popBack( &frame );
+			if( ! frame )
+				return;
+
+			Timer timer( true );
+			mEncoder->compress( frame->mDxt, &frame->mEncoded );
+			timer.stop();
+			mCompressStats.add( frame->mDxt.size(), timer );
+
+			mCompressedFrames.pushFront( frame );
+		}
+	}
+	catch( const exception &exc ) {
+		fail( exc.what() );
+	}
+}
+
+void Transcoder::muxLoop()
+{
+	ThreadSetup threadSetup;
+
+	try {
+		map<uint32_t, FrameRef> pending;
+		for( uint32_t next = 0; next < mJob.mNumFrames && ! mFailed; ) {
+			auto it = pending.find( next );
+			if( it == pending.end() ) {
+				FrameRef frame;
+				mCompressedFrames.popBack( &frame );
+				if( frame )
+					pending[frame->mIndex] = frame;
+				continue;
+			}
+
+			FrameRef frame = it->second;
+			pending.erase( it );
+
+			Timer timer( true );
+			mWriter->addFrame( frame->mEncoded );
+			timer.stop();
+			mMuxStats.add( frame->mEncoded.size(), timer );
+
+			mFreeFrames.pushFront( frame );
+			next++;
+
+			if( next % 100 == 0 )
+				printf( "  %u / %u frames\n", next, mJob.mNumFrames );
+		}
+
+		if( ! mFailed )
+			mWriter->finish();
+	}
+	catch( const exception &exc ) {
+		fail( exc.what() );
+	}
+}
+
+bool Transcoder::run()
+{
+	Timer wallTimer( true );
+
+	vector<thread> threads;
+	for( uint32_t i = 0; i < mOptions.mReadWorkers; i++ )
+		threads.emplace_back( &Transcoder::readLoop, this );
+	threads.emplace_back( &Transcoder::convertLoop, this );
+	for( uint32_t i = 0; i < mOptions.mCompressWorkers; i++ )
+		threads.emplace_back( &Transcoder::compressLoop, this );
+	threads.emplace_back( &Transcoder::muxLoop, this );
+
+	for( auto &thread : threads )
+		thread.join();
+	wallTimer.stop();
+
+	if( mFailed ) {
+		cerr << "  failed: " << mError << endl;
+		return false;
+	}
+
+	double wall = wallTimer.getSeconds();
+	printf( "  %u frames in %.2f s, %.1f fps, %.1f MB written, %u duplicate frames stored once\n", mJob.mNumFrames, wall, mJob.mNumFrames / wall,
+			mWriter->getDataSize() / ( 1024.0 * 1024.0 ), mWriter->getNumDuplicateFrames() );
+	mReadStats.print( wall );
+	mConvertStats.print( wall );
+	mCompressStats.print( wall );
+	mMuxStats.print( wall );
+	return true;
+}
+
+// Builds a job for an input folder or raw file. Returns false and reports why if the input can't be used.
+static bool makeJob( const Options &options, const fs::path &input, Job *job )
+{
+	static const set<string> kImageExtensions = { ".png", ".jpg", ".jpeg", ".tif", ".tiff", ".bmp", ".tga", ".exr" };
+
+	fs::path output = options.mOutput;
+	if( options.mInputs.size() > 1 || fs::is_directory( output ) )
+		output = output / ( input.filename().string() + ".mov" );
+	job->mOutput = output;
+
+	if( fs::is_directory( input ) ) {
+		for( fs::directory_iterator it( input ), end; it != end; ++it ) {
+			string extension = it->path().extension().string();
+			transform( extension.begin(), extension.end(), extension.begin(), ::tolower );
+			if( kImageExtensions.count( extension ) )
+				job->mImages.push_back( it->path() );
+		}
+		// Sequences are expected to be named so that they sort in frame order
+		sort( job->mImages.begin(), job->mImages.end() );
+		if( job->mImages.empty() ) {
+			cerr << input << " contains no images." << endl;
+			return false;
+		}
+
+		auto first = loadImage( job->mImages.front() );
+		job->mWidth = first->getWidth();
+		job->mHeight = first->getHeight();
+		job->mNumFrames = static_cast<uint32_t>( job->mImages.size() );
+		return true;
+	}
+
+	if( options.mWidth <= 0 || options.mHeight <= 0 ) {
+		cerr << "Raw RGBA input " << input << " needs --size." << endl;
+		return false;
+	}
+	job->mRawFile = input;
+	job->mWidth = options.mWidth;
+	job->mHeight = options.mHeight;
+	job->mNumFrames = static_cast<uint32_t>( fs::file_size( input ) / ( static_cast<uint64_t>( options.mWidth ) * options.mHeight * 4 ) );
+	if( job->mNumFrames == 0 ) {
+		cerr << input << " is smaller than one frame." << endl;
+		return false;
+	}
+	return true;
+}
+
+static void printUsage()
+{
+	cout << "Usage: HapTranscoder [options] <input>... -o <output>" << endl
+		<< "  Each input is a folder of images or a file of raw 8-bit RGBA frames." << endl
+		<< "  With several inputs, <output> is a folder and each movie is named after its input." << endl
+		<< endl
+		<< "  --codec hap|hapa|hapq     Hap flavour (default hap)" << endl
+		<< "  --fps <rate>              Frame rate (default 30, NTSC rates such as 29.97 are exact)" << endl
+		<< "  --size <w>x<h>            Frame size of raw RGBA input" << endl
+		<< "  --chunks <n>              Independently compressed chunks per frame (default 1)" << endl
+		<< "  --quality fast|high       DXT endpoint search (default high)" << endl
+		<< "  --no-snappy               Store DXT data without second-stage compression" << endl
+		<< "  --no-reuse                Compress every block, even those unchanged since the previous frame" << endl
+		<< "  --convert-threads <n>     Threads converting each frame to DXT (default: all cores)" << endl
+		<< "  --read-workers <n>        Concurrent image readers (default 2)" << endl
+		<< "  --compress-workers <n>    Concurrent Snappy compressors (default 2)" << endl
+		<< "  --frames-in-flight <n>    Frames buffered across all stages (default 16)" << endl;
+}
+
+static bool parseOptions( int argc, char *argv[], Options *options )
+{
+	for( int i = 1; i < argc; i++ ) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		auto value = [&]() { return string( argv[++i] ); };
+		auto count = [&]() { return static_cast<uint32_t>( max( 1, stoi( value() ) ) ); };
+
+		if( arg == "-o" && hasValue )
+			options->mOutput = value();
+		else if( arg == "--codec" && hasValue ) {
+			string codec = value();
+			if( codec == "hap" )
+				options->mCodec = hap::Codec::HAP;
+			else if( codec == "hapa" )
+				options->mCodec = hap::Codec::HAP_A;
+			else if( codec == "hapq" )
+				options->mCodec = hap::Codec::HAP_Q;
+			else
+				return false;
+		}
+		else if( arg == "--fps" && hasValue )
+			options->mFrameRate = stod( value() );
+		else if( arg == "--size" && hasValue ) {
+			if( sscanf( argv[++i], "%dx%d", &options->mWidth, &options->mHeight ) != 2 )
+				return false;
+		}
+		else if( arg == "--chunks" && hasValue )
+			options->mChunkCount = count();
+		else if( arg == "--quality" && hasValue )
+			options->mQuality = value() == "fast" ? hap::dxt::Quality::FAST : hap::dxt::Quality::HIGH;
+		else if( arg == "--no-snappy" )
+			options->mCompressor = hap::Compressor::NONE;
+		else if( arg == "--no-reuse" )
+			options->mTemporalReuse = false;
+		else if( arg == "--convert-threads" && hasValue )
+			options->mConvertThreads = count();
+		else if( arg == "--read-workers" && hasValue )
+			options->mReadWorkers = count();
+		else if( arg == "--compress-workers" && hasValue )
+			options->mCompressWorkers = count();
+		else if( arg == "--frames-in-flight" && hasValue )
+			options->mFramesInFlight = max<uint32_t>( 2, count() );
+		else if( arg.size() > 1 && arg[0] == '-' )
+			return false;
+		else
+			options->mInputs.push_back( arg );
+	}
+
+	return ! options->mInputs.empty() && ! options->mOutput.empty();
+}
+
+int main( int argc, char *argv[] )
+{
+	Options options;
+	try {
+		if( ! parseOptions( argc, argv, &options ) ) {
+			printUsage();
+			return 1;
+		}
+	}
+	catch( const exception & ) {
+		printUsage();
+		return 1;
+	}
+
+	int failures = 0;
+	for( const auto &input : options.mInputs ) {
+		try {
+			Job job;
+			if( ! makeJob( options, input, &job ) ) {
+				failures++;
+				continue;
+			}
+
+			cout << input.string() << " -> " << job.mOutput.string() << " (" << job.mWidth << "x" << job.mHeight << ", " << job.mNumFrames << " frames)" << endl;
+			Transcoder transcoder( options, job );
+			if( ! transcoder.run() )
+				failures++;
+		}
+		catch( const exception &exc ) {
+			cerr << input.string() << ": " << exc.what() << endl;
+			failures++;
+		}
+	}
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,134 @@
+/*
+ *  HapUploadCheck.cpp
+ *
+ *  Headless round trip of encoded Hap frames through the CPU upload backend.
+ *
+ */
+
+#include "cinder/Cinder.h"
+
+#include "HapDecoder.h"
+#include "HapEncoder.h"
+#include "HapUploadBackend.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace ci;
+using namespace std;
+
+//! Largest mean and per-channel difference from the source frame still within the usual DXT error
+static const double		kMaxMeanError = 4;
+static const int		kMaxError = 32;
+
+static const char* getCodecName( hap::Codec codec )
+{
+	switch( codec ) {
+		case hap::Codec::HAP_A:	return "Hap Alpha";
+		case hap::Codec::HAP_Q:	return "Hap Q";
+		default:				return "Hap";
+	}
+}
+
+//! Gradients in every channel, with alpha varying only where the codec keeps it
+static vector<uint8_t> makeFrame( int32_t width, int32_t height, hap::Codec codec )
+{
+	vector<uint8_t> rgba( static_cast<size_t>( width ) * height * 4 );
+	for( int32_t y = 0; y < height; y++ ) {
+		for( int32_t x = 0; x < width; x++ ) {
+			uint8_t *pixel = &rgba[( static_cast<size_t>( y ) * width + x ) * 4];
+			pixel[0] = static_cast<uint8_t>( x * 255 / width );
+			pixel[1] = static_cast<uint8_t>( y * 255 / height );
+			pixel[2] = static_cast<uint8_t>( ( x + y ) * 2 );
+			pixel[3] = codec == hap::Codec::HAP_A ? static_cast<uint8_t>( x * 4 ) : 255;
+		}
+	}
+	return rgba;
+}
+
+//! Uploads \a dxt whole, or \a bandRows block rows at a time, and returns the pixels fenced
+static vector<uint8_t> roundTrip( const hap::UploadBackend::FrameFormat &format, const vector<uint8_t> &dxt, uint32_t bandRows )
+{
+	auto backend = hap::CpuUploadBackend::create();
+	backend->create( format );
+	if( bandRows == 0 )
+		backend->upload( dxt.data(), dxt.size() );
+	else {
+		for( uint32_t row = 0; row < format.getBlocksHigh(); row += bandRows )
+			backend->uploadRows( dxt.data(), dxt.size(), row, bandRows );
+	}
+	backend->fence();
+
+	const hap::UploadBackend::Stats stats = backend->getStats();
+	if( stats.mCreates != 1 || stats.mUploads != 1 ) {
+		cerr << "  expected one create and one upload, got " << stats.mCreates << " and " << stats.mUploads << endl;
+		return vector<uint8_t>();
+	}
+	return backend->getPixels();
+}
+
+//! Checks one frame size and codec. Returns false, having said why, if any check fails.
+static bool check( int32_t width, int32_t height, hap::Codec codec )
+{
+	const vector<uint8_t> source = makeFrame( width, height, codec );
+	vector<uint8_t> frame, dxt;
+	hap::Encoder::create( width, height, hap::Encoder::Format().codec( codec ) )->encode( source.data(), width * 4, &frame );
+	const uint8_t textureFormat = hap::decodeFrame( frame.data(), frame.size(), &dxt );
+
+	const uint32_t roundedWidth = ( width + 3 ) & ~3, roundedHeight = ( height + 3 ) & ~3;
+	const hap::UploadBackend::FrameFormat format( width, height, roundedWidth, roundedHeight, textureFormat );
+	const vector<uint8_t> pixels = roundTrip( format, dxt, 0 );
+
+	bool ok = pixels.size() == source.size();
+	double totalError = 0;
+	int maxError = 0;
+	for( size_t i = 0; ok && i < source.size(); i++ ) {
+		const int error = abs( pixels[i] - source[i] );
+		totalError += error;
+		maxError = max( maxError, error );
+	}
+	const double meanError = source.empty() ? 0 : totalError / source.size();
+	ok = ok && meanError <= kMaxMeanError && maxError <= kMaxError;
+
+	// The same blocks, padded by two block columns and a block row, and uploaded in bands, must give the same pixels
+	const hap::UploadBackend::FrameFormat paddedFormat( width, height, roundedWidth + 8, roundedHeight + 4, textureFormat );
+	const size_t rowBytes = format.getRowPitch();
+	vector<uint8_t> padded( paddedFormat.getRowPitch() * paddedFormat.getBlocksHigh(), 0xee );
+	for( uint32_t row = 0; row < format.getBlocksHigh(); row++ )
+		memcpy( &padded[row * paddedFormat.getRowPitch()], &dxt[row * rowBytes], rowBytes );
+	const bool paddedOk = roundTrip( paddedFormat, padded, 0 ) == pixels;
+	const bool bandsOk = roundTrip( paddedFormat, padded, 5 ) == pixels;
+
+	printf( "%-9s %3dx%-3d mean error %.2f, max %d%s%s%s\n", getCodecName( codec ), width, height, meanError, maxError,
+			ok ? "" : " FAILED", paddedOk ? "" : ", padded rows differ", bandsOk ? "" : ", bands differ" );
+	return ok && paddedOk && bandsOk;
+}
+
+int main( int argc, char *[] )
+{
+	if( argc > 1 ) {
+		cout << "Usage: HapUploadCheck" << endl
+			<< "  Encodes test frames, decodes them and uploads them through the CPU upload backend, at sizes" << endl
+			<< "  that are and aren't multiples of 4, with padded rows and in bands. Exits with 1 if any differ." << endl;
+		return 1;
+	}
+
+	bool ok = true;
+	try {
+		const int32_t sizes[][2] = { { 64, 48 }, { 70, 48 }, { 64, 37 }, { 70, 37 } };
+		for( const auto &size : sizes ) {
+			for( hap::Codec codec : { hap::Codec::HAP, hap::Codec::HAP_A, hap::Codec::HAP_Q } )
+				ok = check( size[0], size[1], codec ) && ok;
+		}
+	}
+	catch( const exception &exc ) {
+		cerr << exc.what() << endl;
+		return 1;
+	}
+
+	cout << ( ok ? "All frames round-trip." : "Some frames don't round-trip." ) << endl;
+	return ok ? 0 : 1;
+}